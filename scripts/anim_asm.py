@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Assembler for the animation bytecode of src/anim_vm.h.
+#
+# Code lines are "[label:] op operands", registers are r0..r7, immediates are
+# decimal or 0x hex, jump targets are labels. After ".data" a line defines a
+# keyframe table: "label: keyframes <ease> time:value ...". '#' starts a
+# comment.
+#
+#   loop:   time r0
+#           keyf r1, r0, fade
+#           ldi  r2, 0
+#           hsv  r3, r1, r4, r4
+#           ...
+#   .data
+#   fade:   keyframes smooth 0:0 1000:1535 2000:0
+#
+# Usage: anim_asm.py <source> <output>
+#   then: mcumgr <connection options> fs upload <output> /lfs/anim/<pattern>
+
+import struct
+import sys
+
+MAGIC = 0x4E41
+VERSION = 1
+
+# name: (opcode, operand kinds), R register, E ease, I immediate, C code, D data
+OPS = {
+    "end": (0, ""),
+    "ldi": (1, "RI"),
+    "mov": (2, "RR"),
+    "add": (3, "RR"),
+    "sub": (4, "RR"),
+    "mul": (5, "RR"),
+    "div": (6, "RR"),
+    "mod": (7, "RR"),
+    "time": (8, "R"),
+    "npix": (9, "R"),
+    "ease": (10, "RRE"),
+    "lerp": (11, "RRRR"),
+    "hsv": (12, "RRRR"),
+    "rgb": (13, "RRRR"),
+    "fill": (14, "RRR"),
+    "grad": (15, "RRRR"),
+    "pixel": (16, "RR"),
+    "jmp": (17, "C"),
+    "jz": (18, "RC"),
+    "jlt": (19, "RRC"),
+    "loop": (20, "RC"),
+    "keyf": (21, "RRD"),
+}
+
+EASES = ["linear", "in", "out", "in_out", "smooth"]
+
+
+def fail(lineno, msg):
+    sys.exit(f"line {lineno}: {msg}")
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    # Zephyr's crc16_ccitt: reflected polynomial 0x8408
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def parse(path):
+    code, data = [], []
+    section = code
+    for lineno, line in enumerate(open(path), 1):
+        line = line.split("#")[0].strip()
+        if not line:
+            continue
+        if line == ".data":
+            section = data
+            continue
+        label = None
+        if ":" in line.split()[0]:
+            label, line = line.split(":", 1)
+            label, line = label.strip(), line.strip()
+        section.append((lineno, label, line))
+    return code, data
+
+
+def assemble(path):
+    code_lines, data_lines = parse(path)
+
+    data = bytearray()
+    data_labels = {}
+    for lineno, label, line in data_lines:
+        words = line.split()
+        if not label or len(words) < 4 or words[0] != "keyframes" or words[1] not in EASES:
+            fail(lineno, "expected 'label: keyframes <ease> time:value time:value ...'")
+        frames = [tuple(int(v, 0) for v in w.split(":")) for w in words[2:]]
+        data_labels[label] = len(data)
+        data += struct.pack("<BB", len(frames), EASES.index(words[1]))
+        for time, value in frames:
+            data += struct.pack("<Hh", time, value)
+
+    # First pass for the code labels, every instruction has a fixed size
+    code_labels = {}
+    pc = 0
+    parsed = []
+    for lineno, label, line in code_lines:
+        if label:
+            code_labels[label] = pc
+        if not line:
+            continue
+        name, _, rest = line.partition(" ")
+        if name not in OPS:
+            fail(lineno, f"unknown op '{name}'")
+        opcode, kinds = OPS[name]
+        operands = [o.strip() for o in rest.split(",")] if rest.strip() else []
+        if len(operands) != len(kinds):
+            fail(lineno, f"'{name}' takes {len(kinds)} operands")
+        parsed.append((lineno, opcode, kinds, operands))
+        pc += 1 + sum(2 if k in "ICD" else 1 for k in kinds)
+
+    code = bytearray()
+    for lineno, opcode, kinds, operands in parsed:
+        regs, tail = bytearray([opcode]), bytearray()
+        for kind, operand in zip(kinds, operands):
+            if kind == "R":
+                if not (operand.startswith("r") and operand[1:].isdigit() and int(operand[1:]) < 8):
+                    fail(lineno, f"bad register '{operand}'")
+                regs.append(int(operand[1:]))
+            elif kind == "E":
+                if operand not in EASES:
+                    fail(lineno, f"bad ease '{operand}'")
+                regs.append(EASES.index(operand))
+            elif kind == "I":
+                tail += struct.pack("<h", int(operand, 0))
+            elif kind == "C":
+                if operand not in code_labels:
+                    fail(lineno, f"unknown label '{operand}'")
+                tail += struct.pack("<H", code_labels[operand])
+            else:
+                if operand not in data_labels:
+                    fail(lineno, f"unknown table '{operand}'")
+                tail += struct.pack("<H", data_labels[operand])
+        code += regs + tail
+
+    header = struct.pack("<HBBHHH", MAGIC, VERSION, 0, len(code), len(data), crc16_ccitt(code + data))
+    return header + code + data
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(f"usage: {sys.argv[0]} <source> <output>")
+    image = assemble(sys.argv[1])
+    open(sys.argv[2], "wb").write(image)
+    print(f"{sys.argv[2]}: {len(image)} bytes")
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Throughput and added latency of the USB to BLE bridge.
+#
+# Keeps --window writes to one light in flight and reports the acknowledged
+# writes per second and the send to reply time. The ping round trip measured
+# first is the USB share of it, the rest is added by the bridge and the
+# light. The "bridge" stats split the controller side into the time a write
+# was queued and the time the light took to answer it. Notifications that
+# arrive meanwhile are counted, gaps in their seq are lost ones.
+#
+# Usage: bridge_bench.py <port> --light N [--char indicator] [--data 00]
+#                        [--window 8] [--no-rsp] [--seconds 10]
+
+import argparse
+import errno
+import time
+
+from rgbled_host import CHARS, MSG_WRITE, Host
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))] if values else 0
+
+
+def delta(before, after):
+    return {name: after[name] - before[name] for name in after}
+
+
+class Notifications:
+    def __init__(self):
+        self.count = 0
+        self.lost = 0
+        self.seq = None
+
+    def __call__(self, seq, light, handle, data):
+        if self.seq is not None:
+            self.lost += (seq - self.seq - 1) & 0xFF
+        self.seq = seq
+        self.count += 1
+
+
+def ms(values):
+    return "p50 {:.2f} p90 {:.2f} p99 {:.2f} max {:.2f}".format(*(percentile(values, p) * 1000 for p in (50, 90, 99, 100)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="USB to BLE bridge throughput")
+    parser.add_argument("port")
+    parser.add_argument("--light", type=int, required=True)
+    parser.add_argument("--char", choices=CHARS, default="indicator")
+    parser.add_argument("--data", type=bytes.fromhex, default=b"\x00")
+    parser.add_argument("--window", type=int, default=8, help="writes in flight, CONFIG_APP_BRIDGE_WRITES")
+    parser.add_argument("--no-rsp", action="store_true", help="write without response")
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    host = Host(args.port)
+    notifications = Notifications()
+    host.on_notify = notifications
+
+    pings = []
+    for _ in range(50):
+        start = time.monotonic()
+        host.ping()
+        pings.append(time.monotonic() - start)
+
+    bridge_before = host.stats("bridge")
+    body = host.write_body(args.light, args.char, args.data, not args.no_rsp)
+
+    in_flight = {}
+    rtts = []
+    acked = busy = errors = 0
+    start = time.monotonic()
+    end = start + args.seconds
+
+    while time.monotonic() < end or in_flight:
+        if time.monotonic() < end and len(in_flight) < args.window:
+            seq, _ = host.send(MSG_WRITE, body)
+            in_flight[seq] = time.monotonic()
+            continue
+
+        reply = host.reply(timeout=2.0)
+        if reply is None:
+            print(f"timeout, {len(in_flight)} writes unanswered")
+            break
+        # Write replies come when the light answered, in any order
+        sent = in_flight.pop(reply.seq, None)
+        if sent is None:
+            continue
+        if reply.status == 0:
+            acked += 1
+            rtts.append(time.monotonic() - sent)
+        elif reply.status == -errno.EBUSY:
+            busy += 1
+        else:
+            errors += 1
+
+    elapsed = time.monotonic() - start
+    bridge_after = host.stats("bridge")
+    bridge = delta(bridge_before, bridge_after)
+    host.close()
+
+    print(f"{acked} writes of {len(args.data)} bytes to light {args.light} in {elapsed:.2f} s")
+    print(f"throughput: {acked / elapsed:.1f} writes/s, {busy} busy, {errors} errors")
+    print(f"usb ping ms: {ms(pings)}")
+    print(f"write ms:    {ms(rtts)}")
+    print(f"added by the bridge p50: {(percentile(rtts, 50) - percentile(pings, 50)) * 1000:.2f} ms")
+    print(
+        f"controller: queue max {bridge_after['queue_us_max']} us, "
+        f"light answer max {bridge_after['ack_us_max']} us, "
+        f"in flight max {bridge_after['in_flight_max']}, retries {bridge['retries']}"
+    )
+    print(f"notifications: {notifications.count}, {notifications.lost} lost, {bridge['notify_drops']} dropped")
+
+
+if __name__ == "__main__":
+    main()
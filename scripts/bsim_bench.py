@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Connection and latency benchmark of the controller against simulated
+# lights in BabbleSim, no radio hardware needed.
+#
+# Runs the controller and --lights lights (the light role of this tree) on one
+# simulated 2.4 GHz channel, optionally with --interferers advertisers and
+# lights that drop the link every --drop-every seconds. A long press on the
+# pattern button opens the learning window, after --settle seconds the
+# hazard button is pressed --presses times. All devices log in simulated
+# time, which gives:
+#
+#   time to connect    a light starts advertising to the controller connected
+#   time to first      the controller connected to the first acknowledged write
+#   write
+#   press to ack       the first edge of a press to the first acknowledged
+#                      write, from the "latency" module
+#
+# Build both images first, next to BabbleSim (BSIM_OUT_PATH, BSIM_COMPONENTS_PATH):
+#
+#   west build -b nrf52_bsim --no-sysbuild -d build_bsim/controller .
+#   west build -b nrf52_bsim --no-sysbuild -d build_bsim/light . -- -DFILE_SUFFIX=light
+#
+# Usage: bsim_bench.py [--lights 1] [--interferers 0] [--drop-every 0]
+#                      [--presses 50] [--press-interval 500] [--settle 5]
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+LOG_TIME = re.compile(r"\[(\d+):(\d+):(\d+)\.(\d+),(\d+)\]")
+ADVERTISING = re.compile(r"Advertising as (.+)$")
+CONNECTED = re.compile(r"ble: Connected: (.+)$")
+DISCONNECTED = re.compile(r"ble: Disconnected: ")
+FIRST_WRITE = re.compile(r"Time to first write (\d+) ms")
+PRESS_TO_ACK = re.compile(r"Press to ack (\d+) us")
+
+
+def log_us(line):
+    match = LOG_TIME.search(line)
+    if not match:
+        return None
+    h, m, s, ms, us = (int(v) for v in match.groups())
+    return (((h * 60 + m) * 60 + s) * 1000 + ms) * 1000 + us
+
+
+def percentiles(values):
+    if not values:
+        return "no samples"
+    values = sorted(values)
+    pick = lambda p: values[min(len(values) - 1, int(len(values) * p / 100))]
+    return f"n {len(values)}  p50 {pick(50):.1f}  p90 {pick(90):.1f}  p99 {pick(99):.1f}  max {values[-1]:.1f} ms"
+
+
+def buttons_script(args):
+    steps = ["p0 w1000 r0", f"w{int(args.settle * 1000)}"]
+    steps += [f"p3 w50 r3 w{args.press_interval - 50}"] * args.presses
+    return " ".join(steps)
+
+
+def run(args):
+    bsim = os.environ.get("BSIM_OUT_PATH")
+    if not bsim:
+        sys.exit("BSIM_OUT_PATH is not set")
+    bin_dir = os.path.join(bsim, "bin")
+    sim_id = args.sim_id or f"rgbled_{os.getpid()}"
+    devices = 1 + args.lights + args.interferers
+    sim_us = int((args.settle + 1 + args.presses * args.press_interval / 1000 + 2) * 1e6)
+
+    commands = [[os.path.abspath(args.controller), f"-s={sim_id}", "-d=0", f"--buttons={buttons_script(args)}"]]
+    for i in range(args.lights):
+        light = [os.path.abspath(args.light), f"-s={sim_id}", f"-d={1 + i}"]
+        if args.drop_every:
+            light.append(f"--drop_every={int(args.drop_every * 1000)}")
+        commands.append(light)
+    for i in range(args.interferers):
+        commands.append([os.path.abspath(args.light), f"-s={sim_id}", f"-d={1 + args.lights + i}", "--interferer"])
+
+    phy = subprocess.Popen(
+        ["./bs_2G4_phy_v1", f"-s={sim_id}", f"-D={devices}", f"-sim_length={sim_us}"],
+        cwd=bin_dir,
+        stdout=subprocess.DEVNULL,
+    )
+    procs = [subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True) for cmd in commands]
+    start = time.monotonic()
+    outputs = [proc.communicate()[0] for proc in procs]
+    phy.wait()
+    print(f"simulated {sim_us / 1e6:.0f} s in {time.monotonic() - start:.1f} s")
+
+    if args.log:
+        for i, output in enumerate(outputs):
+            with open(f"{args.log}.{i}.log", "w") as f:
+                f.write(output)
+
+    return outputs[0], outputs[1 : 1 + args.lights]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="BabbleSim controller benchmark")
+    parser.add_argument("--controller", default="build_bsim/controller/zephyr/zephyr.exe")
+    parser.add_argument("--light", default="build_bsim/light/zephyr/zephyr.exe")
+    parser.add_argument("--lights", type=int, default=1)
+    parser.add_argument("--interferers", type=int, default=0)
+    parser.add_argument("--drop-every", type=float, default=0, help="seconds, 0 keeps the links")
+    parser.add_argument("--presses", type=int, default=50)
+    parser.add_argument("--press-interval", type=int, default=500, help="ms")
+    parser.add_argument("--settle", type=float, default=5, help="seconds for the lights to connect")
+    parser.add_argument("--sim-id")
+    parser.add_argument("--log", metavar="PREFIX", help="keep the device logs as PREFIX.<device>.log")
+    args = parser.parse_args()
+
+    controller, lights = run(args)
+
+    # Advertising starts per light address, matched to the controller's connects
+    advertising = {}
+    for output in lights:
+        for line in output.splitlines():
+            match = ADVERTISING.search(line)
+            if match:
+                advertising.setdefault(match.group(1).strip(), []).append(log_us(line))
+
+    connect_ms, first_write_ms, press_ms = [], [], []
+    disconnects = 0
+    for line in controller.splitlines():
+        if match := CONNECTED.search(line):
+            now = log_us(line)
+            starts = [t for t in advertising.get(match.group(1).strip(), []) if t <= now]
+            if starts:
+                connect_ms.append((now - starts[-1]) / 1000)
+        elif DISCONNECTED.search(line):
+            disconnects += 1
+        elif match := FIRST_WRITE.search(line):
+            first_write_ms.append(int(match.group(1)))
+        elif match := PRESS_TO_ACK.search(line):
+            press_ms.append(int(match.group(1)) / 1000)
+
+    print(f"{args.lights} lights, {args.interferers} interferers, {disconnects} disconnects")
+    print(f"time to connect:       {percentiles(connect_ms)}")
+    print(f"time to first write:   {percentiles(first_write_ms)}")
+    print(f"press to ack:          {percentiles(press_ms)} ({args.presses} presses)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Per-module RAM and flash report of a build, checked against a budget.
+# Run through the build system, which creates the ram.json and rom.json
+# reports of Zephyr's size_report first:
+#
+#   west build -t footprint_check
+#
+# Application sources are reported per file, the rest per directory, e.g.
+# zephyr/subsys/bluetooth. The budget file has the limits in bytes:
+#
+#   {"ram": {"total": 98304, "src/ble.c": 12288},
+#    "flash": {"total": 393216, "src/ble.c": 16384}}
+#
+# Modules without a limit are only reported, a missing budget file fails the
+# check. --update, or the footprint_update target, writes the current sizes
+# rounded up to ROUND bytes as the new budget, review and commit it like any
+# other change.
+#
+# Usage: footprint_check.py --ram ram.json --rom rom.json --app APP_DIR
+#                           [--budget FILE] [--update] [--top 20]
+
+import argparse
+import json
+import os
+import sys
+
+SOURCE_EXT = (".c", ".h", ".S", ".s", ".cpp", ".ld")
+
+# Budgets written by --update are rounded up to this
+ROUND = 256
+
+
+def leaves(node, path):
+    children = node.get("children")
+    if not children:
+        yield path, node.get("size", 0)
+        return
+    for child in children:
+        yield from leaves(child, path + [child["name"]])
+
+
+def module(path, app):
+    files = [i for i, name in enumerate(path) if name.endswith(SOURCE_EXT)]
+    if not files:
+        return path[0] if path else "(unknown)"
+    file = files[0]
+    if app in path[:file]:
+        start = len(path[:file]) - path[:file][::-1].index(app)
+        return "/".join(path[start : file + 1])
+    if path[0] == "ZEPHYR_BASE":
+        return "/".join(["zephyr"] + path[1 : min(3, file)])
+    return "/".join(path[: min(3, file)])
+
+
+def sizes(report, app):
+    with open(report) as f:
+        root = json.load(f)["symbols"]
+    modules = {}
+    for path, size in leaves(root, []):
+        name = module(path, app)
+        modules[name] = modules.get(name, 0) + size
+    return modules
+
+
+def round_up(size):
+    return (size + ROUND - 1) // ROUND * ROUND
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RAM and flash budget check")
+    parser.add_argument("--ram", required=True, help="ram.json of size_report")
+    parser.add_argument("--rom", required=True, help="rom.json of size_report")
+    parser.add_argument("--app", required=True, help="application source directory")
+    parser.add_argument("--budget", help="budget file, JSON")
+    parser.add_argument("--update", action="store_true", help="write the current sizes as the budget")
+    parser.add_argument("--top", type=int, default=20, help="other modules to list")
+    args = parser.parse_args()
+
+    for report in (args.ram, args.rom):
+        if not os.path.exists(report):
+            sys.exit(f"{report} is missing, run the ram_report and rom_report targets")
+
+    app = os.path.basename(os.path.normpath(args.app))
+    usage = {"ram": sizes(args.ram, app), "flash": sizes(args.rom, app)}
+    for kind in usage:
+        usage[kind]["total"] = sum(usage[kind].values())
+
+    budget = {"ram": {}, "flash": {}}
+    if args.budget and os.path.exists(args.budget) and not args.update:
+        with open(args.budget) as f:
+            budget.update(json.load(f))
+
+    names = set(usage["ram"]) | set(usage["flash"])
+    app_names = sorted(name for name in names if name.startswith("src/"))
+    others = sorted(
+        (name for name in names if name not in app_names and name != "total"),
+        key=lambda name: -(usage["ram"].get(name, 0) + usage["flash"].get(name, 0)),
+    )
+    shown = ["total"] + app_names + others[: args.top]
+
+    over = []
+    print(f"{'module':<40} {'RAM':>9} {'budget':>8}  {'flash':>9} {'budget':>8}")
+    for name in shown:
+        line = f"{name:<40}"
+        for kind in ("ram", "flash"):
+            size = usage[kind].get(name, 0)
+            limit = budget[kind].get(name)
+            mark = ""
+            if limit is not None and size > limit:
+                over.append(f"{name} {kind} {size} > {limit}")
+                mark = "!"
+            line += f" {size:>9} {'-' if limit is None else limit:>8}{mark or ' '}"
+        print(line)
+    rest = others[args.top :]
+    if rest:
+        print(f"{len(rest)} more modules, {sum(usage['ram'].get(n, 0) for n in rest)} B RAM, "
+              f"{sum(usage['flash'].get(n, 0) for n in rest)} B flash")
+
+    if args.update:
+        if not args.budget:
+            sys.exit("--update needs --budget")
+        new = {kind: {name: round_up(usage[kind].get(name, 0)) for name in ["total"] + app_names} for kind in usage}
+        with open(args.budget, "w") as f:
+            json.dump(new, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print(f"budget written to {args.budget}")
+        return 0
+
+    if args.budget and not os.path.exists(args.budget):
+        print(f"no budget in {args.budget}, create it with --update")
+        return 1
+
+    for item in over:
+        print(f"over budget: {item}")
+    return 1 if over else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Sustained live pixel frame rate from the host to the controller.
+#
+# Streams live pixel frames as fast as the credits in the replies allow and
+# reports acknowledged frames per second, throughput and the send to reply
+# time. The "render" stats show how many of them made it to the strip, the
+# strip itself shows at most CONFIG_APP_STRIP_FPS frames per second.
+#
+# Usage: host_bench.py <port> --pixels N [--seconds 10]
+
+import argparse
+import collections
+import time
+
+from rgbled_host import MSG_PIXELS, Host
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))] if values else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Host to controller frame rate")
+    parser.add_argument("port")
+    parser.add_argument("--pixels", type=int, required=True)
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    host = Host(args.port)
+    host.ping()
+    render_before = host.stats("render")
+
+    in_flight = collections.OrderedDict()
+    rtts = []
+    acked = errors = sent_bytes = 0
+    frame = 0
+    pending = None
+    start = time.monotonic()
+    end = start + args.seconds
+
+    while time.monotonic() < end or in_flight:
+        if time.monotonic() < end:
+            if pending is None:
+                hue = frame % 256
+                rgb = bytes([hue, 255 - hue, (hue * 2) & 0xFF]) * args.pixels
+                pending = host.encode(MSG_PIXELS, host.pixels_body(0, rgb))
+            seq, data = pending
+            outstanding = sum(size for size, _ in in_flight.values())
+            # One frame may always be in flight, seqs must not wrap
+            if not in_flight or (outstanding + len(data) <= host.credit_bytes and len(in_flight) < 128):
+                host.serial.write(data)
+                in_flight[seq] = (len(data), time.monotonic())
+                sent_bytes += len(data)
+                frame += 1
+                pending = None
+                continue
+
+        reply = host.reply(timeout=1.0)
+        if reply is None:
+            print(f"timeout, {len(in_flight)} frames unacknowledged")
+            break
+        # Replies come in order, older frames in flight were lost
+        while in_flight:
+            seq, (_, sent) = in_flight.popitem(last=False)
+            if seq == reply.seq:
+                rtts.append(time.monotonic() - sent)
+                break
+            errors += 1
+        if reply.status:
+            errors += 1
+        else:
+            acked += 1
+
+    elapsed = time.monotonic() - start
+    render_after = host.stats("render")
+    host.close()
+
+    shown = render_after["live_frames"] - render_before["live_frames"]
+    print(f"{acked} frames of {args.pixels} pixels in {elapsed:.2f} s, {errors} errors")
+    print(f"host to controller: {acked / elapsed:.1f} frames/s, {sent_bytes / elapsed / 1024:.1f} KiB/s")
+    print(f"shown on the strip: {shown / elapsed:.1f} frames/s")
+    print(
+        "send to reply ms: p50 {:.2f} p90 {:.2f} p99 {:.2f} max {:.2f}".format(
+            *(percentile(rtts, p) * 1000 for p in (50, 90, 99, 100))
+        )
+    )
+
+
+if __name__ == "__main__":
+    main()
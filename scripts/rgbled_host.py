@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Host side of the USB CDC ACM protocol of src/host_proto.h.
+#
+# Usage: rgbled_host.py <port> ping
+#        rgbled_host.py <port> status
+#        rgbled_host.py <port> state [--pattern N] [--indicator N] [--brightness N]
+#        rgbled_host.py <port> stats <group>
+#        rgbled_host.py <port> lights
+#        rgbled_host.py <port> write <light> <state|indicator|pattern> <hex> [--no-rsp]
+#        rgbled_host.py <port> listen [--seconds N]
+#
+# Needs pyserial.
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+MSG_PING = 0x01
+MSG_STATE = 0x02
+MSG_PIXELS = 0x03
+MSG_STATUS = 0x04
+MSG_STATS = 0x05
+MSG_LIGHTS = 0x06
+MSG_WRITE = 0x07
+MSG_NOTIFY = 0x40
+MSG_TRACE = 0x41
+MSG_REPLY = 0x80
+
+# enum ble_light_char
+CHARS = {"state": 0, "indicator": 1, "pattern": 2}
+WRITE_NO_RSP = 0x01
+
+CREDIT_BYTES = 64
+STATE_KEEP = 0xFF
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    # Zephyr's crc16_ccitt: reflected polynomial 0x8408
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos, code = 0, 1
+    for byte in data:
+        if byte:
+            out.append(byte)
+            code += 1
+        if not byte or code == 0xFF:
+            out[code_pos] = code
+            code_pos, code = len(out), 1
+            out.append(0)
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("bad COBS frame")
+        out += data[i + 1 : i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class Reply:
+    def __init__(self, msg_type, seq, status, credits, body):
+        self.type = msg_type
+        self.seq = seq
+        self.status = status
+        self.credits = credits
+        self.body = body
+
+
+class Host:
+    """One open CDC ACM port, requests are matched to replies by seq."""
+
+    def __init__(self, port, timeout=1.0):
+        self.serial = serial.Serial(port, timeout=timeout)
+        self.serial.dtr = True
+        self.seq = 0
+        self.rx = bytearray()
+        # The firmware announces its real window with the first reply
+        self.credit_bytes = CREDIT_BYTES
+
+    def close(self):
+        self.serial.close()
+
+    def encode(self, msg_type, body=b""):
+        self.seq = (self.seq + 1) & 0xFF
+        frame = bytes([msg_type, self.seq]) + body
+        frame += struct.pack("<H", crc16_ccitt(frame))
+        return self.seq, cobs_encode(frame) + b"\0"
+
+    def send(self, msg_type, body=b""):
+        seq, data = self.encode(msg_type, body)
+        self.serial.write(data)
+        return seq, len(data)
+
+    def receive(self, timeout=None):
+        """Next valid frame as (type, seq, body), None on timeout."""
+        deadline = time.monotonic() + (timeout if timeout is not None else self.serial.timeout)
+        while True:
+            end = self.rx.find(b"\0")
+            if end >= 0:
+                encoded, self.rx = bytes(self.rx[:end]), self.rx[end + 1 :]
+                try:
+                    frame = cobs_decode(encoded)
+                except ValueError:
+                    continue
+                if len(frame) < 4 or crc16_ccitt(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+                    continue
+                return frame[0], frame[1], frame[2:-2]
+            if time.monotonic() > deadline:
+                return None
+            self.rx += self.serial.read(max(1, self.serial.in_waiting))
+
+    def reply(self, timeout=None):
+        """Next reply, frames that are not replies are passed to on_message()."""
+        while True:
+            frame = self.receive(timeout)
+            if frame is None:
+                return None
+            msg_type, seq, body = frame
+            if not msg_type & MSG_REPLY or len(body) < 3:
+                self.on_message(msg_type, seq, body)
+                continue
+            status, credits = struct.unpack("<hB", body[:3])
+            self.credit_bytes = credits * CREDIT_BYTES
+            return Reply(msg_type & ~MSG_REPLY, seq, status, credits, body[3:])
+
+    def on_message(self, msg_type, seq, body):
+        if msg_type == MSG_NOTIFY and len(body) >= 3:
+            light, handle = struct.unpack("<BH", body[:3])
+            self.on_notify(seq, light, handle, body[3:])
+
+    def on_notify(self, seq, light, handle, data):
+        pass
+
+    def request(self, msg_type, body=b""):
+        seq, _ = self.send(msg_type, body)
+        while True:
+            reply = self.reply()
+            if reply is None:
+                raise TimeoutError(f"no reply to message {msg_type:#x}")
+            if reply.seq == seq:
+                return reply
+
+    def ping(self, payload=b""):
+        return self.request(MSG_PING, payload)
+
+    def state(self, pattern=STATE_KEEP, indicator=STATE_KEEP, brightness=STATE_KEEP):
+        return self.request(MSG_STATE, bytes([pattern, indicator, brightness]))
+
+    def pixels_body(self, first, rgb):
+        return struct.pack("<H", first) + bytes(rgb)
+
+    def lights(self):
+        reply = self.request(MSG_LIGHTS)
+        if reply.status:
+            raise OSError(-reply.status, "lights")
+        lights = []
+        for offset in range(0, len(reply.body), 9):
+            index, addr_type, addr, state_char = struct.unpack("<BB6sB", reply.body[offset : offset + 9])
+            address = ":".join(f"{b:02X}" for b in reversed(addr))
+            lights.append({"index": index, "addr": address, "addr_type": addr_type, "state_char": bool(state_char)})
+        return lights
+
+    def write_body(self, light, char, data, response=True):
+        return bytes([light, CHARS[char], 0 if response else WRITE_NO_RSP]) + bytes(data)
+
+    def write(self, light, char, data, response=True):
+        return self.request(MSG_WRITE, self.write_body(light, char, data, response))
+
+    def status(self):
+        reply = self.request(MSG_STATUS)
+        fields = struct.unpack("<IHBBBIII", reply.body)
+        names = ("uptime_ms", "seq", "pattern", "indicator", "brightness", "rx_frames", "rx_errors", "pixel_frames")
+        return dict(zip(names, fields))
+
+    def stats(self, group):
+        reply = self.request(MSG_STATS, group.encode())
+        if reply.status:
+            raise OSError(-reply.status, f"stats group '{group}'")
+        values, body = {}, reply.body
+        while body:
+            name_len = body[0]
+            name = body[1 : 1 + name_len].decode()
+            values[name] = struct.unpack("<I", body[1 + name_len : 5 + name_len])[0]
+            body = body[5 + name_len :]
+        return values
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Talk to the controller over USB")
+    parser.add_argument("port")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("ping")
+    sub.add_parser("status")
+    state = sub.add_parser("state")
+    state.add_argument("--pattern", type=int, default=STATE_KEEP)
+    state.add_argument("--indicator", type=int, default=STATE_KEEP)
+    state.add_argument("--brightness", type=int, default=STATE_KEEP)
+    stats = sub.add_parser("stats")
+    stats.add_argument("group")
+    sub.add_parser("lights")
+    write = sub.add_parser("write")
+    write.add_argument("light", type=int)
+    write.add_argument("char", choices=CHARS)
+    write.add_argument("data", type=bytes.fromhex)
+    write.add_argument("--no-rsp", action="store_true")
+    listen = sub.add_parser("listen")
+    listen.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    host = Host(args.port)
+    if args.command == "ping":
+        start = time.monotonic()
+        host.ping(b"ping")
+        print(f"reply in {(time.monotonic() - start) * 1000:.2f} ms")
+    elif args.command == "status":
+        for name, value in host.status().items():
+            print(f"{name}: {value}")
+    elif args.command == "state":
+        reply = host.state(args.pattern, args.indicator, args.brightness)
+        print(f"status {reply.status}")
+    elif args.command == "stats":
+        for name, value in host.stats(args.group).items():
+            print(f"{name}: {value}")
+    elif args.command == "lights":
+        for light in host.lights():
+            print(f"{light['index']}: {light['addr']} state_char={light['state_char']}")
+    elif args.command == "write":
+        start = time.monotonic()
+        reply = host.write(args.light, args.char, args.data, not args.no_rsp)
+        print(f"status {reply.status} in {(time.monotonic() - start) * 1000:.2f} ms")
+    elif args.command == "listen":
+        host.on_notify = lambda seq, light, handle, data: print(f"#{seq} light {light} handle {handle}: {data.hex()}")
+        end = time.monotonic() + args.seconds
+        while time.monotonic() < end:
+            host.reply(timeout=end - time.monotonic())
+    host.close()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Encoder for the streamed light show files of src/show.h.
+#
+# The input is raw RGB, frames * pixels * 3 bytes, e.g. rendered by a light
+# show tool or converted with:
+#   ffmpeg -i show.mp4 -vf scale=<pixels>:1 -f rawvideo -pix_fmt rgb24 show.rgb
+# Every frame is stored as the smallest of raw, run length or delta to the
+# previous frame. Key frames are forced every --key-interval frames so
+# playback can skip ahead after an underrun.
+#
+# Usage: show_encode.py --pixels N [--fps 50] [--key-interval 50] <input.rgb> <output>
+#   then: mcumgr <connection options> fs upload <output> /lfs/anim/<pattern>
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x534C
+VERSION = 1
+INDEX_KEY = 0x80000000
+
+FRAME_RAW = 0
+FRAME_RLE = 1
+FRAME_DELTA = 2
+
+
+def pixels_of(frame):
+    return [tuple(frame[i : i + 3]) for i in range(0, len(frame), 3)]
+
+
+def encode_rle(pixels):
+    out = bytearray([FRAME_RLE])
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while i + run < len(pixels) and run < 255 and pixels[i + run] == pixels[i]:
+            run += 1
+        out += bytes([run, *pixels[i]])
+        i += run
+    return out
+
+
+def encode_delta(pixels, previous):
+    out = bytearray([FRAME_DELTA])
+    i = 0
+    skip = 0
+    while i < len(pixels):
+        if pixels[i] == previous[i]:
+            skip += 1
+            i += 1
+            if skip == 255:
+                # Only needed when more pixels change after the skip
+                if any(p != q for p, q in zip(pixels[i:], previous[i:])):
+                    out += bytes([255, 0, 0, 0, 0])
+                skip = 0
+            continue
+        run = 1
+        while i + run < len(pixels) and run < 255 and pixels[i + run] == pixels[i]:
+            run += 1
+        out += bytes([skip, run, *pixels[i]])
+        skip = 0
+        i += run
+    return out
+
+
+def encode(data, count, fps, key_interval):
+    size = count * 3
+    if len(data) % size:
+        sys.exit(f"input is not a whole number of {count} pixel frames")
+
+    records = []
+    previous = None
+    for n in range(len(data) // size):
+        raw = data[n * size : (n + 1) * size]
+        pixels = pixels_of(raw)
+        key = previous is None or n % key_interval == 0
+        candidates = [bytes([FRAME_RAW]) + raw, encode_rle(pixels)]
+        if not key:
+            candidates.append(encode_delta(pixels, previous))
+        best = min(candidates, key=len)
+        records.append((best[0] != FRAME_DELTA, best))
+        previous = pixels
+
+    header = struct.pack("<HBBHHI", MAGIC, VERSION, 0, count, 1000 // fps, len(records))
+    offset = len(header) + 4 * (len(records) + 1)
+    index = bytearray()
+    for key, record in records:
+        index += struct.pack("<I", offset | (INDEX_KEY if key else 0))
+        offset += len(record)
+    index += struct.pack("<I", offset)
+
+    return header + index + b"".join(record for _, record in records), len(records)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Encode a streamed light show")
+    parser.add_argument("--pixels", type=int, required=True)
+    parser.add_argument("--fps", type=int, default=50)
+    parser.add_argument("--key-interval", type=int, default=50)
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    data = open(args.input, "rb").read()
+    image, frames = encode(data, args.pixels, args.fps, args.key_interval)
+    open(args.output, "wb").write(image)
+    print(f"{args.output}: {frames} frames, {len(image)} bytes, {len(data)} bytes raw")
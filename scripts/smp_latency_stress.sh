@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Button latency while an image is uploaded over SMP, on the hardware.
+#
+# This is a manual procedure: the presses come from a person, nothing can
+# press the buttons of the nice!nano. The verdict is scripted. Start from a
+# fresh boot so the "latency" stats group holds few idle samples, run the
+# script and keep pressing the hazard button, about twice a second, until the
+# upload is done. The script fails when
+#
+#   - fewer than MIN_PRESSES presses completed during the upload
+#   - total_p99_us after the upload is over P99_LIMIT_US
+#   - total_max_us grew past MAX_LIMIT_US during the upload
+#
+# The percentiles cover every sample since boot, idle ones included, which
+# is why the run starts from a fresh boot.
+#
+# Usage: smp_latency_stress.sh <image.bin> [mcumgr connection options]
+#   e.g. smp_latency_stress.sh build/zephyr/zephyr.signed.bin --conntype ble --connstring peer_name=BikeLight
+
+IMAGE=$1
+shift
+INTERVAL=${INTERVAL:-5}
+MIN_PRESSES=${MIN_PRESSES:-20}
+P99_LIMIT_US=${P99_LIMIT_US:-30000}
+MAX_LIMIT_US=${MAX_LIMIT_US:-60000}
+
+if [ -z "$IMAGE" ] || [ ! -f "$IMAGE" ]; then
+    echo "usage: $0 <image.bin> [mcumgr connection options]"
+    exit 1
+fi
+
+STATS=$(mktemp)
+trap 'rm -f "$STATS"' EXIT
+
+read_latency() {
+    echo "--- $1"
+    shift
+    mcumgr "$@" stat read latency >"$STATS" || exit 1
+    grep -E "total_(count|p50_us|p90_us|p99_us|max_us)|abandoned" "$STATS"
+}
+
+# Value of a stat in the last read, mcumgr prints "<value> <name>"
+stat() {
+    awk -v name="$1" '{
+        for (i = 1; i <= NF; i++) { field = $i; sub(":$", "", field); if (field == name) found = 1 }
+        if (found) { for (i = 1; i <= NF; i++) if ($i ~ /^[0-9]+$/) { print $i; exit } }
+    }' "$STATS"
+}
+
+read_latency "idle" "$@"
+IDLE_COUNT=$(stat total_count)
+IDLE_MAX=$(stat total_max_us)
+
+echo "Press the hazard button until the upload is done"
+mcumgr "$@" image upload "$IMAGE" &
+UPLOAD=$!
+
+while kill -0 $UPLOAD 2>/dev/null; do
+    sleep "$INTERVAL"
+    read_latency "uploading" "$@"
+done
+
+wait $UPLOAD || { echo "FAIL: upload failed"; exit 1; }
+# The percentiles are published at most every second
+sleep 2
+read_latency "after upload" "$@"
+
+if [ -z "$IDLE_COUNT" ] || [ -z "$(stat total_count)" ] || [ -z "$(stat total_p99_us)" ]; then
+    echo "FAIL: no latency stats, is CONFIG_APP_LATENCY_STATS enabled?"
+    exit 1
+fi
+
+PRESSES=$(($(stat total_count) - IDLE_COUNT))
+P99=$(stat total_p99_us)
+MAX=$(stat total_max_us)
+FAILED=0
+
+if [ "$PRESSES" -lt "$MIN_PRESSES" ]; then
+    echo "FAIL: $PRESSES presses during the upload, need $MIN_PRESSES"
+    FAILED=1
+fi
+if [ "$P99" -gt "$P99_LIMIT_US" ]; then
+    echo "FAIL: p99 $P99 us over $P99_LIMIT_US us"
+    FAILED=1
+fi
+if [ "$MAX" -gt "$IDLE_MAX" ] && [ "$MAX" -gt "$MAX_LIMIT_US" ]; then
+    echo "FAIL: max $MAX us during the upload, over $MAX_LIMIT_US us"
+    FAILED=1
+fi
+
+[ $FAILED -eq 0 ] && echo "PASS: $PRESSES presses, p99 $P99 us, max $MAX us"
+exit $FAILED
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Timeline of the binary trace of src/trace.h.
+#
+# Build the controller with CONFIG_APP_TRACE=y, then listen on its port for
+# --seconds. Each HOST_MSG_TRACE message carries the cycle frequency, the
+# records dropped since boot and a batch of records. The cycle counter wraps,
+# timestamps are unwrapped and shown in ms since the first record:
+#
+#      12.345  button isr       port 0 pin 11
+#      12.407  debounced        code 3 pressed
+#      12.409  button event     pressed code 3
+#      12.431  write submit     light 0 state seq 17
+#      19.902  write done       light 0 state ok  7.471 ms
+#
+# Dropped records and lost batches (gaps in the message seq) are reported
+# at the end. --chrome writes the trace as Chrome trace events, open it in
+# Perfetto or chrome://tracing: writes become slices per light, the other
+# events instants.
+#
+# Usage: trace_decode.py <port> [--seconds 10] [--chrome FILE]
+
+import argparse
+import json
+import struct
+import time
+
+from rgbled_host import MSG_TRACE, Host
+
+HEAD = struct.Struct("<II")
+RECORD = struct.Struct("<IBBH")
+
+# enum trace_event
+EVENTS = [
+    None,
+    "button isr",
+    "debounced",
+    "button event",
+    "write submit",
+    "write done",
+    "write skip",
+    "connect",
+    "disconnect",
+    "scan report",
+]
+BUTTON_ISR, DEBOUNCED, BUTTON_EVENT, WRITE_SUBMIT, WRITE_DONE, WRITE_SKIP, CONNECT, DISCONNECT, SCAN_REPORT = range(1, 10)
+
+# enum button_evt
+BUTTON_EVTS = ["pressed", "released", "long press", "double click", "chord"]
+# enum rgbled_cmd
+CMDS = ["state", "indicator", "pattern"]
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def light_cmd(a):
+    return f"light {a & 0xF} {name(CMDS, a >> 4)}"
+
+
+def describe(event, a, b):
+    if event == BUTTON_ISR:
+        return f"port {a} pin {b}"
+    if event == DEBOUNCED:
+        return f"code {a} {'pressed' if b else 'released'}"
+    if event == BUTTON_EVENT:
+        return f"{name(BUTTON_EVTS, a)} code {b}"
+    if event in (WRITE_SUBMIT, WRITE_SKIP):
+        return f"{light_cmd(a)} seq {b}"
+    if event == WRITE_DONE:
+        return f"{light_cmd(a)} {'ok' if not b else f'err {b}'}"
+    if event == CONNECT:
+        return f"failed, err 0x{b:02x}" if a == 0xFF else f"light {a}"
+    if event == DISCONNECT:
+        return f"light {a} reason 0x{b:02x}"
+    if event == SCAN_REPORT:
+        return f"type {a} rssi {b - 256 if b >= 128 else b}"
+    return f"a {a} b {b}"
+
+
+class Trace:
+    def __init__(self):
+        self.records = []
+        self.cycles_per_sec = None
+        self.dropped = 0
+        self.lost = 0
+        self.seq = None
+        self.raw = None
+        self.cycles = 0
+
+    def __call__(self, msg_type, seq, body):
+        if msg_type != MSG_TRACE or len(body) < HEAD.size:
+            return
+        if self.seq is not None:
+            self.lost += (seq - self.seq - 1) & 0xFF
+        self.seq = seq
+        self.cycles_per_sec, self.dropped = HEAD.unpack_from(body)
+        for offset in range(HEAD.size, len(body) - RECORD.size + 1, RECORD.size):
+            raw, event, a, b = RECORD.unpack_from(body, offset)
+            # Records of one batch can be slightly out of order, the slot is
+            # reserved before the timestamp is taken
+            if self.raw is not None:
+                delta = (raw - self.raw) & 0xFFFFFFFF
+                self.cycles += delta - (1 << 32) if delta >= 1 << 31 else delta
+            self.raw = raw
+            self.records.append((self.cycles, event, a, b))
+
+    def timeline(self):
+        """(ms, event, a, b) sorted by time, relative to the first record."""
+        if not self.records:
+            return []
+        records = sorted(self.records, key=lambda r: r[0])
+        start = records[0][0]
+        return [((c - start) * 1000 / self.cycles_per_sec, e, a, b) for c, e, a, b in records]
+
+
+def chrome_events(timeline):
+    events = []
+    submitted = {}
+    for ms, event, a, b in timeline:
+        us = ms * 1000
+        if event == WRITE_SUBMIT:
+            submitted[a & 0xF] = (us, a, b)
+            continue
+        if event == WRITE_DONE and (a & 0xF) in submitted:
+            start, sub_a, seq = submitted.pop(a & 0xF)
+            events.append(
+                {
+                    "name": f"write {name(CMDS, sub_a >> 4)}",
+                    "ph": "X",
+                    "ts": start,
+                    "dur": us - start,
+                    "pid": 1,
+                    "tid": f"light {a & 0xF}",
+                    "args": {"seq": seq, "err": b},
+                }
+            )
+            continue
+        events.append(
+            {
+                "name": name(EVENTS, event),
+                "ph": "i",
+                "s": "t",
+                "ts": us,
+                "pid": 1,
+                "tid": "input" if event <= BUTTON_EVENT else "ble",
+                "args": {"detail": describe(event, a, b)},
+            }
+        )
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Timeline of the controller trace")
+    parser.add_argument("port")
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("--chrome", metavar="FILE", help="write Chrome trace events to FILE")
+    args = parser.parse_args()
+
+    host = Host(args.port)
+    trace = Trace()
+    host.on_message = trace
+    try:
+        end = time.monotonic() + args.seconds
+        while time.monotonic() < end:
+            host.reply(timeout=end - time.monotonic())
+    except KeyboardInterrupt:
+        pass
+    host.close()
+
+    timeline = trace.timeline()
+    submitted = {}
+    for ms, event, a, b in timeline:
+        line = f"{ms:10.3f}  {name(EVENTS, event):<15}  {describe(event, a, b)}"
+        if event == WRITE_SUBMIT:
+            submitted[a & 0xF] = ms
+        elif event == WRITE_DONE and (a & 0xF) in submitted:
+            line += f"  {ms - submitted.pop(a & 0xF):.3f} ms"
+        print(line)
+
+    print(f"{len(timeline)} records, {trace.dropped} dropped, {trace.lost} batches lost")
+
+    if args.chrome:
+        with open(args.chrome, "w") as f:
+            json.dump(chrome_events(timeline), f)
+        print(f"Chrome trace written to {args.chrome}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024-2025 Robert Wessels
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Bulk throughput of the USB CDC ACM data path.
+#
+# Streams ping frames with a random payload within the credits of the host
+# protocol. The controller echoes every payload, so both directions carry
+# the same load. Every echo is compared with what was sent, and the "usb"
+# and "host" stats groups are read before and after to show throttling,
+# dropped bytes, frame errors and the interrupt count.
+#
+# Usage: usb_throughput.py <port> [--size 256] [--seconds 10]
+
+import argparse
+import collections
+import os
+import time
+
+from rgbled_host import MSG_PING, Host
+
+
+def delta(before, after):
+    return {name: after[name] - before[name] for name in after}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="USB CDC ACM throughput")
+    parser.add_argument("port")
+    parser.add_argument("--size", type=int, default=256, help="payload bytes per frame")
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    host = Host(args.port)
+    host.ping()
+    usb_before = host.stats("usb")
+    host_before = host.stats("host")
+
+    in_flight = collections.OrderedDict()
+    echoed = mismatches = lost = 0
+    start = time.monotonic()
+    end = start + args.seconds
+    pending = None
+
+    while time.monotonic() < end or in_flight:
+        if time.monotonic() < end:
+            if pending is None:
+                payload = os.urandom(args.size)
+                pending = (payload, *host.encode(MSG_PING, payload))
+            payload, seq, data = pending
+            outstanding = sum(len(d) for _, d in in_flight.values())
+            if not in_flight or (outstanding + len(data) <= host.credit_bytes and len(in_flight) < 128):
+                host.serial.write(data)
+                in_flight[seq] = (payload, data)
+                pending = None
+                continue
+
+        reply = host.reply(timeout=1.0)
+        if reply is None:
+            lost += len(in_flight)
+            break
+        while in_flight:
+            seq, (payload, _) = in_flight.popitem(last=False)
+            if seq == reply.seq:
+                echoed += 1
+                mismatches += reply.body != payload
+                break
+            lost += 1
+
+    elapsed = time.monotonic() - start
+    usb = delta(usb_before, host.stats("usb"))
+    proto = delta(host_before, host.stats("host"))
+    host.close()
+
+    rate = echoed * args.size / elapsed / 1024
+    print(f"{echoed} frames of {args.size} bytes echoed in {elapsed:.2f} s")
+    print(f"payload: {rate:.1f} KiB/s each way, {mismatches} mismatches, {lost} lost")
+    print(f"wire: rx {usb['rx_bytes'] / elapsed / 1024:.1f} KiB/s, tx {usb['tx_bytes'] / elapsed / 1024:.1f} KiB/s")
+    print(f"irqs: {usb['irqs']}, {usb['rx_bytes'] / max(usb['irqs'], 1):.1f} rx bytes per irq")
+    print(f"rx throttles {usb['rx_throttles']}, rx errors {usb['rx_errors']}, tx drops {usb['tx_drops']}")
+    print(
+        f"frame errors: crc {proto['rx_crc_errors']}, framing {proto['rx_framing_errors']}, "
+        f"oversize {proto['rx_oversize']}, tx {proto['tx_errors']}"
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Uploaded animation patterns
+ *
+ * Animation programs are files in ANIM_DIR named after their pattern ID. The
+ * directory is scanned at startup and again shortly after the mcumgr fs group
+ * touched a file in it, so an upload becomes selectable without a restart.
+ * The render thread loads the program of the current pattern when it changes.
+ * A file can also hold a pre-rendered show, which is streamed instead.
+ */
+
+#include "anim.h"
+#include "anim_vm.h"
+#include "render.h"
+#include "show.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/mgmt/mcumgr/grp/fs_mgmt/fs_mgmt_callbacks.h>
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(anim, LOG_LEVEL_INF);
+
+#define PATTERN_TOTAL (ANIM_PATTERN_FIRST + CONFIG_APP_ANIM_SLOTS)
+
+/* An upload is many file accesses, rescan once it went quiet */
+#define RESCAN_DELAY_MS 1000
+
+BUILD_ASSERT(PATTERN_TOTAL <= UINT8_MAX + 1, "pattern IDs are 8 bit");
+
+STATS_SECT_START(anim_stats)
+STATS_SECT_ENTRY32(loads)
+STATS_SECT_ENTRY32(load_errors)
+STATS_SECT_ENTRY32(rescans)
+STATS_SECT_ENTRY32(budget_exceeded)
+STATS_SECT_ENTRY32(run_us_max)
+STATS_SECT_END;
+
+STATS_NAME_START(anim_stats)
+STATS_NAME(anim_stats, loads)
+STATS_NAME(anim_stats, load_errors)
+STATS_NAME(anim_stats, rescans)
+STATS_NAME(anim_stats, budget_exceeded)
+STATS_NAME(anim_stats, run_us_max)
+STATS_NAME_END(anim_stats);
+
+static STATS_SECT_DECL(anim_stats) anim_stats;
+
+/* Slots with a file, written by the scan and read by any thread */
+static ATOMIC_DEFINE(slots, CONFIG_APP_ANIM_SLOTS);
+/* Bumped by every scan, the render thread reloads when it changed */
+static atomic_t generation;
+
+enum program_kind
+{
+    PROGRAM_NONE,
+    PROGRAM_VM,
+    PROGRAM_SHOW,
+};
+
+/* Render thread only */
+static struct anim_program program;
+static uint8_t file_buf[sizeof(struct anim_header) + CONFIG_APP_ANIM_MAX_SIZE];
+static int loaded_pattern = -1;
+static atomic_val_t loaded_generation;
+static enum program_kind kind;
+static uint32_t program_since;
+
+static void rescan_handler(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(rescan_work, rescan_handler);
+
+static void anim_scan(void)
+{
+    ATOMIC_DEFINE(found, CONFIG_APP_ANIM_SLOTS) = { 0 };
+    struct fs_dirent entry;
+    struct fs_dir_t dir;
+    int err;
+
+    fs_dir_t_init(&dir);
+
+    err = fs_opendir(&dir, ANIM_DIR);
+    if (err)
+    {
+        LOG_WRN("Cannot open %s (err %d)", ANIM_DIR, err);
+        return;
+    }
+
+    while (fs_readdir(&dir, &entry) == 0 && entry.name[0] != '\0')
+    {
+        char* end;
+        unsigned long id = strtoul(entry.name, &end, 10);
+
+        if (entry.type != FS_DIR_ENTRY_FILE || *end != '\0' || end == entry.name || id < ANIM_PATTERN_FIRST ||
+            id >= PATTERN_TOTAL || entry.size < sizeof(struct anim_header))
+        {
+            continue;
+        }
+
+        atomic_set_bit(found, id - ANIM_PATTERN_FIRST);
+    }
+
+    fs_closedir(&dir);
+
+    for (int i = 0; i < CONFIG_APP_ANIM_SLOTS; i++)
+    {
+        atomic_set_bit_to(slots, i, atomic_test_bit(found, i));
+    }
+
+    atomic_inc(&generation);
+    STATS_INC(anim_stats, rescans);
+}
+
+static void rescan_handler(struct k_work* work)
+{
+    anim_scan();
+}
+
+static enum mgmt_cb_return fs_access_hook(uint32_t event,
+                                          enum mgmt_cb_return prev_status,
+                                          int32_t* rc,
+                                          uint16_t* group,
+                                          bool* abort_more,
+                                          void* data,
+                                          size_t data_size)
+{
+    const struct fs_mgmt_file_access* access = data;
+
+    if (access->access == FS_MGMT_FILE_ACCESS_WRITE && strncmp(access->filename, ANIM_DIR "/", strlen(ANIM_DIR) + 1) == 0)
+    {
+        k_work_reschedule(&rescan_work, K_MSEC(RESCAN_DELAY_MS));
+    }
+
+    return MGMT_CB_OK;
+}
+
+static struct mgmt_callback fs_access_cb = {
+    .callback = fs_access_hook,
+    .event_id = MGMT_EVT_OP_FS_MGMT_FILE_ACCESS,
+};
+
+static int anim_load(uint8_t pattern, enum program_kind* loaded)
+{
+    char path[sizeof(ANIM_DIR) + 4];
+    struct fs_file_t file;
+    ssize_t len;
+    int err;
+
+    if (pattern < ANIM_PATTERN_FIRST || !atomic_test_bit(slots, pattern - ANIM_PATTERN_FIRST))
+    {
+        return -ENOENT;
+    }
+
+    snprintf(path, sizeof(path), ANIM_DIR "/%u", pattern);
+    fs_file_t_init(&file);
+
+    err = fs_open(&file, path, FS_O_READ);
+    if (err)
+    {
+        return err;
+    }
+
+    len = fs_read(&file, file_buf, sizeof(file_buf));
+    fs_close(&file);
+    if (len < 0)
+    {
+        return len;
+    }
+
+    if (IS_ENABLED(CONFIG_APP_SHOW) && len >= sizeof(struct show_header) && sys_get_le16(file_buf) == SHOW_MAGIC)
+    {
+        show_start(path);
+        *loaded = PROGRAM_SHOW;
+        return 0;
+    }
+
+    err = anim_vm_load(&program, file_buf, len);
+    if (!err)
+    {
+        *loaded = PROGRAM_VM;
+    }
+
+    return err;
+}
+
+uint8_t anim_pattern_next(uint8_t pattern)
+{
+    for (int i = 1; i <= PATTERN_TOTAL; i++)
+    {
+        uint8_t next = (pattern + i) % PATTERN_TOTAL;
+
+        if (next < ANIM_PATTERN_FIRST || atomic_test_bit(slots, next - ANIM_PATTERN_FIRST))
+        {
+            return next;
+        }
+    }
+
+    return 0;
+}
+
+void anim_stop(void)
+{
+    if (kind == PROGRAM_SHOW)
+    {
+        show_stop();
+    }
+
+    kind = PROGRAM_NONE;
+    loaded_pattern = -1;
+}
+
+void anim_render(uint8_t pattern, uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+    atomic_val_t gen = atomic_get(&generation);
+    uint32_t start;
+    uint32_t us;
+    int err;
+
+    if (pattern != loaded_pattern || gen != loaded_generation)
+    {
+        anim_stop();
+
+        loaded_pattern = pattern;
+        loaded_generation = gen;
+        program_since = now;
+
+        err = anim_load(pattern, &kind);
+        restart = true;
+
+        if (err)
+        {
+            LOG_WRN("Pattern %u not loaded (err %d)", pattern, err);
+            STATS_INC(anim_stats, load_errors);
+        }
+        else
+        {
+            STATS_INC(anim_stats, loads);
+        }
+    }
+
+    if (kind == PROGRAM_SHOW)
+    {
+        show_render(now, restart, from, to);
+        return;
+    }
+
+    if (kind == PROGRAM_NONE)
+    {
+        if (restart)
+        {
+            for (uint16_t i = from; i < to; i++)
+            {
+                render_pixel_set(i, (struct led_rgb){ 0 });
+            }
+        }
+        return;
+    }
+
+    start = k_cycle_get_32();
+    err = anim_vm_run(&program, now - program_since, from, to);
+    us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+    if (err == -E2BIG)
+    {
+        STATS_INC(anim_stats, budget_exceeded);
+    }
+
+    if (us > anim_stats.run_us_max)
+    {
+        STATS_SET(anim_stats, run_us_max, us);
+    }
+}
+
+int anim_init(void)
+{
+    int err = fs_mkdir(ANIM_DIR);
+
+    if (err && err != -EEXIST)
+    {
+        LOG_ERR("Cannot create %s (err %d)", ANIM_DIR, err);
+        return err;
+    }
+
+    STATS_INIT_AND_REG(anim_stats, STATS_SIZE_32, "anim");
+
+    anim_scan();
+
+    if (IS_ENABLED(CONFIG_MCUMGR_GRP_FS_FILE_ACCESS_HOOK))
+    {
+        mgmt_callback_register(&fs_access_cb);
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ANIM_H
+#define ANIM_H
+
+#include "rgbled_service.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Uploaded animations take the pattern IDs after the built-in patterns. The
+ * program of pattern N is the file ANIM_DIR "/N", uploaded with the mcumgr
+ * fs group, e.g. mcumgr fs upload wave.anim /lfs/anim/3
+ * A file can also be a light show, see show.h.
+ */
+#define ANIM_DIR           "/lfs/anim"
+#define ANIM_PATTERN_FIRST RGBLED_PATTERN_COUNT
+
+#if defined(CONFIG_APP_ANIM)
+
+/** @brief Find the uploaded animations and watch for new uploads. */
+int anim_init(void);
+
+/** @brief Pattern after @p pattern, skipping animation slots without a file. */
+uint8_t anim_pattern_next(uint8_t pattern);
+
+/**
+ * @brief Draw one frame of an uploaded animation over [from, to).
+ *
+ * The program is loaded from the file system when the pattern or its file
+ * changes, its time and registers start at 0 then. Runs on the render thread
+ * within the cycle budget of CONFIG_APP_ANIM_BUDGET.
+ *
+ * @param now Uptime in milliseconds.
+ * @param restart Every pixel of the range has to be drawn again.
+ */
+void anim_render(uint8_t pattern, uint32_t now, bool restart, uint16_t from, uint16_t to);
+
+/** @brief A built-in pattern is shown, release the animation. Render thread only. */
+void anim_stop(void);
+
+#else
+
+static inline int anim_init(void)
+{
+    return 0;
+}
+
+static inline uint8_t anim_pattern_next(uint8_t pattern)
+{
+    return (pattern + 1) % RGBLED_PATTERN_COUNT;
+}
+
+static inline void anim_render(uint8_t pattern, uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+}
+
+static inline void anim_stop(void)
+{
+}
+
+#endif
+
+#endif // ANIM_H
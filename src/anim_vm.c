@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Bounded time animation interpreter
+ *
+ * Programs are checked completely when they are loaded: opcodes, register
+ * numbers, ease modes, jump targets and keyframe tables. The interpreter
+ * then only has to keep the program counter and pixel ranges in bounds.
+ * Register values come from the program and can be anything, so register
+ * arithmetic wraps like two's complement and spans are computed in 64 bits.
+ */
+
+#include "anim_vm.h"
+#include "render.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+
+/* Operand layout: register bytes, then an ease mode, then 16 bits */
+enum operand16
+{
+    OPERAND_NONE,
+    OPERAND_IMM,
+    OPERAND_CODE_ADDR,
+    OPERAND_DATA_ADDR,
+};
+
+struct op_format
+{
+    uint8_t regs;
+    bool mode;
+    enum operand16 operand;
+};
+
+static const struct op_format formats[ANIM_OP_COUNT] = {
+    [ANIM_OP_END] = { 0, false, OPERAND_NONE },
+    [ANIM_OP_LDI] = { 1, false, OPERAND_IMM },
+    [ANIM_OP_MOV] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_ADD] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_SUB] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_MUL] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_DIV] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_MOD] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_TIME] = { 1, false, OPERAND_NONE },
+    [ANIM_OP_NPIX] = { 1, false, OPERAND_NONE },
+    [ANIM_OP_EASE] = { 2, true, OPERAND_NONE },
+    [ANIM_OP_LERP] = { 4, false, OPERAND_NONE },
+    [ANIM_OP_HSV] = { 4, false, OPERAND_NONE },
+    [ANIM_OP_RGB] = { 4, false, OPERAND_NONE },
+    [ANIM_OP_FILL] = { 3, false, OPERAND_NONE },
+    [ANIM_OP_GRAD] = { 4, false, OPERAND_NONE },
+    [ANIM_OP_PIXEL] = { 2, false, OPERAND_NONE },
+    [ANIM_OP_JMP] = { 0, false, OPERAND_CODE_ADDR },
+    [ANIM_OP_JZ] = { 1, false, OPERAND_CODE_ADDR },
+    [ANIM_OP_JLT] = { 2, false, OPERAND_CODE_ADDR },
+    [ANIM_OP_LOOP] = { 1, false, OPERAND_CODE_ADDR },
+    [ANIM_OP_KEYF] = { 2, false, OPERAND_DATA_ADDR },
+};
+
+/* Keyframe table header and entry sizes */
+#define KEYF_HEADER 2U
+#define KEYF_ENTRY  4U
+
+static size_t op_len(uint8_t op)
+{
+    const struct op_format* format = &formats[op];
+
+    return 1 + format->regs + format->mode + (format->operand != OPERAND_NONE ? 2 : 0);
+}
+
+static int keyf_check(const struct anim_program* prog, uint16_t addr)
+{
+    const uint8_t* table = &prog->image[prog->code_len + addr];
+    uint8_t count;
+
+    if (addr + KEYF_HEADER > prog->data_len)
+    {
+        return -EINVAL;
+    }
+
+    count = table[0];
+    if (count < 2 || table[1] >= ANIM_EASE_COUNT || addr + KEYF_HEADER + count * KEYF_ENTRY > prog->data_len)
+    {
+        return -EINVAL;
+    }
+
+    for (int i = 1; i < count; i++)
+    {
+        if (sys_get_le16(&table[KEYF_HEADER + i * KEYF_ENTRY]) <
+            sys_get_le16(&table[KEYF_HEADER + (i - 1) * KEYF_ENTRY]))
+        {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static int code_check(const struct anim_program* prog)
+{
+    uint8_t starts[DIV_ROUND_UP(CONFIG_APP_ANIM_MAX_SIZE, 8)] = { 0 };
+    const uint8_t* code = prog->image;
+    size_t pc = 0;
+
+    /* Pass 1: instruction boundaries and operands */
+    while (pc < prog->code_len)
+    {
+        const struct op_format* format;
+        size_t len;
+
+        if (code[pc] >= ANIM_OP_COUNT)
+        {
+            return -EINVAL;
+        }
+
+        format = &formats[code[pc]];
+        len = op_len(code[pc]);
+        if (pc + len > prog->code_len)
+        {
+            return -EINVAL;
+        }
+
+        for (int i = 0; i < format->regs; i++)
+        {
+            if (code[pc + 1 + i] >= ANIM_REGS)
+            {
+                return -EINVAL;
+            }
+        }
+
+        if (format->mode && code[pc + 1 + format->regs] >= ANIM_EASE_COUNT)
+        {
+            return -EINVAL;
+        }
+
+        starts[pc / 8] |= BIT(pc % 8);
+        pc += len;
+    }
+
+    /* Pass 2: jumps land on instructions, keyframe tables are sound */
+    for (pc = 0; pc < prog->code_len; pc += op_len(code[pc]))
+    {
+        const struct op_format* format = &formats[code[pc]];
+        uint16_t addr;
+
+        if (format->operand != OPERAND_CODE_ADDR && format->operand != OPERAND_DATA_ADDR)
+        {
+            continue;
+        }
+
+        addr = sys_get_le16(&code[pc + 1 + format->regs]);
+
+        if (format->operand == OPERAND_CODE_ADDR)
+        {
+            /* Jumping to the end is a valid way to finish the frame */
+            if (addr > prog->code_len || (addr < prog->code_len && !(starts[addr / 8] & BIT(addr % 8))))
+            {
+                return -EINVAL;
+            }
+        }
+        else if (keyf_check(prog, addr))
+        {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+int anim_vm_load(struct anim_program* prog, const uint8_t* file, size_t len)
+{
+    const struct anim_header* header = (const struct anim_header*)file;
+    uint16_t code_len;
+    uint16_t data_len;
+
+    if (len < sizeof(*header) || sys_le16_to_cpu(header->magic) != ANIM_MAGIC || header->version != ANIM_VERSION)
+    {
+        return -EINVAL;
+    }
+
+    code_len = sys_le16_to_cpu(header->code_len);
+    data_len = sys_le16_to_cpu(header->data_len);
+
+    if (code_len + data_len > sizeof(prog->image) || sizeof(*header) + code_len + data_len != len)
+    {
+        return -E2BIG;
+    }
+
+    if (crc16_ccitt(0xffff, file + sizeof(*header), code_len + data_len) != sys_le16_to_cpu(header->crc))
+    {
+        return -EBADMSG;
+    }
+
+    memcpy(prog->image, file + sizeof(*header), code_len + data_len);
+    prog->code_len = code_len;
+    prog->data_len = data_len;
+    memset(prog->regs, 0, sizeof(prog->regs));
+
+    if (code_check(prog))
+    {
+        prog->code_len = 0;
+        prog->data_len = 0;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int32_t ease(int32_t x, uint8_t mode)
+{
+    int32_t inv;
+
+    x = CLAMP(x, 0, UINT8_MAX);
+    inv = UINT8_MAX - x;
+
+    switch (mode)
+    {
+    case ANIM_EASE_IN:
+        return (x * x) / UINT8_MAX;
+    case ANIM_EASE_OUT:
+        return UINT8_MAX - (inv * inv) / UINT8_MAX;
+    case ANIM_EASE_IN_OUT:
+        return x < 128 ? (2 * x * x) / UINT8_MAX : UINT8_MAX - (2 * inv * inv) / UINT8_MAX;
+    case ANIM_EASE_SMOOTH:
+        return (x * x * (3 * UINT8_MAX - 2 * x)) / (UINT8_MAX * UINT8_MAX);
+    default:
+        return x;
+    }
+}
+
+static int32_t wrap_add(int32_t a, int32_t b)
+{
+    return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static int32_t wrap_sub(int32_t a, int32_t b)
+{
+    return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+static int32_t wrap_mul(int32_t a, int32_t b)
+{
+    return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+
+/* Division by zero gives 0, INT32_MIN / -1 wraps to INT32_MIN */
+static int32_t safe_div(int32_t a, int32_t b)
+{
+    if (b == 0)
+    {
+        return 0;
+    }
+
+    return b == -1 ? wrap_sub(0, a) : a / b;
+}
+
+static int32_t safe_mod(int32_t a, int32_t b)
+{
+    return b == 0 || b == -1 ? 0 : a % b;
+}
+
+/* The result lies between a and b */
+static int32_t lerp(int32_t a, int32_t b, int32_t t)
+{
+    return (int32_t)(a + (((int64_t)b - a) * CLAMP(t, 0, UINT8_MAX)) / UINT8_MAX);
+}
+
+static int32_t color_pack(int32_t r, int32_t g, int32_t b)
+{
+    return (CLAMP(r, 0, UINT8_MAX) << 16) | (CLAMP(g, 0, UINT8_MAX) << 8) | CLAMP(b, 0, UINT8_MAX);
+}
+
+static struct led_rgb color_unpack(int32_t color)
+{
+    return (struct led_rgb){ .r = (color >> 16) & 0xff, .g = (color >> 8) & 0xff, .b = color & 0xff };
+}
+
+static int32_t color_lerp(int32_t a, int32_t b, int32_t t)
+{
+    return color_pack(lerp((a >> 16) & 0xff, (b >> 16) & 0xff, t),
+                      lerp((a >> 8) & 0xff, (b >> 8) & 0xff, t),
+                      lerp(a & 0xff, b & 0xff, t));
+}
+
+static int32_t keyframe(const struct anim_program* prog, uint16_t addr, int32_t time)
+{
+    const uint8_t* table = &prog->image[prog->code_len + addr];
+    const uint8_t* entry = &table[KEYF_HEADER];
+    uint8_t count = table[0];
+    uint16_t last = sys_get_le16(&entry[(count - 1) * KEYF_ENTRY]);
+    int i;
+
+    /* Tables loop over their last time */
+    time = MAX(time, 0);
+    if (last)
+    {
+        time %= last;
+    }
+
+    for (i = 0; i < count - 2; i++)
+    {
+        if (time < sys_get_le16(&entry[(i + 1) * KEYF_ENTRY]))
+        {
+            break;
+        }
+    }
+
+    uint16_t t0 = sys_get_le16(&entry[i * KEYF_ENTRY]);
+    uint16_t t1 = sys_get_le16(&entry[(i + 1) * KEYF_ENTRY]);
+    int32_t v0 = (int16_t)sys_get_le16(&entry[i * KEYF_ENTRY + 2]);
+    int32_t v1 = (int16_t)sys_get_le16(&entry[(i + 1) * KEYF_ENTRY + 2]);
+    int32_t frac = t1 > t0 ? ((time - t0) * UINT8_MAX) / (t1 - t0) : UINT8_MAX;
+
+    return lerp(v0, v1, ease(frac, table[1]));
+}
+
+/* Clip a pixel span to the drawable range, returns the clipped count */
+static int32_t span_clip(int32_t* first, int32_t count, uint16_t from, uint16_t to)
+{
+    int64_t start = MAX((int64_t)*first, (int64_t)from);
+    int64_t end = MIN((int64_t)*first + MAX(count, 0), (int64_t)to);
+
+    if (end <= start)
+    {
+        return 0;
+    }
+
+    /* Both are within from..to now */
+    *first = (int32_t)start;
+
+    return (int32_t)(end - start);
+}
+
+int anim_vm_run(struct anim_program* prog, uint32_t time, uint16_t from, uint16_t to)
+{
+    const uint8_t* code = prog->image;
+    int32_t* r = prog->regs;
+    uint32_t budget = CONFIG_APP_ANIM_BUDGET;
+    uint16_t pc = 0;
+
+    to = MIN(to, render_pixel_count());
+
+    while (pc < prog->code_len)
+    {
+        const uint8_t* ins = &code[pc];
+        const uint8_t* a = &ins[1];
+        uint32_t cost = 1;
+        int32_t first = 0;
+        int32_t count = 0;
+
+        switch (ins[0])
+        {
+        case ANIM_OP_FILL:
+        case ANIM_OP_GRAD:
+            first = r[a[0]];
+            count = span_clip(&first, r[a[1]], from, to);
+            cost += count / 8;
+            break;
+        case ANIM_OP_KEYF:
+            cost += code[prog->code_len + sys_get_le16(&a[2])] / 4;
+            break;
+        default:
+            break;
+        }
+
+        if (cost > budget)
+        {
+            return -E2BIG;
+        }
+        budget -= cost;
+        pc += op_len(ins[0]);
+
+        switch (ins[0])
+        {
+        case ANIM_OP_END:
+            return 0;
+        case ANIM_OP_LDI:
+            r[a[0]] = (int16_t)sys_get_le16(&a[1]);
+            break;
+        case ANIM_OP_MOV:
+            r[a[0]] = r[a[1]];
+            break;
+        case ANIM_OP_ADD:
+            r[a[0]] = wrap_add(r[a[0]], r[a[1]]);
+            break;
+        case ANIM_OP_SUB:
+            r[a[0]] = wrap_sub(r[a[0]], r[a[1]]);
+            break;
+        case ANIM_OP_MUL:
+            r[a[0]] = wrap_mul(r[a[0]], r[a[1]]);
+            break;
+        case ANIM_OP_DIV:
+            r[a[0]] = safe_div(r[a[0]], r[a[1]]);
+            break;
+        case ANIM_OP_MOD:
+            r[a[0]] = safe_mod(r[a[0]], r[a[1]]);
+            break;
+        case ANIM_OP_TIME:
+            r[a[0]] = (int32_t)time;
+            break;
+        case ANIM_OP_NPIX:
+            r[a[0]] = render_pixel_count();
+            break;
+        case ANIM_OP_EASE:
+            r[a[0]] = ease(r[a[1]], a[2]);
+            break;
+        case ANIM_OP_LERP:
+            r[a[0]] = lerp(r[a[1]], r[a[2]], r[a[3]]);
+            break;
+        case ANIM_OP_HSV: {
+            struct led_rgb c = render_hsv(((uint32_t)r[a[1]]) % RENDER_HUE_MAX,
+                                          CLAMP(r[a[2]], 0, UINT8_MAX),
+                                          CLAMP(r[a[3]], 0, UINT8_MAX));
+
+            r[a[0]] = color_pack(c.r, c.g, c.b);
+            break;
+        }
+        case ANIM_OP_RGB:
+            r[a[0]] = color_pack(r[a[1]], r[a[2]], r[a[3]]);
+            break;
+        case ANIM_OP_FILL:
+            for (int32_t i = 0; i < count; i++)
+            {
+                render_pixel_set(first + i, color_unpack(r[a[2]]));
+            }
+            break;
+        case ANIM_OP_GRAD: {
+            /* Position within the unclipped span */
+            int64_t span = MAX((int64_t)r[a[1]] - 1, 1);
+            int64_t offset = (int64_t)first - r[a[0]];
+
+            for (int32_t i = 0; i < count; i++)
+            {
+                int32_t t = (int32_t)MIN(((offset + i) * UINT8_MAX) / span, UINT8_MAX);
+
+                render_pixel_set(first + i, color_unpack(color_lerp(r[a[2]], r[a[3]], t)));
+            }
+            break;
+        }
+        case ANIM_OP_PIXEL:
+            if (r[a[0]] >= from && r[a[0]] < to)
+            {
+                render_pixel_set(r[a[0]], color_unpack(r[a[1]]));
+            }
+            break;
+        case ANIM_OP_JMP:
+            pc = sys_get_le16(&a[0]);
+            break;
+        case ANIM_OP_JZ:
+            if (r[a[0]] == 0)
+            {
+                pc = sys_get_le16(&a[1]);
+            }
+            break;
+        case ANIM_OP_JLT:
+            if (r[a[0]] < r[a[1]])
+            {
+                pc = sys_get_le16(&a[2]);
+            }
+            break;
+        case ANIM_OP_LOOP:
+            r[a[0]] = wrap_sub(r[a[0]], 1);
+            if (r[a[0]] > 0)
+            {
+                pc = sys_get_le16(&a[1]);
+            }
+            break;
+        case ANIM_OP_KEYF:
+            r[a[0]] = keyframe(prog, sys_get_le16(&a[2]), r[a[1]]);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ANIM_VM_H
+#define ANIM_VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/*
+ * Animation file: header, code section, data section. All values are little
+ * endian. The code runs once per frame from the start until END, registers
+ * keep their values between frames. Colors are 0x00RRGGBB in a register.
+ *
+ * Instructions are an opcode byte followed by one byte per register operand
+ * and two bytes per immediate or address. Jump addresses are code offsets,
+ * KEYF addresses are data offsets of a table:
+ *   count (u8, >= 2), ease (u8), count * { time ms (u16), value (i16) }
+ */
+#define ANIM_MAGIC   0x4e41 /* "AN" */
+#define ANIM_VERSION 1U
+#define ANIM_REGS    8U
+
+struct anim_header
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t code_len;
+    uint16_t data_len;
+    /* CRC16-CCITT over code and data, seed 0xffff */
+    uint16_t crc;
+} __packed;
+
+enum anim_op
+{
+    ANIM_OP_END,   /* end of frame */
+    ANIM_OP_LDI,   /* rd, imm16: rd = imm (signed) */
+    ANIM_OP_MOV,   /* rd, rs */
+    ANIM_OP_ADD,   /* rd, rs: rd += rs, wraps */
+    ANIM_OP_SUB,   /* rd, rs: rd -= rs, wraps */
+    ANIM_OP_MUL,   /* rd, rs: rd *= rs, wraps */
+    ANIM_OP_DIV,   /* rd, rs: rd /= rs, 0 if rs is 0 */
+    ANIM_OP_MOD,   /* rd, rs: rd %= rs, 0 if rs is 0 */
+    ANIM_OP_TIME,  /* rd: ms since the pattern started */
+    ANIM_OP_NPIX,  /* rd: number of pixels */
+    ANIM_OP_EASE,  /* rd, rs, mode: rd = ease(rs clamped to 0..255) */
+    ANIM_OP_LERP,  /* rd, ra, rb, rt: rd = ra + (rb - ra) * rt / 255 */
+    ANIM_OP_HSV,   /* rd, rh, rs, rv: rd = color, hue 0..1535 */
+    ANIM_OP_RGB,   /* rd, rr, rg, rb: rd = color */
+    ANIM_OP_FILL,  /* rf, rn, rc: pixels rf..rf+rn-1 = rc */
+    ANIM_OP_GRAD,  /* rf, rn, ra, rb: gradient from ra to rb */
+    ANIM_OP_PIXEL, /* ri, rc: pixel ri = rc */
+    ANIM_OP_JMP,   /* addr16 */
+    ANIM_OP_JZ,    /* rs, addr16: jump if rs == 0 */
+    ANIM_OP_JLT,   /* ra, rb, addr16: jump if ra < rb */
+    ANIM_OP_LOOP,  /* rc, addr16: jump while --rc > 0 */
+    ANIM_OP_KEYF,  /* rd, rt, addr16: rd = keyframe table value at time rt */
+    ANIM_OP_COUNT,
+};
+
+enum anim_ease
+{
+    ANIM_EASE_LINEAR,
+    ANIM_EASE_IN,
+    ANIM_EASE_OUT,
+    ANIM_EASE_IN_OUT,
+    ANIM_EASE_SMOOTH,
+    ANIM_EASE_COUNT,
+};
+
+struct anim_program
+{
+    uint16_t code_len;
+    uint16_t data_len;
+    /* Code followed by data */
+    uint8_t image[CONFIG_APP_ANIM_MAX_SIZE];
+    int32_t regs[ANIM_REGS];
+};
+
+/** @brief Validate an animation file and load it, registers start at 0. */
+int anim_vm_load(struct anim_program* prog, const uint8_t* file, size_t len);
+
+/**
+ * @brief Run one frame.
+ *
+ * Every instruction costs one unit of CONFIG_APP_ANIM_BUDGET, pixel and
+ * keyframe operations one more unit per eight pixels or four keyframes, so
+ * a frame takes a bounded number of cycles whatever the program does.
+ * Pixels outside [from, to) are not drawn.
+ *
+ * @retval -E2BIG The budget ran out before END, the frame is cut short.
+ */
+int anim_vm_run(struct anim_program* prog, uint32_t time, uint16_t from, uint16_t to);
+
+#endif // ANIM_VM_H
@@ -15,8 +15,21 @@
 #include <zephyr/bluetooth/hci.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/init.h>
+#include <zephyr/stats/stats.h>
 #include <zephyr/sys/byteorder.h>
 
+#include "anim.h"
+#include "ble.h"
+#include "broadcast.h"
+#include "gatt_cache.h"
+#include "latency.h"
+#include "light_peers.h"
+#include "link_profile.h"
+#include "render.h"
+#include "rgbled_service.h"
+#include "trace.h"
+
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(ble, LOG_LEVEL_DBG);
 
@@ -24,43 +37,25 @@ LOG_MODULE_REGISTER(ble, LOG_LEVEL_DBG);
 #define LED0_NODE DT_ALIAS(led0)
 static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 
-#define STACK_SIZE      1024
-#define THREAD_PRIORITY 5
-
 /* Use atomic variable, 2 bits for connection and disconnection state */
-static ATOMIC_DEFINE(conn_state, 4U);
+static ATOMIC_DEFINE(conn_state, 8U);
 #define STATE_CONNECTED               1U
 #define STATE_DISCONNECTED            2U
 #define STATE_PERIPHERAL_CONNECTED    3U
 #define STATE_PERIPHERAL_DISCONNECTED 4U
-
-/** @brief RGBLED Service UUID */
-#define BT_UUID_RGBLED_CTRL_SERVICE_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4)
-#define BT_UUID_RGBLED_SERVICE_VAL      BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef0)
-
-// f0debc9a7856 3412 7856 3412 78563412 0106
-
-/** @brief RGBLED Pattern Characteristic UUID */
-#define BT_UUID_RGBLED_PATTERN_CHAR_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef1)
-
-/** @brief RGBLED Pattern Characteristic UUID */
-#define BT_UUID_RGBLED_INDICATOR_CHAR_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef2)
-
-#define BT_UUID_RGBLED_SERVICE        BT_UUID_DECLARE_128(BT_UUID_RGBLED_SERVICE_VAL)
-#define BT_UUID_RGBLED_PATTERN_CHAR   BT_UUID_DECLARE_128(BT_UUID_RGBLED_PATTERN_CHAR_VAL)
-#define BT_UUID_RGBLED_INDICATOR_CHAR BT_UUID_DECLARE_128(BT_UUID_RGBLED_INDICATOR_CHAR_VAL)
+#define STATE_PEERS_DIRTY             5U
+#define STATE_PEER_LEARNING           6U
 
 static const struct bt_data ad[] = {
     BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
     BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_RGBLED_CTRL_SERVICE_VAL),
 };
 
-#if !defined(CONFIG_BT_EXT_ADV)
+/* Also used with CONFIG_BT_EXT_ADV, bt_le_adv_start() keeps using a legacy set */
 static const struct bt_data sd[] = {
     BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_RGBLED_CTRL_SERVICE_VAL),
     BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
 };
-#endif /* !CONFIG_BT_EXT_ADV */
 
 static enum {
     BLE_CENTRAL_DISCONNECTED,
@@ -70,134 +65,1168 @@ static enum {
 } ble_state;
 
 static struct k_work_delayable ble_work;
+static struct k_work_delayable learn_work;
 
 extern const char* bt_uuid_str(const struct bt_uuid* uuid);
 static void write_func(struct bt_conn* conn, uint8_t err, struct bt_gatt_write_params* params);
 static void start_scan(void);
 static void start_advertising(void);
+static bool peer_learning(void);
+
+/* Protocol negotiated with the light during discovery */
+enum rgbled_proto
+{
+    RGBLED_PROTO_NONE,
+    RGBLED_PROTO_LEGACY,
+    RGBLED_PROTO_STATE,
+};
+
+/* What to do with the database hash once it has been read */
+enum db_hash_action
+{
+    DB_HASH_VERIFY,
+    DB_HASH_STORE,
+};
+
+/* Light commands are coalesced per characteristic: a command is only a dirty
+ * flag and the value is taken from light_state when it is sent. At most one
+ * write is in flight per connection. Commands are drained in enum order, so
+ * indicator changes go out first.
+ */
+enum rgbled_cmd
+{
+    RGBLED_CMD_STATE,
+    RGBLED_CMD_INDICATOR,
+    RGBLED_CMD_PATTERN,
+    RGBLED_CMD_COUNT,
+};
+
+/* ble_light_write() picks the characteristic like the command queue */
+BUILD_ASSERT(BLE_LIGHT_CHAR_STATE == (int)RGBLED_CMD_STATE);
+BUILD_ASSERT(BLE_LIGHT_CHAR_INDICATOR == (int)RGBLED_CMD_INDICATOR);
+BUILD_ASSERT(BLE_LIGHT_CHAR_PATTERN == (int)RGBLED_CMD_PATTERN);
+
+struct rgbled_cmd_queue
+{
+    struct k_spinlock lock;
+    struct bt_gatt_write_params write_params;
+    struct k_work_delayable retry_work;
+    uint8_t tx_buf[sizeof(struct rgbled_light_state)];
+    uint16_t tx_seq;
+    enum rgbled_cmd tx_cmd;
+    /* Sequence number of the last state write handed to the host */
+    uint16_t sent_seq;
+    bool sent;
+    uint8_t dirty;
+    bool busy;
+};
 
-static struct bt_conn* default_conn;
+/* Fields of the light state mirrored per light */
+#define REMOTE_PATTERN    BIT(0)
+#define REMOTE_INDICATOR  BIT(1)
+#define REMOTE_BRIGHTNESS BIT(2)
 
-static struct bt_uuid_128 discover_uuid = BT_UUID_INIT_128(0);
-static struct bt_uuid_16 discover_uuid_ccc = BT_UUID_INIT_16(0);
-static struct bt_gatt_discover_params discover_params;
-static struct bt_gatt_subscribe_params subscribe_params;
-uint16_t rgbled_pattern_char_handle;
-uint16_t rgbled_indicator_char_handle;
+/* Everything the controller tracks for one connected light */
+struct light_link
+{
+    struct bt_conn* conn;
+    enum rgbled_proto proto;
+    uint16_t service_start_handle;
+    uint16_t service_end_handle;
+    uint16_t pattern_char_handle;
+    uint16_t indicator_char_handle;
+    uint16_t state_char_handle;
+    struct bt_uuid_128 discover_uuid;
+    struct bt_uuid_16 discover_uuid_ccc;
+    struct bt_gatt_discover_params discover_params;
+    struct bt_gatt_subscribe_params subscribe_params;
+    enum db_hash_action db_hash_action;
+    struct bt_gatt_read_params db_hash_read_params;
+    struct gatt_cache_entry cache_entry;
+    struct rgbled_cmd_queue queue;
+    /* Mirror of what the light shows, from the read on link setup, write
+     * acknowledgments and notifications. Only the fields in remote_known
+     * are valid, a field is forgotten while a write to it is unconfirmed.
+     * Protected by the queue lock.
+     */
+    struct rgbled_light_state remote;
+    uint8_t remote_known;
+    struct bt_gatt_read_params remote_read_params;
+    /* remote_read_params is in use until its callback ran. A stale read was
+     * started on handles that were dropped since, its value is ignored. A
+     * sync asked for meanwhile starts when it completes.
+     */
+    bool remote_reading;
+    bool remote_stale;
+    bool remote_again;
+    /* Link setup time, used for the time-to-first-write statistic */
+    int64_t connected_ts;
+    bool first_write_done;
+};
+
+static struct light_link links[CONFIG_BT_MAX_CONN];
+
+/* Connection being created from a scan report, owned until connected() */
+static struct bt_conn* pending_conn;
 
 uint64_t total_rx_count; /* This value is exposed to test code */
 
 typedef void (*bt_connected_cb_t)(void);
 static bt_connected_cb_t connected_cb;
 
-void rgbled_pattern_next(void)
+static ble_notify_cb_t notify_cb;
+
+/* Connection statistics, readable through the mcumgr stat group */
+STATS_SECT_START(ble_stats)
+STATS_SECT_ENTRY32(ttfw_last_ms)
+STATS_SECT_ENTRY32(ttfw_max_ms)
+STATS_SECT_ENTRY32(cache_hits)
+STATS_SECT_ENTRY32(cache_misses)
+STATS_SECT_ENTRY32(lights)
+STATS_SECT_ENTRY32(fanouts)
+STATS_SECT_ENTRY32(skew_last_us)
+STATS_SECT_ENTRY32(skew_max_us)
+STATS_SECT_ENTRY32(skipped)
+STATS_SECT_ENTRY32(diverged)
+STATS_SECT_END;
+
+STATS_NAME_START(ble_stats)
+STATS_NAME(ble_stats, ttfw_last_ms)
+STATS_NAME(ble_stats, ttfw_max_ms)
+STATS_NAME(ble_stats, cache_hits)
+STATS_NAME(ble_stats, cache_misses)
+STATS_NAME(ble_stats, lights)
+STATS_NAME(ble_stats, fanouts)
+STATS_NAME(ble_stats, skew_last_us)
+STATS_NAME(ble_stats, skew_max_us)
+STATS_NAME(ble_stats, skipped)
+STATS_NAME(ble_stats, diverged)
+STATS_NAME_END(ble_stats);
+
+static STATS_SECT_DECL(ble_stats) ble_stats;
+
+/* Desired light state, the queue encodes it at send time so a write always
+ * carries the latest value.
+ */
+static struct
+{
+    struct k_spinlock lock;
+    uint16_t seq;
+    uint8_t pattern;
+    uint8_t indicator;
+    uint8_t brightness;
+} light_state = {
+    .indicator = INDICATOR_OFF,
+    .brightness = UINT8_MAX,
+};
+
+/* Skew of one fan-out: the time between the first and the last light
+ * acknowledging the same state change.
+ */
+static struct
+{
+    struct k_spinlock lock;
+    uint16_t seq;
+    uint32_t pending;
+    uint32_t first_ack;
+    uint32_t last_ack;
+} fanout;
+
+static struct light_link* link_get(const struct bt_conn* conn)
+{
+    for (int i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        if (links[i].conn == conn)
+        {
+            return &links[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool link_ready(const struct light_link* link)
+{
+    return link->conn && link->proto != RGBLED_PROTO_NONE;
+}
+
+static size_t links_connected(void)
+{
+    size_t count = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        if (links[i].conn)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void fanout_start(uint16_t seq, uint32_t targets, size_t count)
+{
+    k_spinlock_key_t key = k_spin_lock(&fanout.lock);
+
+    /* A new change replaces a round that has not completed yet */
+    fanout.seq = seq;
+    fanout.pending = count > 1 ? targets : 0;
+    fanout.first_ack = 0;
+    k_spin_unlock(&fanout.lock, key);
+}
+
+static void fanout_ack(struct light_link* link, uint16_t seq)
+{
+    uint32_t idx = ARRAY_INDEX(links, link);
+    uint32_t now = k_cycle_get_32();
+    bool done = false;
+    uint32_t skew = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&fanout.lock);
+
+    if ((fanout.pending & BIT(idx)) && (int16_t)(seq - fanout.seq) >= 0)
+    {
+        if (!fanout.first_ack)
+        {
+            fanout.first_ack = now;
+        }
+        fanout.last_ack = now;
+        fanout.pending &= ~BIT(idx);
+
+        if (!fanout.pending)
+        {
+            done = true;
+            skew = k_cyc_to_us_floor32(fanout.last_ack - fanout.first_ack);
+        }
+    }
+
+    k_spin_unlock(&fanout.lock, key);
+
+    if (done)
+    {
+        STATS_INC(ble_stats, fanouts);
+        STATS_SET(ble_stats, skew_last_us, skew);
+        if (skew > ble_stats.skew_max_us)
+        {
+            STATS_SET(ble_stats, skew_max_us, skew);
+        }
+    }
+}
+
+static uint16_t cmd_queue_handle(const struct light_link* link, enum rgbled_cmd cmd)
+{
+    switch (cmd)
+    {
+    case RGBLED_CMD_STATE:
+        return link->state_char_handle;
+    case RGBLED_CMD_INDICATOR:
+        return link->indicator_char_handle;
+    case RGBLED_CMD_PATTERN:
+        return link->pattern_char_handle;
+    default:
+        return 0;
+    }
+}
+
+static uint16_t cmd_queue_encode(enum rgbled_cmd cmd, uint8_t* buf, uint16_t* seq)
+{
+    struct rgbled_light_state* state = (struct rgbled_light_state*)buf;
+    uint16_t len = 1;
+
+    k_spinlock_key_t key = k_spin_lock(&light_state.lock);
+
+    switch (cmd)
+    {
+    case RGBLED_CMD_STATE:
+        state->version = RGBLED_LIGHT_STATE_VERSION;
+        state->seq = sys_cpu_to_le16(light_state.seq);
+        state->pattern = light_state.pattern;
+        state->indicator = light_state.indicator;
+        state->brightness = light_state.brightness;
+        len = sizeof(*state);
+        break;
+    case RGBLED_CMD_INDICATOR:
+        buf[0] = light_state.indicator;
+        break;
+    case RGBLED_CMD_PATTERN:
+        buf[0] = light_state.pattern;
+        break;
+    default:
+        len = 0;
+        break;
+    }
+
+    *seq = light_state.seq;
+    k_spin_unlock(&light_state.lock, key);
+
+    return len;
+}
+
+/* Fields of the light state a command writes */
+static uint8_t cmd_fields(enum rgbled_cmd cmd)
+{
+    switch (cmd)
+    {
+    case RGBLED_CMD_STATE:
+        return REMOTE_PATTERN | REMOTE_INDICATOR | REMOTE_BRIGHTNESS;
+    case RGBLED_CMD_INDICATOR:
+        return REMOTE_INDICATOR;
+    case RGBLED_CMD_PATTERN:
+        return REMOTE_PATTERN;
+    default:
+        return 0;
+    }
+}
+
+/* Take a characteristic value the light confirmed into the mirror, called
+ * with the queue lock held.
+ */
+static void remote_update(struct light_link* link, enum rgbled_cmd cmd, const uint8_t* buf)
+{
+    const struct rgbled_light_state* state = (const struct rgbled_light_state*)buf;
+
+    switch (cmd)
+    {
+    case RGBLED_CMD_STATE:
+        link->remote.pattern = state->pattern;
+        link->remote.indicator = state->indicator;
+        link->remote.brightness = state->brightness;
+        break;
+    case RGBLED_CMD_INDICATOR:
+        link->remote.indicator = buf[0];
+        break;
+    case RGBLED_CMD_PATTERN:
+        link->remote.pattern = buf[0];
+        break;
+    default:
+        return;
+    }
+
+    link->remote_known |= cmd_fields(cmd);
+}
+
+/* True if the light is known to show the value encoded in @p buf, called
+ * with the queue lock held.
+ */
+static bool remote_matches(const struct light_link* link, enum rgbled_cmd cmd, const uint8_t* buf)
+{
+    const struct rgbled_light_state* state = (const struct rgbled_light_state*)buf;
+    uint8_t fields = cmd_fields(cmd);
+
+    if (!fields || (link->remote_known & fields) != fields)
+    {
+        return false;
+    }
+
+    switch (cmd)
+    {
+    case RGBLED_CMD_STATE:
+        return link->remote.pattern == state->pattern && link->remote.indicator == state->indicator &&
+               link->remote.brightness == state->brightness;
+    case RGBLED_CMD_INDICATOR:
+        return link->remote.indicator == buf[0];
+    case RGBLED_CMD_PATTERN:
+        return link->remote.pattern == buf[0];
+    default:
+        return false;
+    }
+}
+
+static void cmd_queue_drain(struct light_link* link);
+
+static void first_write_check(struct light_link* link)
+{
+    uint32_t ttfw;
+
+    if (link->first_write_done)
+    {
+        return;
+    }
+
+    link->first_write_done = true;
+    ttfw = (uint32_t)(k_uptime_get() - link->connected_ts);
+    STATS_SET(ble_stats, ttfw_last_ms, ttfw);
+    if (ttfw > ble_stats.ttfw_max_ms)
+    {
+        STATS_SET(ble_stats, ttfw_max_ms, ttfw);
+    }
+
+    LOG_INF("Time to first write %u ms", ttfw);
+}
+
+static void cmd_queue_done(struct light_link* link, bool success)
 {
-    static uint8_t pattern = 0x0;
+    struct rgbled_cmd_queue* queue = &link->queue;
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+    uint16_t seq = queue->tx_seq;
+
+    queue->busy = false;
+    k_spin_unlock(&queue->lock, key);
+
+    if (success)
+    {
+        latency_mark(LATENCY_STAGE_ACK);
+        first_write_check(link);
+        fanout_ack(link, seq);
+    }
+
+    cmd_queue_drain(link);
+}
+
+static void trace_write(enum trace_event event, struct light_link* link, enum rgbled_cmd cmd, uint16_t b)
+{
+    trace_point(event, ARRAY_INDEX(links, link) | cmd << 4, b);
+}
+
+static void write_cmd_sent(struct bt_conn* conn, void* user_data)
+{
+    struct light_link* link = user_data;
+
+    trace_write(TRACE_WRITE_DONE, link, link->queue.tx_cmd, 0);
+    LOG_DBG("[write cmd] Sent");
+    cmd_queue_done(user_data, true);
+}
+
+static int cmd_queue_send(struct light_link* link, enum rgbled_cmd cmd, uint16_t handle, uint16_t len)
+{
+    struct rgbled_cmd_queue* queue = &link->queue;
+
+    if (IS_ENABLED(CONFIG_APP_BLE_INDICATOR_WRITE_NO_RSP) && cmd != RGBLED_CMD_PATTERN)
+    {
+        return bt_gatt_write_without_response_cb(link->conn, handle, queue->tx_buf, len, false, write_cmd_sent, link);
+    }
+
+    queue->write_params.handle = handle;
+    queue->write_params.offset = 0;
+    queue->write_params.data = queue->tx_buf;
+    queue->write_params.length = len;
+    queue->write_params.func = write_func;
+
+    return bt_gatt_write(link->conn, &queue->write_params);
+}
+
+static void cmd_queue_drain(struct light_link* link)
+{
+    struct rgbled_cmd_queue* queue = &link->queue;
+    enum rgbled_cmd cmd;
+    uint16_t handle = 0;
+    uint16_t len = 0;
+    k_spinlock_key_t key;
+    bool skip;
     int err;
-    uint8_t buf[1];
 
-    if (atomic_test_bit(conn_state, STATE_CONNECTED) && rgbled_pattern_char_handle != 0)
+    do
     {
-        static struct bt_gatt_write_params write_params;
-        buf[0] = pattern;
+        cmd = RGBLED_CMD_COUNT;
+        key = k_spin_lock(&queue->lock);
 
-        write_params.handle = rgbled_pattern_char_handle;
-        write_params.offset = 0;
-        write_params.data = buf;
-        write_params.length = 1;
-        write_params.func = write_func;
-        LOG_DBG("Writing pattern %d to handle %d", pattern, write_params.handle);
-        err = bt_gatt_write(default_conn, &write_params);
-        if (err)
+        if (!queue->busy && link->conn)
         {
-            LOG_DBG("Write failed for pattern %x (err %d)", pattern, err);
+            for (int i = 0; i < RGBLED_CMD_COUNT; i++)
+            {
+                handle = cmd_queue_handle(link, i);
+                if ((queue->dirty & BIT(i)) && handle != 0)
+                {
+                    cmd = i;
+                    queue->dirty &= ~BIT(i);
+                    queue->busy = true;
+                    break;
+                }
+            }
+        }
+
+        k_spin_unlock(&queue->lock, key);
+
+        if (cmd == RGBLED_CMD_COUNT)
+        {
+            return;
+        }
+
+        len = cmd_queue_encode(cmd, queue->tx_buf, &queue->tx_seq);
+
+        /* Nothing to send if the light already shows the value, otherwise
+         * the mirror no longer knows the fields until the write is confirmed.
+         */
+        key = k_spin_lock(&queue->lock);
+        skip = remote_matches(link, cmd, queue->tx_buf);
+        if (skip)
+        {
+            queue->busy = false;
         }
         else
         {
-            LOG_DBG("Write successful");
-            pattern++;
-            if (pattern > 0x2)
+            queue->tx_cmd = cmd;
+            link->remote_known &= ~cmd_fields(cmd);
+            if (cmd == RGBLED_CMD_STATE)
             {
-                // Back to first pattern
-                pattern = 0x0;
+                queue->sent_seq = queue->tx_seq;
+                queue->sent = true;
             }
         }
+        k_spin_unlock(&queue->lock, key);
+
+        if (skip)
+        {
+            trace_write(TRACE_WRITE_SKIP, link, cmd, queue->tx_seq);
+            LOG_DBG("Light already shows cmd %d, not writing", cmd);
+            STATS_INC(ble_stats, skipped);
+            first_write_check(link);
+            fanout_ack(link, queue->tx_seq);
+        }
+    } while (skip);
+
+    LOG_DBG("Writing cmd %d (%u bytes) to handle %d", cmd, len, handle);
+    latency_mark(LATENCY_STAGE_SUBMIT);
+    trace_write(TRACE_WRITE_SUBMIT, link, cmd, queue->tx_seq);
+    err = cmd_queue_send(link, cmd, handle, len);
+    if (!err)
+    {
+        return;
+    }
+
+    LOG_DBG("Write failed for cmd %d (err %d)", cmd, err);
+
+    key = k_spin_lock(&queue->lock);
+    queue->busy = false;
+    queue->dirty |= BIT(cmd);
+    k_spin_unlock(&queue->lock, key);
+
+    /* Out of ATT buffers or a request is still pending: retry shortly */
+    if (err == -ENOMEM || err == -EBUSY || err == -EAGAIN)
+    {
+        k_work_reschedule(&queue->retry_work, K_MSEC(CONFIG_APP_BLE_CMD_RETRY_MS));
+    }
+}
+
+static void cmd_queue_retry(struct k_work* work)
+{
+    struct k_work_delayable* dwork = k_work_delayable_from_work(work);
+    struct light_link* link = CONTAINER_OF(dwork, struct light_link, queue.retry_work);
+
+    cmd_queue_drain(link);
+}
+
+static void cmd_queue_put(struct light_link* link, enum rgbled_cmd cmd)
+{
+    struct rgbled_cmd_queue* queue = &link->queue;
+
+    /* The packed state characteristic carries every field */
+    if (link->proto == RGBLED_PROTO_STATE)
+    {
+        cmd = RGBLED_CMD_STATE;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+
+    queue->dirty |= BIT(cmd);
+    k_spin_unlock(&queue->lock, key);
+
+    /* The host only allocates ATT buffers without waiting on the system
+     * workqueue, other callers such as the input workqueue hand over.
+     */
+    if (k_current_get() == k_work_queue_thread_get(&k_sys_work_q))
+    {
+        cmd_queue_drain(link);
+    }
+    else
+    {
+        k_work_reschedule(&queue->retry_work, K_NO_WAIT);
+    }
+}
+
+static void cmd_queue_reset(struct light_link* link)
+{
+    struct rgbled_cmd_queue* queue = &link->queue;
+
+    k_work_cancel_delayable(&queue->retry_work);
+
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+
+    queue->dirty = 0;
+    queue->busy = false;
+    queue->sent = false;
+    link->remote_known = 0;
+    k_spin_unlock(&queue->lock, key);
+}
+
+/* Queue a command on every usable light. Each link has its own write in
+ * flight, so the lights are updated in parallel.
+ */
+static void rgbled_fanout(enum rgbled_cmd cmd, uint16_t seq)
+{
+    uint32_t targets = 0;
+    size_t count = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        /* Brightness is only carried by the packed state characteristic */
+        if (link_ready(&links[i]) && (cmd != RGBLED_CMD_STATE || links[i].proto == RGBLED_PROTO_STATE))
+        {
+            targets |= BIT(i);
+            count++;
+        }
+    }
+
+    fanout_start(seq, targets, count);
+    link_profile_activity();
+
+    if (IS_ENABLED(CONFIG_APP_BLE_BROADCAST) || IS_ENABLED(CONFIG_APP_STRIP))
+    {
+        struct rgbled_light_state state;
+        uint16_t state_seq;
+
+        (void)cmd_queue_encode(RGBLED_CMD_STATE, (uint8_t*)&state, &state_seq);
+
+        if (IS_ENABLED(CONFIG_APP_BLE_BROADCAST))
+        {
+            broadcast_update(&state);
+        }
+
+        if (IS_ENABLED(CONFIG_APP_STRIP))
+        {
+            render_update(&state);
+        }
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        if (targets & BIT(i))
+        {
+            cmd_queue_put(&links[i], cmd);
+        }
+    }
+}
+
+/* Push the complete desired state, used once a link becomes usable */
+static void rgbled_sync_state(struct light_link* link)
+{
+    if (link->proto == RGBLED_PROTO_STATE)
+    {
+        cmd_queue_put(link, RGBLED_CMD_STATE);
+    }
+    else if (link->proto == RGBLED_PROTO_LEGACY)
+    {
+        cmd_queue_put(link, RGBLED_CMD_INDICATOR);
+        cmd_queue_put(link, RGBLED_CMD_PATTERN);
+    }
+}
+
+static void remote_sync(struct light_link* link);
+
+static uint8_t remote_read_func(
+    struct bt_conn* conn,
+    uint8_t err,
+    struct bt_gatt_read_params* params,
+    const void* data,
+    uint16_t length)
+{
+    struct light_link* link = CONTAINER_OF(params, struct light_link, remote_read_params);
+
+    link->remote_reading = false;
+
+    if (link->remote_stale)
+    {
+        link->remote_stale = false;
+        if (link->remote_again && link->conn)
+        {
+            link->remote_again = false;
+            remote_sync(link);
+        }
+
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (!err && data && length == sizeof(struct rgbled_light_state))
+    {
+        k_spinlock_key_t key = k_spin_lock(&link->queue.lock);
+
+        remote_update(link, RGBLED_CMD_STATE, data);
+        k_spin_unlock(&link->queue.lock, key);
+    }
+    else
+    {
+        LOG_DBG("Light state not readable (err %u), writing all of it", err);
+    }
+
+    rgbled_sync_state(link);
+
+    return BT_GATT_ITER_STOP;
+}
+
+/* Bring a light that became usable to the desired state. The packed state
+ * is read back first, so a light that kept its state over a reconnect only
+ * gets the fields that differ and a power-cycled one gets everything.
+ */
+static void remote_sync(struct light_link* link)
+{
+    struct bt_gatt_read_params* params = &link->remote_read_params;
+    int err;
+
+    /* The parameters belong to the stack until the callback ran */
+    if (link->remote_reading)
+    {
+        link->remote_again = true;
+        return;
+    }
+
+    if (link->proto == RGBLED_PROTO_STATE)
+    {
+        params->func = remote_read_func;
+        params->handle_count = 1;
+        params->single.handle = link->state_char_handle;
+        params->single.offset = 0;
+
+        err = bt_gatt_read(link->conn, params);
+        if (!err)
+        {
+            link->remote_reading = true;
+            return;
+        }
+
+        LOG_DBG("Light state read failed (err %d)", err);
+    }
+
+    rgbled_sync_state(link);
+}
+
+/* A light notified a characteristic value. Keep it in the mirror and repair
+ * a light that shows something else than it was told to without a write
+ * pending, e.g. one that was power-cycled.
+ */
+static void remote_notified(struct light_link* link, uint16_t handle, const uint8_t* data, uint16_t length)
+{
+    struct rgbled_cmd_queue* queue = &link->queue;
+    uint8_t desired[sizeof(struct rgbled_light_state)];
+    enum rgbled_cmd cmd;
+    k_spinlock_key_t key;
+    uint16_t seq;
+    bool diverged;
+
+    if (handle == link->state_char_handle && length == sizeof(struct rgbled_light_state))
+    {
+        cmd = RGBLED_CMD_STATE;
+    }
+    else if (handle == link->indicator_char_handle && length == 1)
+    {
+        cmd = RGBLED_CMD_INDICATOR;
+    }
+    else if (handle == link->pattern_char_handle && length == 1)
+    {
+        cmd = RGBLED_CMD_PATTERN;
+    }
+    else
+    {
+        return;
+    }
+
+    (void)cmd_queue_encode(cmd, desired, &seq);
+
+    key = k_spin_lock(&queue->lock);
+
+    /* The write in flight updates the mirror when it completes, and a
+     * notification sent before the light took the last state write would
+     * undo it.
+     */
+    if (queue->busy ||
+        (cmd == RGBLED_CMD_STATE && queue->sent &&
+         (int16_t)(sys_le16_to_cpu(((const struct rgbled_light_state*)data)->seq) - queue->sent_seq) < 0))
+    {
+        k_spin_unlock(&queue->lock, key);
+        return;
+    }
+
+    remote_update(link, cmd, data);
+    diverged = !queue->dirty && !remote_matches(link, cmd, desired);
+    k_spin_unlock(&queue->lock, key);
+
+    if (diverged)
+    {
+        LOG_INF("Light %d diverged from the desired state, resyncing", (int)ARRAY_INDEX(links, link));
+        STATS_INC(ble_stats, diverged);
+        rgbled_sync_state(link);
+    }
+}
+
+void rgbled_pattern_next(void)
+{
+    uint16_t seq;
+
+    k_spinlock_key_t key = k_spin_lock(&light_state.lock);
+
+    light_state.pattern = anim_pattern_next(light_state.pattern);
+    seq = ++light_state.seq;
+    k_spin_unlock(&light_state.lock, key);
+
+    LOG_DBG("Queueing pattern");
+
+    rgbled_fanout(RGBLED_CMD_PATTERN, seq);
+}
+
+void rgbled_pattern_set(uint8_t pattern)
+{
+    uint16_t seq;
+
+    k_spinlock_key_t key = k_spin_lock(&light_state.lock);
+
+    light_state.pattern = pattern;
+    seq = ++light_state.seq;
+    k_spin_unlock(&light_state.lock, key);
+
+    rgbled_fanout(RGBLED_CMD_PATTERN, seq);
+}
+
+void rgbled_left_right_hazard(uint8_t state)
+{
+    uint16_t seq;
+
+    k_spinlock_key_t key = k_spin_lock(&light_state.lock);
+
+    light_state.indicator = state;
+    seq = ++light_state.seq;
+    k_spin_unlock(&light_state.lock, key);
+
+    LOG_DBG("Queueing left_right %d", state);
+
+    link_profile_indicator(state != INDICATOR_OFF);
+
+    rgbled_fanout(RGBLED_CMD_INDICATOR, seq);
+}
+
+void rgbled_brightness_set(uint8_t brightness)
+{
+    uint16_t seq;
+
+    k_spinlock_key_t key = k_spin_lock(&light_state.lock);
+
+    light_state.brightness = brightness;
+    seq = ++light_state.seq;
+    k_spin_unlock(&light_state.lock, key);
+
+    rgbled_fanout(RGBLED_CMD_STATE, seq);
+}
+
+void rgbled_state_get(struct rgbled_light_state* state)
+{
+    uint16_t seq;
+
+    (void)cmd_queue_encode(RGBLED_CMD_STATE, (uint8_t*)state, &seq);
+}
+
+void ble_notify_callback_set(ble_notify_cb_t cb)
+{
+    notify_cb = cb;
+}
+
+size_t ble_lights_get(struct ble_light_info* info, size_t max)
+{
+    size_t count = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(links) && count < max; i++)
+    {
+        if (link_ready(&links[i]))
+        {
+            info[count].index = i;
+            bt_addr_le_copy(&info[count].addr, bt_conn_get_dst(links[i].conn));
+            info[count].state_char = links[i].proto == RGBLED_PROTO_STATE;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void light_write_func(struct bt_conn* conn, uint8_t err, struct bt_gatt_write_params* params)
+{
+    struct ble_light_write* write = CONTAINER_OF(params, struct ble_light_write, params);
+
+    write->cb(write, err ? -EIO : 0);
+}
+
+static void light_write_sent(struct bt_conn* conn, void* user_data)
+{
+    struct ble_light_write* write = user_data;
+
+    write->cb(write, 0);
+}
+
+int ble_light_write(uint8_t light,
+                    enum ble_light_char chr,
+                    bool response,
+                    struct ble_light_write* write,
+                    const uint8_t* data,
+                    uint16_t len)
+{
+    struct light_link* link;
+    uint16_t handle;
+
+    if (light >= ARRAY_SIZE(links) || chr >= RGBLED_CMD_COUNT)
+    {
+        return -EINVAL;
+    }
+
+    link = &links[light];
+    if (!link_ready(link))
+    {
+        return -ENOTCONN;
+    }
+
+    handle = cmd_queue_handle(link, (enum rgbled_cmd)chr);
+    if (!handle)
+    {
+        return -ENOENT;
+    }
+
+    /* The mirror cannot follow raw writes, the light's notification restores it */
+    k_spinlock_key_t key = k_spin_lock(&link->queue.lock);
+
+    link->remote_known &= ~cmd_fields((enum rgbled_cmd)chr);
+    k_spin_unlock(&link->queue.lock, key);
+
+    link_profile_activity();
+
+    if (!response)
+    {
+        return bt_gatt_write_without_response_cb(link->conn, handle, data, len, false, light_write_sent, write);
+    }
+
+    write->params.handle = handle;
+    write->params.offset = 0;
+    write->params.data = data;
+    write->params.length = len;
+    write->params.func = light_write_func;
+
+    return bt_gatt_write(link->conn, &write->params);
+}
+
+extern void ble_on_connected(void (*connected)(void))
+{
+    connected_cb = connected;
+}
+
+static void ble_timeout(struct k_work* work)
+{
+    LOG_DBG("BLE timeout");
+    switch (ble_state)
+    {
+    case BLE_PERIPHERAL_DISCONNECTED:
+        ble_state = BLE_START_ADVERTISING;
+        __fallthrough; // silence gcc warning about missing break
+    case BLE_START_ADVERTISING:
+        start_advertising();
+        break;
+    case BLE_CENTRAL_DISCONNECTED:
+        ble_state = BLE_START_SCAN;
+        __fallthrough;
+    case BLE_START_SCAN:
+        start_scan();
+        break;
+    default:
+        break;
+    }
+}
+
+static uint8_t notify_func(
+    struct bt_conn* conn,
+    struct bt_gatt_subscribe_params* params,
+    const void* data,
+    uint16_t length)
+{
+    if (!data)
+    {
+        LOG_DBG("[UNSUBSCRIBED]");
+        params->value_handle = 0U;
+        return BT_GATT_ITER_STOP;
+    }
+
+    LOG_DBG("[NOTIFICATION] data %p length %u", data, length);
+
+    total_rx_count++;
+
+    struct light_link* link = link_get(conn);
+
+    if (!link)
+    {
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    remote_notified(link, params->value_handle, data, length);
+
+    if (notify_cb)
+    {
+        notify_cb(ARRAY_INDEX(links, link), params->value_handle, data, length);
+    }
+
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t discover_func(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    struct bt_gatt_discover_params* params);
+
+static int discover_start(struct light_link* link)
+{
+    struct bt_gatt_discover_params* params = &link->discover_params;
+
+    link->proto = RGBLED_PROTO_NONE;
+    memcpy(&link->discover_uuid, BT_UUID_RGBLED_SERVICE, sizeof(link->discover_uuid));
+    params->uuid = &link->discover_uuid.uuid;
+    params->func = discover_func;
+    params->start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    params->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    params->type = BT_GATT_DISCOVER_PRIMARY;
+
+    LOG_DBG("Discovering services");
+    return bt_gatt_discover(link->conn, params);
+}
+
+static void subscribe(struct light_link* link)
+{
+    int err;
+
+    link->subscribe_params.notify = notify_func;
+    link->subscribe_params.value = BT_GATT_CCC_NOTIFY;
+
+    err = bt_gatt_subscribe(link->conn, &link->subscribe_params);
+    if (err && err != -EALREADY)
+    {
+        LOG_DBG("Subscribe failed (err %d)", err);
+    }
+    else
+    {
+        LOG_DBG("[SUBSCRIBED]");
+    }
+}
+
+static uint8_t db_hash_read_func(
+    struct bt_conn* conn,
+    uint8_t err,
+    struct bt_gatt_read_params* params,
+    const void* data,
+    uint16_t length)
+{
+    struct light_link* link = CONTAINER_OF(params, struct light_link, db_hash_read_params);
+    const bt_addr_le_t* addr = bt_conn_get_dst(conn);
+    bool valid = !err && data && length == GATT_CACHE_DB_HASH_SIZE;
+
+    if (link->db_hash_action == DB_HASH_STORE)
+    {
+        if (!valid)
+        {
+            LOG_DBG("Light has no database hash, not caching handles");
+            return BT_GATT_ITER_STOP;
+        }
+
+        memcpy(link->cache_entry.db_hash, data, GATT_CACHE_DB_HASH_SIZE);
+        (void)gatt_cache_store(addr, &link->cache_entry);
+
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (valid && !memcmp(link->cache_entry.db_hash, data, GATT_CACHE_DB_HASH_SIZE))
+    {
+        LOG_DBG("Database hash matches, cached handles are valid");
+        STATS_INC(ble_stats, cache_hits);
+        subscribe(link);
+        return BT_GATT_ITER_STOP;
     }
-}
 
-void rgbled_left_right_hazard(uint8_t state)
-{
-    int err;
-    uint8_t buf[1];
+    LOG_INF("Light database changed, rediscovering");
+    STATS_INC(ble_stats, cache_misses);
+    (void)gatt_cache_delete(addr);
 
-    if (atomic_test_bit(conn_state, STATE_CONNECTED) && rgbled_indicator_char_handle != 0)
-    {
-        static struct bt_gatt_write_params write_params;
-        buf[0] = state;
+    /* The read started with the cached handles may still be in flight */
+    link->remote_stale = link->remote_reading;
+    link->remote_again = false;
 
-        write_params.handle = rgbled_indicator_char_handle;
-        write_params.offset = 0;
-        write_params.data = buf;
-        write_params.length = 1;
-        write_params.func = write_func;
-        LOG_DBG("Writing left_right %d to handle %d", state, write_params.handle);
-        err = bt_gatt_write(default_conn, &write_params);
-        if (err)
-        {
-            LOG_DBG("Write failed for left_right %x (err %d)", state, err);
-        }
-        else
-        {
-            LOG_DBG("Write successful");
-        }
+    cmd_queue_reset(link);
+    link->pattern_char_handle = 0;
+    link->indicator_char_handle = 0;
+    link->state_char_handle = 0;
+
+    err = discover_start(link);
+    if (err)
+    {
+        LOG_DBG("Discover failed (err %d)", err);
     }
+
+    return BT_GATT_ITER_STOP;
 }
 
-extern void ble_on_connected(void (*connected)(void))
+static int db_hash_read(struct light_link* link, enum db_hash_action action)
 {
-    connected_cb = connected;
+    struct bt_gatt_read_params* params = &link->db_hash_read_params;
+
+    link->db_hash_action = action;
+    params->func = db_hash_read_func;
+    params->handle_count = 0;
+    params->by_uuid.uuid = BT_UUID_GATT_DB_HASH;
+    params->by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    params->by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+
+    return bt_gatt_read(link->conn, params);
 }
 
-static void ble_timeout(struct k_work* work)
+/* Reuse the handles of a known light right away. Until the light's database
+ * hash has been read back, a light that supports robust caching rejects our
+ * writes as out of sync, so stale handles cannot hit the wrong attribute.
+ * Notifications are only enabled once the hash matches.
+ */
+static int gatt_cache_apply(struct light_link* link)
 {
-    LOG_DBG("BLE timeout");
-    switch (ble_state)
+    struct gatt_cache_entry* entry = &link->cache_entry;
+    int err = gatt_cache_get(bt_conn_get_dst(link->conn), entry);
+
+    if (err)
     {
-    case BLE_PERIPHERAL_DISCONNECTED:
-        ble_state = BLE_START_ADVERTISING;
-        __fallthrough; // silence gcc warning about missing break
-    case BLE_START_ADVERTISING:
-        start_advertising();
-        break;
-    case BLE_CENTRAL_DISCONNECTED:
-        ble_state = BLE_START_SCAN;
-        __fallthrough;
-    case BLE_START_SCAN:
-        start_scan();
-        break;
-    default:
-        break;
+        return err;
     }
-}
 
-static uint8_t notify_func(
-    struct bt_conn* conn,
-    struct bt_gatt_subscribe_params* params,
-    const void* data,
-    uint16_t length)
-{
-    if (!data)
+    link->state_char_handle = entry->state_handle;
+    link->pattern_char_handle = entry->pattern_handle;
+    link->indicator_char_handle = entry->indicator_handle;
+    link->subscribe_params.value_handle = entry->value_handle;
+    link->subscribe_params.ccc_handle = entry->ccc_handle;
+    link->proto = entry->proto;
+
+    err = db_hash_read(link, DB_HASH_VERIFY);
+    if (err)
     {
-        LOG_DBG("[UNSUBSCRIBED]");
-        params->value_handle = 0U;
-        return BT_GATT_ITER_STOP;
+        link->proto = RGBLED_PROTO_NONE;
+        return err;
     }
 
-    LOG_DBG("[NOTIFICATION] data %p length %u", data, length);
+    remote_sync(link);
 
-    total_rx_count++;
+    return 0;
+}
 
-    return BT_GATT_ITER_CONTINUE;
+static int discover_char(struct light_link* link, const struct bt_uuid* uuid, uint16_t start_handle)
+{
+    struct bt_gatt_discover_params* params = &link->discover_params;
+
+    memcpy(&link->discover_uuid, uuid, sizeof(link->discover_uuid));
+    params->uuid = &link->discover_uuid.uuid;
+    params->start_handle = start_handle;
+    params->end_handle = link->service_end_handle;
+    params->type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+    return bt_gatt_discover(link->conn, params);
+}
+
+static int discover_ccc(struct light_link* link, const struct bt_gatt_attr* attr)
+{
+    struct bt_gatt_discover_params* params = &link->discover_params;
+
+    memcpy(&link->discover_uuid_ccc, BT_UUID_GATT_CCC, sizeof(link->discover_uuid_ccc));
+    params->uuid = &link->discover_uuid_ccc.uuid;
+    params->start_handle = attr->handle + 2;
+    params->end_handle = link->service_end_handle;
+    params->type = BT_GATT_DISCOVER_DESCRIPTOR;
+    link->subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
+
+    return bt_gatt_discover(link->conn, params);
 }
 
 static uint8_t discover_func(
@@ -205,10 +1234,25 @@ static uint8_t discover_func(
     const struct bt_gatt_attr* attr,
     struct bt_gatt_discover_params* params)
 {
+    struct light_link* link = CONTAINER_OF(params, struct light_link, discover_params);
     int err;
 
     if (!attr)
     {
+        /* Lights without the packed state characteristic fall back to the
+         * separate pattern and indicator characteristics.
+         */
+        if (params->type == BT_GATT_DISCOVER_CHARACTERISTIC && !bt_uuid_cmp(params->uuid, BT_UUID_RGBLED_STATE_CHAR))
+        {
+            LOG_DBG("No light state characteristic, using legacy protocol");
+            err = discover_char(link, BT_UUID_RGBLED_PATTERN_CHAR, link->service_start_handle);
+            if (err)
+            {
+                LOG_DBG("Discover failed (err %d)", err);
+            }
+            return BT_GATT_ITER_STOP;
+        }
+
         LOG_DBG("Discover complete");
         (void)memset(params, 0, sizeof(*params));
         return BT_GATT_ITER_STOP;
@@ -216,48 +1260,50 @@ static uint8_t discover_func(
 
     LOG_DBG("[ATTRIBUTE] handle %u", attr->handle);
 
-    if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_RGBLED_SERVICE))
+    if (!bt_uuid_cmp(params->uuid, BT_UUID_RGBLED_SERVICE))
     {
+        struct bt_gatt_service_val* service = attr->user_data;
+
         LOG_DBG("Found primary RGBLED service");
-        memcpy(&discover_uuid, BT_UUID_RGBLED_PATTERN_CHAR, sizeof(discover_uuid));
-        discover_params.uuid = &discover_uuid.uuid;
-        discover_params.start_handle = attr->handle + 1;
-        discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+        link->service_start_handle = attr->handle + 1;
+        link->service_end_handle = service->end_handle;
 
-        err = bt_gatt_discover(conn, &discover_params);
+        err = discover_char(link, BT_UUID_RGBLED_STATE_CHAR, link->service_start_handle);
         if (err)
         {
             LOG_DBG("Discover failed (err %d)", err);
         }
     }
-    else if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_RGBLED_PATTERN_CHAR))
+    else if (!bt_uuid_cmp(params->uuid, BT_UUID_RGBLED_STATE_CHAR))
     {
-        rgbled_pattern_char_handle = bt_gatt_attr_value_handle(attr);
-        LOG_DBG("Found RGBLED pattern characteristic with handle %u", rgbled_pattern_char_handle);
+        link->state_char_handle = bt_gatt_attr_value_handle(attr);
+        link->proto = RGBLED_PROTO_STATE;
+        LOG_DBG("Found RGBLED light state characteristic with handle %u", link->state_char_handle);
 
-        memcpy(&discover_uuid, BT_UUID_RGBLED_INDICATOR_CHAR, sizeof(discover_uuid));
-        discover_params.uuid = &discover_uuid.uuid;
-        discover_params.start_handle = attr->handle + 1;
-        discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-
-        err = bt_gatt_discover(conn, &discover_params);
+        err = discover_ccc(link, attr);
         if (err)
         {
             LOG_DBG("Discover failed (err %d)", err);
         }
     }
-    else if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_RGBLED_INDICATOR_CHAR))
+    else if (!bt_uuid_cmp(params->uuid, BT_UUID_RGBLED_PATTERN_CHAR))
     {
-        rgbled_indicator_char_handle = bt_gatt_attr_value_handle(attr);
-        LOG_DBG("Found RGBLED indicator characteristic with handle %u", rgbled_indicator_char_handle);
+        link->pattern_char_handle = bt_gatt_attr_value_handle(attr);
+        LOG_DBG("Found RGBLED pattern characteristic with handle %u", link->pattern_char_handle);
 
-        memcpy(&discover_uuid_ccc, BT_UUID_GATT_CCC, sizeof(discover_uuid_ccc));
-        discover_params.uuid = &discover_uuid_ccc.uuid;
-        discover_params.start_handle = attr->handle + 2;
-        discover_params.type = BT_GATT_DISCOVER_DESCRIPTOR;
-        subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
+        err = discover_char(link, BT_UUID_RGBLED_INDICATOR_CHAR, attr->handle + 1);
+        if (err)
+        {
+            LOG_DBG("Discover failed (err %d)", err);
+        }
+    }
+    else if (!bt_uuid_cmp(params->uuid, BT_UUID_RGBLED_INDICATOR_CHAR))
+    {
+        link->indicator_char_handle = bt_gatt_attr_value_handle(attr);
+        link->proto = RGBLED_PROTO_LEGACY;
+        LOG_DBG("Found RGBLED indicator characteristic with handle %u", link->indicator_char_handle);
 
-        err = bt_gatt_discover(conn, &discover_params);
+        err = discover_ccc(link, attr);
         if (err)
         {
             LOG_DBG("Discover failed (err %d)", err);
@@ -265,21 +1311,33 @@ static uint8_t discover_func(
     }
     else
     {
+        struct gatt_cache_entry* entry = &link->cache_entry;
+
         LOG_DBG("Found CCC notify descriptor");
-        subscribe_params.notify = notify_func;
-        subscribe_params.value = BT_GATT_CCC_NOTIFY;
-        subscribe_params.ccc_handle = attr->handle;
+        link->subscribe_params.ccc_handle = attr->handle;
+        subscribe(link);
 
-        err = bt_gatt_subscribe(conn, &subscribe_params);
-        if (err && err != -EALREADY)
+        entry->state_handle = link->state_char_handle;
+        entry->pattern_handle = link->pattern_char_handle;
+        entry->indicator_handle = link->indicator_char_handle;
+        entry->value_handle = link->subscribe_params.value_handle;
+        entry->ccc_handle = link->subscribe_params.ccc_handle;
+        entry->proto = link->proto;
+
+        err = db_hash_read(link, DB_HASH_STORE);
+        if (err)
         {
-            LOG_DBG("Subscribe failed (err %d)", err);
+            LOG_DBG("Database hash read failed (err %d)", err);
         }
-        else
+
+        if (peer_learning() && !light_peers_add(bt_conn_get_dst(conn)))
         {
-            LOG_DBG("[SUBSCRIBED]");
+            LOG_INF("Learned new light");
+            atomic_set_bit(conn_state, STATE_PEERS_DIRTY);
         }
 
+        remote_sync(link);
+
         return BT_GATT_ITER_STOP;
     }
 
@@ -288,95 +1346,99 @@ static uint8_t discover_func(
 
 static bool eir_found(struct bt_data* data, void* user_data)
 {
-    bt_addr_le_t* addr = user_data;
-    int i;
-    char dev[BT_ADDR_LE_STR_LEN];
-    struct bt_conn_le_create_param* create_param;
-    struct bt_le_conn_param* param;
-    int err;
-
-    bt_addr_le_to_str(addr, dev, sizeof(dev));
-    LOG_DBG("[AD]: from %s type %d data_len %u", dev, data->type, data->data_len);
+    bool* found = user_data;
 
-    switch (data->type)
+    if (data->type != BT_DATA_UUID128_ALL && data->type != BT_DATA_UUID128_SOME)
     {
-    case BT_DATA_UUID128_ALL:
+        return true;
+    }
 
-        err = bt_le_scan_stop();
-        if (err)
-        {
-            LOG_DBG("Stop LE scan failed (err %d)", err);
-            return true;
-        }
+    for (int i = 0; i + BT_UUID_SIZE_128 <= data->data_len; i += BT_UUID_SIZE_128)
+    {
+        struct bt_uuid_128 uuid = BT_UUID_INIT_128(0);
 
-        if (data->data_len < 16)
+        memcpy(uuid.val, &data->data[i], BT_UUID_SIZE_128);
+        if (!bt_uuid_cmp(&uuid.uuid, BT_UUID_RGBLED_SERVICE))
         {
-            LOG_DBG("Invalid UUID length");
-            return true;
+            *found = true;
+            return false;
         }
+    }
 
-        struct bt_uuid_128 uuid = BT_UUID_INIT_128(0);
-        memcpy(uuid.val, data->data, BT_UUID_SIZE_128);
+    return true;
+}
 
-        LOG_DBG("UUID: %s", (char*)bt_uuid_str((struct bt_uuid*)&uuid));
+static void connect_light(const bt_addr_le_t* addr)
+{
+    char dev[BT_ADDR_LE_STR_LEN];
+    struct bt_conn_le_create_param* create_param;
+    struct bt_le_conn_param* param;
+    int err;
 
-        if (bt_uuid_cmp((struct bt_uuid*)&uuid, BT_UUID_RGBLED_SERVICE))
-        {
-            LOG_DBG("UUID mismatch");
-            return true;
-        }
+    err = bt_le_scan_stop();
+    if (err)
+    {
+        LOG_DBG("Stop LE scan failed (err %d)", err);
+        return;
+    }
 
-        LOG_DBG("Found RGBLED service UUID");
+    bt_addr_le_to_str(addr, dev, sizeof(dev));
+    LOG_DBG("Found RGBLED service UUID on %s", dev);
 
-        char hex_data[data->data_len * 2 + 1];
-        for (i = 0; i < data->data_len; i++)
-        {
-            sprintf(&hex_data[i * 2], "%02x", data->data[i]);
-        }
-        hex_data[data->data_len * 2] = '\0';
-        LOG_DBG("Data: %s", hex_data);
+    LOG_DBG("Creating connection with Coded PHY support");
+    param = BT_LE_CONN_PARAM_DEFAULT;
+    create_param = BT_CONN_LE_CREATE_CONN;
+    create_param->options |= BT_CONN_LE_OPT_CODED;
+    err = bt_conn_le_create(addr, create_param, param, &pending_conn);
 
-        LOG_DBG("Creating connection with Coded PHY support");
-        param = BT_LE_CONN_PARAM_DEFAULT;
-        create_param = BT_CONN_LE_CREATE_CONN;
-        create_param->options |= BT_CONN_LE_OPT_CODED;
-        err = bt_conn_le_create(addr, create_param, param, &default_conn);
+    if (err)
+    {
+        LOG_DBG("Create connection with Coded PHY support failed (err %d)", err);
 
+        LOG_DBG("Creating non-Coded PHY connection");
+        create_param->options &= ~BT_CONN_LE_OPT_CODED;
+        err = bt_conn_le_create(addr, create_param, param, &pending_conn);
         if (err)
         {
-            LOG_DBG("Create connection with Coded PHY support failed (err %d)", err);
-
-            LOG_DBG("Creating non-Coded PHY connection");
-            create_param->options &= ~BT_CONN_LE_OPT_CODED;
-            err = bt_conn_le_create(addr, create_param, param, &default_conn);
-            if (err)
-            {
-                LOG_DBG("Create connection failed (err %d)", err);
-                ble_state = BLE_CENTRAL_DISCONNECTED;
-                k_work_reschedule(&ble_work, K_NO_WAIT);
-                return false;
-            }
+            LOG_DBG("Create connection failed (err %d)", err);
+            ble_state = BLE_CENTRAL_DISCONNECTED;
+            k_work_reschedule(&ble_work, K_NO_WAIT);
         }
-
-        return false;
     }
-
-    return true;
 }
 
+/* Only used while learning new lights: known lights are connected by the
+ * controller through the filter accept list without any report reaching
+ * the host.
+ */
 static void device_found(const bt_addr_le_t* addr, int8_t rssi, uint8_t type, struct net_buf_simple* ad)
 {
-    char dev[BT_ADDR_LE_STR_LEN];
+    struct bt_conn* conn;
+    bool found = false;
 
-    bt_addr_le_to_str(addr, dev, sizeof(dev));
+    trace_point(TRACE_SCAN_REPORT, type, (uint8_t)rssi);
 
-    /* Hack for specific device to reduce debug messages */
-    if (type == BT_GAP_ADV_TYPE_ADV_IND && !strncmp(dev, "EA:F4:A3:ED:27:1C", 5))
+    if (type != BT_GAP_ADV_TYPE_ADV_IND || pending_conn)
     {
-        LOG_DBG("[DEVICE]: %s, AD evt type %u, AD data len %u, RSSI %i", dev, type, ad->len, rssi);
+        return;
+    }
+
+    bt_data_parse(ad, eir_found, &found);
+    if (!found)
+    {
+        return;
+    }
 
-        bt_data_parse(ad, eir_found, (void*)addr);
+    /* Scanning continues while connected, skip lights we already have */
+    conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+    if (conn)
+    {
+        bt_conn_unref(conn);
+        return;
     }
+
+    LOG_DBG("[DEVICE]: AD evt type %u, RSSI %i", type, rssi);
+    connect_light(addr);
 }
 
 static void start_advertising(void)
@@ -393,10 +1455,66 @@ static void start_advertising(void)
     LOG_DBG("Advertising successfully started");
 }
 
+static bool peer_learning(void)
+{
+    return atomic_test_bit(conn_state, STATE_PEER_LEARNING) || light_peers_count() == 0;
+}
+
+/* Connect to any known light as soon as it advertises, the controller drops
+ * all other advertisers.
+ */
+static int start_auto_connect(void)
+{
+    int err;
+
+    if (atomic_test_and_clear_bit(conn_state, STATE_PEERS_DIRTY))
+    {
+        err = light_peers_load_accept_list();
+        if (err)
+        {
+            atomic_set_bit(conn_state, STATE_PEERS_DIRTY);
+            LOG_DBG("Loading filter accept list failed (err %d)", err);
+            return err;
+        }
+    }
+
+    err = bt_conn_le_create_auto(BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT);
+    if (err && err != -EALREADY)
+    {
+        LOG_DBG("Auto connect failed to start (err %d)", err);
+        return err;
+    }
+
+    LOG_DBG("Auto connect to %u known lights started", light_peers_count());
+    return 0;
+}
+
 static void start_scan(void)
 {
     int err;
 
+    /* A connection is being created, scanning resumes once it completes */
+    if (pending_conn)
+    {
+        return;
+    }
+
+    /* The accept list cannot change while the scanner or initiator uses it */
+    (void)bt_le_scan_stop();
+    (void)bt_conn_create_auto_stop();
+
+    /* Keep looking for lights while there is room for another link */
+    if (!link_get(NULL) || (!peer_learning() && links_connected() >= light_peers_count()))
+    {
+        return;
+    }
+
+    if (!peer_learning())
+    {
+        (void)start_auto_connect();
+        return;
+    }
+
     /* Use active scanning and disable duplicate filtering to handle any
      * devices that might update their advertising data at runtime. */
     struct bt_le_scan_param scan_param = {
@@ -424,24 +1542,75 @@ static void start_scan(void)
     LOG_DBG("Scanning successfully started");
 }
 
+static void peers_changed(void)
+{
+    atomic_set_bit(conn_state, STATE_PEERS_DIRTY);
+    ble_state = BLE_START_SCAN;
+    k_work_reschedule(&ble_work, K_NO_WAIT);
+}
+
+static void learn_timeout(struct k_work* work)
+{
+    LOG_INF("Light learning window closed");
+    atomic_clear_bit(conn_state, STATE_PEER_LEARNING);
+    peers_changed();
+}
+
+int ble_peer_add(const bt_addr_le_t* addr)
+{
+    int err = light_peers_add(addr);
+
+    if (!err)
+    {
+        peers_changed();
+    }
+
+    return err;
+}
+
+int ble_peer_remove(const bt_addr_le_t* addr)
+{
+    int err = light_peers_remove(addr);
+
+    if (!err)
+    {
+        peers_changed();
+    }
+
+    return err;
+}
+
+void ble_peer_learn(void)
+{
+    LOG_INF("Learning new lights for %d s", CONFIG_APP_BLE_PEER_LEARN_SECONDS);
+    atomic_set_bit(conn_state, STATE_PEER_LEARNING);
+    k_work_reschedule(&learn_work, K_SECONDS(CONFIG_APP_BLE_PEER_LEARN_SECONDS));
+    peers_changed();
+}
+
 static void connected(struct bt_conn* conn, uint8_t conn_err)
 {
     char addr[BT_ADDR_LE_STR_LEN];
     int err;
     struct bt_conn_info info;
+    struct light_link* link;
 
     bt_conn_get_info(conn, &info);
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
     if (conn_err)
     {
+        trace_point(TRACE_CONNECT, UINT8_MAX, conn_err);
         LOG_DBG("Failed to connect to %s (%u)", addr, conn_err);
 
         switch (info.role)
         {
         case BT_CONN_ROLE_CENTRAL:
-            bt_conn_unref(default_conn);
-            default_conn = NULL;
+            if (pending_conn == conn)
+            {
+                bt_conn_unref(pending_conn);
+                pending_conn = NULL;
+            }
             start_scan();
             break;
 
@@ -470,38 +1639,64 @@ static void connected(struct bt_conn* conn, uint8_t conn_err)
         return;
     }
 
+    link = link_get(NULL);
+    if (!link)
+    {
+        trace_point(TRACE_CONNECT, UINT8_MAX, 0);
+        LOG_DBG("No free light link for %s", addr);
+        (void)bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        return;
+    }
+
+    /* Take over the reference of a scan-created connection, connections
+     * made by the auto connect initiator are not referenced yet.
+     */
+    if (pending_conn == conn)
+    {
+        pending_conn = NULL;
+        link->conn = conn;
+    }
+    else
+    {
+        link->conn = bt_conn_ref(conn);
+    }
+
     // bt_le_adv_stop();
+    trace_point(TRACE_CONNECT, ARRAY_INDEX(links, link), 0);
     (void)atomic_set_bit(conn_state, STATE_CONNECTED);
     LOG_INF("Connected: %s", addr);
+    STATS_SET(ble_stats, lights, links_connected());
 
     total_rx_count = 0U;
+    link->connected_ts = k_uptime_get();
+    link->first_write_done = false;
 
-    if (conn == default_conn)
-    {
-        memcpy(&discover_uuid, BT_UUID_RGBLED_SERVICE, sizeof(discover_uuid));
-        discover_params.uuid = &discover_uuid.uuid;
-        discover_params.func = discover_func;
-        discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
-        discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
-        discover_params.type = BT_GATT_DISCOVER_PRIMARY;
+    link_profile_connected(conn);
 
-        err = bt_gatt_discover(default_conn, &discover_params);
-        LOG_DBG("Discovering services");
+    if (!gatt_cache_apply(link))
+    {
+        LOG_DBG("Using cached handles");
+    }
+    else
+    {
+        err = discover_start(link);
         if (err)
         {
             LOG_DBG("Discover failed(err %d)", err);
-            return;
         }
     }
 
     /* Turn on connection LED */
     gpio_pin_set_dt(&led, 1);
+
+    /* Look for the remaining lights */
+    start_scan();
 }
 
 static void disconnected(struct bt_conn* conn, uint8_t reason)
 {
-    int err;
     struct bt_conn_info info;
+    struct light_link* link;
     char addr[BT_ADDR_LE_STR_LEN];
 
     bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
@@ -522,24 +1717,33 @@ static void disconnected(struct bt_conn* conn, uint8_t reason)
         return;
     }
 
-    (void)atomic_set_bit(conn_state, STATE_DISCONNECTED);
-
-    rgbled_pattern_char_handle = 0;
-
-    LOG_INF("Disconnected: %s (reason 0x%02x)", addr, reason);
-
-    if (default_conn != conn)
+    link = link_get(conn);
+    if (!link)
     {
         return;
     }
 
-    bt_conn_unref(default_conn);
-    default_conn = NULL;
+    trace_point(TRACE_DISCONNECT, ARRAY_INDEX(links, link), reason);
+    cmd_queue_reset(link);
+    bt_conn_unref(link->conn);
+    link->conn = NULL;
+    link->proto = RGBLED_PROTO_NONE;
+    link->pattern_char_handle = 0;
+    link->indicator_char_handle = 0;
+    link->state_char_handle = 0;
+
+    STATS_SET(ble_stats, lights, links_connected());
 
     LOG_DBG("Starting scan and advertising");
     start_scan();
-    /* Turn off Connection LED */
-    gpio_pin_set_dt(&led, 0);
+
+    if (links_connected() == 0)
+    {
+        (void)atomic_clear_bit(conn_state, STATE_CONNECTED);
+        (void)atomic_set_bit(conn_state, STATE_DISCONNECTED);
+        /* Turn off Connection LED */
+        gpio_pin_set_dt(&led, 0);
+    }
 }
 
 BT_CONN_CB_DEFINE(conn_callbacks) = {
@@ -549,6 +1753,10 @@ BT_CONN_CB_DEFINE(conn_callbacks) = {
 
 static void write_func(struct bt_conn* conn, uint8_t err, struct bt_gatt_write_params* params)
 {
+    struct light_link* link = CONTAINER_OF(params, struct light_link, queue.write_params);
+
+    trace_write(TRACE_WRITE_DONE, link, link->queue.tx_cmd, err);
+
     if (err)
     {
         LOG_DBG("[write func] Write failed on handle %d (err %d)", params->handle, err);
@@ -556,7 +1764,14 @@ static void write_func(struct bt_conn* conn, uint8_t err, struct bt_gatt_write_p
     else
     {
         LOG_DBG("[write func] Write successful");
+
+        k_spinlock_key_t key = k_spin_lock(&link->queue.lock);
+
+        remote_update(link, link->queue.tx_cmd, link->queue.tx_buf);
+        k_spin_unlock(&link->queue.lock, key);
     }
+
+    cmd_queue_done(link, !err);
 }
 
 static void bt_ready(int err)
@@ -569,43 +1784,77 @@ static void bt_ready(int err)
 
     LOG_DBG("Bluetooth initialized");
 
+    STATS_INIT_AND_REG(ble_stats, STATS_SIZE_32, "ble");
+
+    err = gatt_cache_init();
+    if (err)
+    {
+        LOG_DBG("GATT cache init failed (err %d)", err);
+    }
+
+    err = light_peers_init();
+    if (err)
+    {
+        LOG_DBG("Loading known lights failed (err %d)", err);
+    }
+    atomic_set_bit(conn_state, STATE_PEERS_DIRTY);
+
+    err = link_profile_init();
+    if (err)
+    {
+        LOG_DBG("Link profile init failed (err %d)", err);
+    }
+
     start_advertising();
+
+    if (IS_ENABLED(CONFIG_APP_BLE_BROADCAST))
+    {
+        err = broadcast_init();
+        if (err)
+        {
+            LOG_ERR("Broadcast init failed (err %d)", err);
+        }
+    }
+
     ble_state = BLE_START_SCAN;
     k_work_reschedule(&ble_work, K_NO_WAIT);
 }
 
-void ble_thread(void)
+/* Bluetooth comes up on the system workqueue, everything after is driven
+ * by the stack's callbacks and delayed work.
+ */
+static int ble_init(void)
 {
     int err;
 
     if (!gpio_is_ready_dt(&led))
     {
         LOG_DBG("LED device not ready");
-        return;
+        return -ENODEV;
     }
 
     err = gpio_pin_configure_dt(&led, GPIO_OUTPUT_INACTIVE);
     if (err < 0)
     {
         LOG_DBG("Failed to configure LED pin");
-        return;
+        return err;
     }
 
     k_work_init_delayable(&ble_work, ble_timeout);
+    k_work_init_delayable(&learn_work, learn_timeout);
+    for (int i = 0; i < ARRAY_SIZE(links); i++)
+    {
+        k_work_init_delayable(&links[i].queue.retry_work, cmd_queue_retry);
+    }
 
     err = bt_enable(bt_ready);
-
     if (err)
     {
         LOG_DBG("Bluetooth init failed (err %d)", err);
-        return;
+        return err;
     }
 
-    while (1)
-    {
-        k_sleep(K_SECONDS(3));
-    }
-    return;
+    return 0;
 }
 
-K_THREAD_DEFINE(ble_thread_id, STACK_SIZE, ble_thread, NULL, NULL, NULL, THREAD_PRIORITY, 0, 0);
+SYS_INIT(ble_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BLE_H
+#define BLE_H
+
+#include "rgbled_service.h"
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/types.h>
+
+void rgbled_pattern_next(void);
+void rgbled_pattern_set(uint8_t pattern);
+void rgbled_left_right_hazard(uint8_t state);
+void rgbled_brightness_set(uint8_t brightness);
+
+/** @brief Current light state, as carried by the light state characteristic. */
+void rgbled_state_get(struct rgbled_light_state* state);
+
+/**
+ * @brief Add a light to the known peers and reconnect with the updated
+ * filter accept list.
+ */
+int ble_peer_add(const bt_addr_le_t* addr);
+
+/** @brief Remove a light from the known peers. */
+int ble_peer_remove(const bt_addr_le_t* addr);
+
+/**
+ * @brief Scan for lights that are not known yet.
+ *
+ * For CONFIG_APP_BLE_PEER_LEARN_SECONDS the controller scans without the
+ * filter accept list and adds every light it connects to to the known
+ * peers. Without known peers the controller is always learning.
+ */
+void ble_peer_learn(void);
+
+/** @brief Called for every notification of a light, from the Bluetooth thread. */
+typedef void (*ble_notify_cb_t)(uint8_t light, uint16_t handle, const void* data, uint16_t len);
+
+void ble_notify_callback_set(ble_notify_cb_t cb);
+
+struct ble_light_info
+{
+    /* Light number for ble_light_write() */
+    uint8_t index;
+    bt_addr_le_t addr;
+    /* The light has the packed light state characteristic */
+    bool state_char;
+};
+
+/** @brief Fill @p info with up to @p max usable lights, returns the count. */
+size_t ble_lights_get(struct ble_light_info* info, size_t max);
+
+enum ble_light_char
+{
+    BLE_LIGHT_CHAR_STATE,
+    BLE_LIGHT_CHAR_INDICATOR,
+    BLE_LIGHT_CHAR_PATTERN,
+};
+
+struct ble_light_write;
+
+/** @brief Write completion, @p err is 0 once the light acknowledged or the write was sent. */
+typedef void (*ble_light_write_cb_t)(struct ble_light_write* write, int err);
+
+struct ble_light_write
+{
+    struct bt_gatt_write_params params;
+    ble_light_write_cb_t cb;
+};
+
+/**
+ * @brief Write raw data to a characteristic of one light.
+ *
+ * Writes are queued by the stack, several can be in flight per light. @p data
+ * and @p write must stay valid until @p write->cb is called. Call from the
+ * system workqueue, the light state writes of the command queue are not
+ * affected.
+ *
+ * @retval -ENOTCONN The light is not connected or not discovered yet.
+ * @retval -ENOMEM No ATT buffer is free right now, retry later.
+ */
+int ble_light_write(uint8_t light,
+                    enum ble_light_char chr,
+                    bool response,
+                    struct ble_light_write* write,
+                    const uint8_t* data,
+                    uint16_t len);
+
+#endif // BLE_H
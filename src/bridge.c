@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Forwards host protocol writes to the lights and their notifications back
+ *
+ * The protocol thread only parses a write into a free slot and queues it,
+ * the system workqueue hands the queued writes to the stack in order. The
+ * stack keeps several of them in flight per light, the light answers them
+ * one after the other. The reply to the host is deferred to the protocol
+ * thread once the light answered, the Bluetooth thread never waits for the
+ * USB port. Notifications take the same way back, they are dropped when all
+ * notification slots are still waiting to be sent.
+ */
+
+#include "bridge.h"
+#include "ble.h"
+#include "host_proto.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(bridge, LOG_LEVEL_INF);
+
+#define DATA_MAX CONFIG_APP_BRIDGE_DATA_MAX
+
+STATS_SECT_START(bridge_stats)
+STATS_SECT_ENTRY32(writes)
+STATS_SECT_ENTRY32(write_errors)
+STATS_SECT_ENTRY32(busy)
+STATS_SECT_ENTRY32(retries)
+STATS_SECT_ENTRY32(in_flight_max)
+STATS_SECT_ENTRY32(queue_us_max)
+STATS_SECT_ENTRY32(ack_us_last)
+STATS_SECT_ENTRY32(ack_us_max)
+STATS_SECT_ENTRY32(notifications)
+STATS_SECT_ENTRY32(notify_drops)
+STATS_SECT_ENTRY32(notify_truncated)
+STATS_SECT_END;
+
+STATS_NAME_START(bridge_stats)
+STATS_NAME(bridge_stats, writes)
+STATS_NAME(bridge_stats, write_errors)
+STATS_NAME(bridge_stats, busy)
+STATS_NAME(bridge_stats, retries)
+STATS_NAME(bridge_stats, in_flight_max)
+STATS_NAME(bridge_stats, queue_us_max)
+STATS_NAME(bridge_stats, ack_us_last)
+STATS_NAME(bridge_stats, ack_us_max)
+STATS_NAME(bridge_stats, notifications)
+STATS_NAME(bridge_stats, notify_drops)
+STATS_NAME(bridge_stats, notify_truncated)
+STATS_NAME_END(bridge_stats);
+
+static STATS_SECT_DECL(bridge_stats) bridge_stats;
+
+struct bridge_write
+{
+    void* fifo_reserved;
+    struct host_deferred reply;
+    struct ble_light_write write;
+    uint8_t light;
+    uint8_t chr;
+    bool response;
+    uint8_t len;
+    /* Cycle count when the frame was handled and when it went to the stack */
+    uint32_t received;
+    uint32_t submitted;
+    uint8_t data[DATA_MAX];
+};
+
+struct bridge_notify
+{
+    struct host_deferred msg;
+    uint8_t body[sizeof(struct host_notify) + DATA_MAX];
+};
+
+K_MEM_SLAB_DEFINE_STATIC(write_slab, sizeof(struct bridge_write), CONFIG_APP_BRIDGE_WRITES, 4);
+K_MEM_SLAB_DEFINE_STATIC(notify_slab, sizeof(struct bridge_notify), CONFIG_APP_BRIDGE_NOTIFICATIONS, 4);
+
+static K_FIFO_DEFINE(write_fifo);
+static atomic_t in_flight;
+
+/* System workqueue only: the write the stack had no buffer for */
+static struct bridge_write* write_pending;
+
+static void write_submit(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(write_work, write_submit);
+
+static void write_release(struct host_deferred* msg)
+{
+    struct bridge_write* w = CONTAINER_OF(msg, struct bridge_write, reply);
+
+    k_mem_slab_free(&write_slab, w);
+    atomic_dec(&in_flight);
+}
+
+static void write_done(struct ble_light_write* write, int err)
+{
+    struct bridge_write* w = CONTAINER_OF(write, struct bridge_write, write);
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - w->submitted);
+
+    if (err)
+    {
+        STATS_INC(bridge_stats, write_errors);
+    }
+    else
+    {
+        STATS_INC(bridge_stats, writes);
+        STATS_SET(bridge_stats, ack_us_last, us);
+        if (us > bridge_stats.ack_us_max)
+        {
+            STATS_SET(bridge_stats, ack_us_max, us);
+        }
+    }
+
+    w->reply.status = err;
+    host_proto_defer(&w->reply);
+}
+
+static void write_submit(struct k_work* work)
+{
+    struct bridge_write* w;
+    uint32_t us;
+    int err;
+
+    while ((w = write_pending ? write_pending : k_fifo_get(&write_fifo, K_NO_WAIT)) != NULL)
+    {
+        write_pending = NULL;
+        w->submitted = k_cycle_get_32();
+
+        err = ble_light_write(w->light, w->chr, w->response, &w->write, w->data, w->len);
+
+        /* Out of ATT buffers: keep the order and retry shortly */
+        if (err == -ENOMEM || err == -ENOBUFS || err == -EAGAIN)
+        {
+            write_pending = w;
+            STATS_INC(bridge_stats, retries);
+            k_work_reschedule(&write_work, K_MSEC(CONFIG_APP_BLE_CMD_RETRY_MS));
+            return;
+        }
+
+        us = k_cyc_to_us_floor32(w->submitted - w->received);
+        if (us > bridge_stats.queue_us_max)
+        {
+            STATS_SET(bridge_stats, queue_us_max, us);
+        }
+
+        if (err)
+        {
+            LOG_DBG("Write to light %u failed (err %d)", w->light, err);
+            write_done(&w->write, err);
+        }
+    }
+}
+
+int bridge_write(uint8_t seq, const uint8_t* body, size_t len)
+{
+    const struct host_write* req = (const struct host_write*)body;
+    struct bridge_write* w;
+    atomic_val_t count;
+
+    if (len < sizeof(*req) || len - sizeof(*req) > DATA_MAX)
+    {
+        return -EINVAL;
+    }
+
+    if (k_mem_slab_alloc(&write_slab, (void**)&w, K_NO_WAIT))
+    {
+        STATS_INC(bridge_stats, busy);
+        return -EBUSY;
+    }
+
+    count = atomic_inc(&in_flight) + 1;
+    if (count > bridge_stats.in_flight_max)
+    {
+        STATS_SET(bridge_stats, in_flight_max, count);
+    }
+
+    w->reply = (struct host_deferred){
+        .type = HOST_MSG_WRITE,
+        .seq = seq,
+        .reply = true,
+        .release = write_release,
+    };
+    w->write.cb = write_done;
+    w->light = req->light;
+    w->chr = req->chr;
+    w->response = !(req->flags & HOST_WRITE_NO_RSP);
+    w->len = len - sizeof(*req);
+    w->received = k_cycle_get_32();
+    memcpy(w->data, &body[sizeof(*req)], w->len);
+
+    k_fifo_put(&write_fifo, w);
+    k_work_schedule(&write_work, K_NO_WAIT);
+
+    return 0;
+}
+
+size_t bridge_lights(uint8_t* buf, size_t size)
+{
+    struct ble_light_info info[CONFIG_BT_MAX_CONN];
+    size_t count = ble_lights_get(info, MIN(ARRAY_SIZE(info), size / sizeof(struct host_light)));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct host_light* light = (struct host_light*)&buf[i * sizeof(*light)];
+
+        light->index = info[i].index;
+        light->addr_type = info[i].addr.type;
+        memcpy(light->addr, info[i].addr.a.val, sizeof(light->addr));
+        light->state_char = info[i].state_char;
+    }
+
+    return count * sizeof(struct host_light);
+}
+
+static void notify_release(struct host_deferred* msg)
+{
+    k_mem_slab_free(&notify_slab, CONTAINER_OF(msg, struct bridge_notify, msg));
+}
+
+static void notify_forward(uint8_t light, uint16_t handle, const void* data, uint16_t len)
+{
+    static uint8_t seq;
+    struct bridge_notify* n;
+
+    /* Notifications count even when they are dropped, the host sees the gap */
+    seq++;
+
+    if (k_mem_slab_alloc(&notify_slab, (void**)&n, K_NO_WAIT))
+    {
+        STATS_INC(bridge_stats, notify_drops);
+        return;
+    }
+
+    if (len > DATA_MAX)
+    {
+        STATS_INC(bridge_stats, notify_truncated);
+        len = DATA_MAX;
+    }
+
+    n->body[0] = light;
+    sys_put_le16(handle, &n->body[1]);
+    memcpy(&n->body[sizeof(struct host_notify)], data, len);
+
+    n->msg = (struct host_deferred){
+        .type = HOST_MSG_NOTIFY,
+        .seq = seq,
+        .body = n->body,
+        .len = sizeof(struct host_notify) + len,
+        .release = notify_release,
+    };
+
+    STATS_INC(bridge_stats, notifications);
+    host_proto_defer(&n->msg);
+}
+
+void bridge_init(void)
+{
+    STATS_INIT_AND_REG(bridge_stats, STATS_SIZE_32, "bridge");
+    ble_notify_callback_set(notify_forward);
+}
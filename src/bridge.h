@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(CONFIG_APP_BRIDGE)
+
+/** @brief Register the stats and forward light notifications to the host. */
+void bridge_init(void);
+
+/** @brief Fill @p buf with a struct host_light per connected light, returns the length. */
+size_t bridge_lights(uint8_t* buf, size_t size);
+
+/**
+ * @brief Forward a HOST_MSG_WRITE body to a light.
+ *
+ * @retval 0 Queued, the reply is deferred until the light answered.
+ * @retval -EBUSY All CONFIG_APP_BRIDGE_WRITES writes are in flight.
+ */
+int bridge_write(uint8_t seq, const uint8_t* body, size_t len);
+
+#else
+
+static inline void bridge_init(void)
+{
+}
+
+static inline size_t bridge_lights(uint8_t* buf, size_t size)
+{
+    return 0;
+}
+
+static inline int bridge_write(uint8_t seq, const uint8_t* body, size_t len)
+{
+    return -ENOTSUP;
+}
+
+#endif
+
+#endif // BRIDGE_H
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Connectionless light state broadcast
+ *
+ * The light state is carried in the RGBLED service data of a non-connectable
+ * extended advertising set and of its periodic advertising train. Lights
+ * synced to the periodic train follow the state without a connection. On a
+ * change the extended advertising can burst at a short interval for a
+ * number of events before falling back to the slow interval.
+ *
+ * The epoch in the frame is kept in settings. It is advanced before the
+ * first frame of every boot and when the sequence number wraps, so frames
+ * captured earlier can not be replayed to lights that saw a later one.
+ */
+
+#include "broadcast.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/crypto.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(broadcast, LOG_LEVEL_INF);
+
+/* Advertising intervals are in 0.625 ms units, periodic in 1.25 ms units */
+#define ADV_INTERVAL(ms)     ((ms) * 8 / 5)
+#define PER_ADV_INTERVAL(ms) ((ms) * 4 / 5)
+
+#define BROADCAST_KEY_SIZE 16
+
+#define BROADCAST_SUBTREE  "broadcast"
+#define BROADCAST_EPOCH    BROADCAST_SUBTREE "/epoch"
+
+static struct bt_le_ext_adv* adv;
+static struct k_work update_work;
+static struct k_work rearm_work;
+static K_MUTEX_DEFINE(frame_lock);
+static uint8_t key[BROADCAST_KEY_SIZE];
+static bool bursting;
+static uint32_t epoch;
+static uint16_t last_seq;
+
+/* UUID followed by the frame, as carried in the service data AD */
+static uint8_t svc_data[BT_UUID_SIZE_128 + sizeof(struct broadcast_frame)] = {
+    BT_UUID_RGBLED_SERVICE_VAL,
+};
+
+static const struct bt_data ad[] = {
+    BT_DATA(BT_DATA_SVC_DATA128, svc_data, sizeof(svc_data)),
+};
+
+static struct rgbled_light_state pending_state;
+
+static int epoch_set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    ssize_t rc;
+
+    if (!key || strcmp(key, "epoch"))
+    {
+        return -ENOENT;
+    }
+
+    if (len != sizeof(epoch))
+    {
+        return -EINVAL;
+    }
+
+    rc = read_cb(cb_arg, &epoch, sizeof(epoch));
+
+    return rc < 0 ? rc : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(broadcast, BROADCAST_SUBTREE, NULL, epoch_set, NULL, NULL);
+
+/* Stored before it is used, a reboot never reuses an epoch */
+static int epoch_advance(void)
+{
+    uint32_t next = epoch + 1;
+    int err;
+
+    err = settings_save_one(BROADCAST_EPOCH, &next, sizeof(next));
+    if (err)
+    {
+        return err;
+    }
+
+    epoch = next;
+    LOG_INF("Broadcast epoch %u", epoch);
+
+    return 0;
+}
+
+static int frame_sign(struct broadcast_frame* frame)
+{
+    uint8_t block[16] = { 0 };
+    uint8_t enc[16];
+    int err;
+
+    memcpy(block, &frame->state, sizeof(frame->state));
+    memcpy(&block[sizeof(frame->state)], &frame->epoch, sizeof(frame->epoch));
+
+    err = bt_encrypt_le(key, block, enc);
+    if (err)
+    {
+        return err;
+    }
+
+    memcpy(frame->tag, enc, sizeof(frame->tag));
+
+    return 0;
+}
+
+static int adv_start(bool burst)
+{
+    uint32_t interval = burst ? CONFIG_APP_BLE_BROADCAST_BURST_INTERVAL_MS : CONFIG_APP_BLE_BROADCAST_INTERVAL_MS;
+    struct bt_le_adv_param param =
+        BT_LE_ADV_PARAM_INIT(BT_LE_ADV_OPT_EXT_ADV, ADV_INTERVAL(interval), ADV_INTERVAL(interval), NULL);
+    struct bt_le_ext_adv_start_param start = {
+        .num_events = burst ? CONFIG_APP_BLE_BROADCAST_BURST_EVENTS : 0,
+    };
+    int err;
+
+    (void)bt_le_ext_adv_stop(adv);
+
+    err = bt_le_ext_adv_update_param(adv, &param);
+    if (err)
+    {
+        return err;
+    }
+
+    bursting = burst;
+
+    return bt_le_ext_adv_start(adv, &start);
+}
+
+static void update_handler(struct k_work* work)
+{
+    struct broadcast_frame frame;
+    int err;
+
+    k_mutex_lock(&frame_lock, K_FOREVER);
+    frame.state = pending_state;
+    k_mutex_unlock(&frame_lock);
+
+    /* After a wrap the sequence numbers would look old to the lights */
+    if (sys_le16_to_cpu(frame.state.seq) < last_seq)
+    {
+        err = epoch_advance();
+        if (err)
+        {
+            LOG_ERR("Advancing broadcast epoch failed (err %d)", err);
+            return;
+        }
+    }
+    last_seq = sys_le16_to_cpu(frame.state.seq);
+    frame.epoch = sys_cpu_to_le32(epoch);
+
+    err = frame_sign(&frame);
+    if (err)
+    {
+        LOG_ERR("Signing broadcast frame failed (err %d)", err);
+        return;
+    }
+
+    memcpy(&svc_data[BT_UUID_SIZE_128], &frame, sizeof(frame));
+
+    err = bt_le_ext_adv_set_data(adv, ad, ARRAY_SIZE(ad), NULL, 0);
+    if (err)
+    {
+        LOG_ERR("Setting broadcast data failed (err %d)", err);
+    }
+
+    err = bt_le_per_adv_set_data(adv, ad, ARRAY_SIZE(ad));
+    if (err)
+    {
+        LOG_ERR("Setting periodic broadcast data failed (err %d)", err);
+    }
+
+    if (IS_ENABLED(CONFIG_APP_BLE_BROADCAST_BURST))
+    {
+        err = adv_start(true);
+        if (err)
+        {
+            LOG_ERR("Broadcast burst failed (err %d)", err);
+        }
+    }
+}
+
+static void rearm_handler(struct k_work* work)
+{
+    int err;
+
+    if (!bursting)
+    {
+        return;
+    }
+
+    err = adv_start(false);
+    if (err)
+    {
+        LOG_ERR("Restarting broadcast failed (err %d)", err);
+    }
+}
+
+/* Called when a burst has sent its events, fall back to the slow interval */
+static void adv_sent(struct bt_le_ext_adv* instance, struct bt_le_ext_adv_sent_info* info)
+{
+    k_work_submit(&rearm_work);
+}
+
+static const struct bt_le_ext_adv_cb adv_cb = {
+    .sent = adv_sent,
+};
+
+int broadcast_init(void)
+{
+    struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(
+        BT_LE_ADV_OPT_EXT_ADV,
+        ADV_INTERVAL(CONFIG_APP_BLE_BROADCAST_INTERVAL_MS),
+        ADV_INTERVAL(CONFIG_APP_BLE_BROADCAST_INTERVAL_MS),
+        NULL);
+    struct bt_le_per_adv_param per_param = BT_LE_PER_ADV_PARAM_INIT(
+        PER_ADV_INTERVAL(CONFIG_APP_BLE_BROADCAST_INTERVAL_MS),
+        PER_ADV_INTERVAL(CONFIG_APP_BLE_BROADCAST_INTERVAL_MS),
+        BT_LE_PER_ADV_OPT_NONE);
+    int err;
+
+    if (strlen(CONFIG_APP_BLE_BROADCAST_KEY) == 0)
+    {
+        LOG_ERR("No broadcast key, set CONFIG_APP_BLE_BROADCAST_KEY");
+        return -EINVAL;
+    }
+
+    if (hex2bin(CONFIG_APP_BLE_BROADCAST_KEY, strlen(CONFIG_APP_BLE_BROADCAST_KEY), key, sizeof(key)) != sizeof(key))
+    {
+        LOG_ERR("Invalid broadcast key");
+        return -EINVAL;
+    }
+
+    err = settings_load_subtree(BROADCAST_SUBTREE);
+    if (err)
+    {
+        LOG_ERR("Loading broadcast epoch failed (err %d)", err);
+        return err;
+    }
+
+    err = epoch_advance();
+    if (err)
+    {
+        LOG_ERR("Storing broadcast epoch failed (err %d)", err);
+        return err;
+    }
+
+    k_work_init(&update_work, update_handler);
+    k_work_init(&rearm_work, rearm_handler);
+
+    err = bt_le_ext_adv_create(&param, &adv_cb, &adv);
+    if (err)
+    {
+        LOG_ERR("Creating broadcast set failed (err %d)", err);
+        return err;
+    }
+
+    err = bt_le_per_adv_set_param(adv, &per_param);
+    if (err)
+    {
+        LOG_ERR("Setting periodic broadcast parameters failed (err %d)", err);
+        return err;
+    }
+
+    /* Start with the initial state so lights can sync right away */
+    pending_state.version = RGBLED_LIGHT_STATE_VERSION;
+    pending_state.indicator = INDICATOR_OFF;
+    pending_state.brightness = UINT8_MAX;
+    update_handler(&update_work);
+
+    err = bt_le_per_adv_start(adv);
+    if (err)
+    {
+        LOG_ERR("Starting periodic broadcast failed (err %d)", err);
+        return err;
+    }
+
+    err = adv_start(false);
+    if (err)
+    {
+        LOG_ERR("Starting broadcast failed (err %d)", err);
+        return err;
+    }
+
+    LOG_INF("Broadcast started");
+
+    return 0;
+}
+
+void broadcast_update(const struct rgbled_light_state* state)
+{
+    if (!adv)
+    {
+        return;
+    }
+
+    k_mutex_lock(&frame_lock, K_FOREVER);
+    pending_state = *state;
+    k_mutex_unlock(&frame_lock);
+
+    k_work_submit(&update_work);
+}
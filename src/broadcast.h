@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include "rgbled_service.h"
+
+#define BROADCAST_TAG_SIZE 4
+
+/**
+ * @brief Light state as broadcast in the RGBLED service data.
+ *
+ * @p epoch is a little endian counter the controller persists and advances
+ * on every boot and whenever the state sequence number wraps. @p tag is the
+ * first BROADCAST_TAG_SIZE bytes of AES-128 with the shared broadcast key
+ * over @p state followed by @p epoch, zero padded to one block.
+ *
+ * Lights drop frames with a wrong tag or an epoch older than the last one.
+ * A newer epoch is accepted with any sequence number, within an epoch only
+ * sequence numbers newer than the last one are. Lights that do not keep the
+ * last epoch across a reset accept the first frame with a valid tag.
+ */
+struct broadcast_frame
+{
+    struct rgbled_light_state state;
+    uint32_t epoch;
+    uint8_t tag[BROADCAST_TAG_SIZE];
+} __packed;
+
+BUILD_ASSERT(sizeof(struct rgbled_light_state) + sizeof(uint32_t) <= 16, "Tagged data must fit one AES block");
+
+/**
+ * @brief Create the broadcast advertising set. Bluetooth and settings must be ready.
+ *
+ * @retval -EINVAL CONFIG_APP_BLE_BROADCAST_KEY is not set or invalid.
+ */
+int broadcast_init(void);
+
+/** @brief Broadcast a new light state. Does not block, the update runs on the system workqueue. */
+void broadcast_update(const struct rgbled_light_state* state);
+
+#endif // BROADCAST_H
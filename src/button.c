@@ -1,4 +1,8 @@
 #include "button.h"
+#include "input_wq.h"
+#include "latency.h"
+#include "trace.h"
+#include <string.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/kernel.h>
 
@@ -10,44 +14,318 @@ LOG_MODULE_REGISTER(button, LOG_LEVEL_INF);
 
 #pragma GCC pop_options
 
-#define MAX_BUTTONS 4
+/* Every enabled child of the buttons node is a button */
+#define BUTTONS_NODE DT_COMPAT_GET_ANY_STATUS_OKAY(rgbled_gpio_keys)
+#define MAX_BUTTONS  DT_CHILD_NUM_STATUS_OKAY(BUTTONS_NODE)
+
+/* One callback per GPIO port, the pins of an edge map to buttons directly */
+#define PORT_PINS 32
+#define NO_BUTTON UINT8_MAX
+
+BUILD_ASSERT(MAX_BUTTONS < NO_BUTTON, "Too many buttons");
+
+/* Sample period of the integrating debouncer */
+#define INTEGRATE_PERIOD K_MSEC(1)
+
+#define BUTTON_DEBOUNCE_CFG(node)                                                                                      \
+    {                                                                                                                  \
+        .mode = DT_ENUM_IDX(node, debounce_mode),                                                                      \
+        .ms = DT_PROP(node, debounce_ms),                                                                              \
+    }
+
+#define BUTTON_CONFIG(node)                                                                                            \
+    {                                                                                                                  \
+        .spec = GPIO_DT_SPEC_GET(node, gpios),                                                                         \
+        .code = DT_PROP(node, zephyr_code),                                                                            \
+        .debounce = BUTTON_DEBOUNCE_CFG(node),                                                                         \
+    },
+
+struct button_config
+{
+    struct gpio_dt_spec spec;
+    uint32_t code;
+    struct button_debounce_cfg debounce;
+};
+
+static const struct button_config button_configs[] = { DT_FOREACH_CHILD_STATUS_OKAY(BUTTONS_NODE, BUTTON_CONFIG) };
 
 struct button_data
 {
     struct gpio_dt_spec spec;
-    struct gpio_callback cb_data;
     button_event_handler_t user_cb;
     struct k_work_delayable cooldown_work;
+    struct k_work report_work;
+    struct button_debounce_cfg debounce;
     uint32_t code;
+    /* Uptime of the first edge of the change being debounced */
+    uint32_t edge_ts;
+    bool edge_open;
+    /* Debounced state, owned by the debouncer */
+    bool pressed;
+    /* Leading edge: edges are ignored until the lockout expires */
+    bool locked;
+    /* Integrating: number of samples the pin was active, 0..debounce.ms */
+    uint16_t integrator;
+};
+
+struct button_port
+{
+    const struct device* dev;
+    struct gpio_callback cb_data;
+    /* Index into buttons by pin, NO_BUTTON if the pin is not a button */
+    uint8_t buttons[PORT_PINS];
 };
 
 static struct button_data buttons[MAX_BUTTONS];
+static struct button_port ports[MAX_BUTTONS];
+static struct k_spinlock lock;
+
+/* Time of the first edge since the debouncer last settled */
+static uint32_t edge_take(struct button_data* button)
+{
+    uint32_t timestamp;
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    timestamp = button->edge_open ? button->edge_ts : k_uptime_get_32();
+    button->edge_open = false;
+    k_spin_unlock(&lock, key);
+
+    return timestamp;
+}
+
+static void button_report(struct button_data* button, bool pressed, uint32_t timestamp)
+{
+    enum button_evt evt = pressed ? BUTTON_EVT_PRESSED : BUTTON_EVT_RELEASED;
+
+    if (pressed)
+    {
+        latency_mark(LATENCY_STAGE_DEBOUNCED);
+    }
+    trace_point(TRACE_DEBOUNCED, button->code, pressed);
+
+    LOG_DBG("Button %d %s\n", button->spec.pin, pressed ? "pressed" : "released");
+
+    if (button->user_cb)
+    {
+        button->user_cb(evt, button->code, timestamp);
+    }
+}
+
+static void report_handler(struct k_work* work)
+{
+    struct button_data* button = CONTAINER_OF(work, struct button_data, report_work);
+
+    button_report(button, button->pressed, edge_take(button));
+}
+
+/* Trailing edge: the pin has been quiet for the debounce window */
+static void trailing_expired(struct button_data* button)
+{
+    bool pressed = gpio_pin_get_dt(&button->spec) > 0;
+    uint32_t timestamp = edge_take(button);
+
+    if (pressed == button->pressed)
+    {
+        return;
+    }
+
+    button->pressed = pressed;
+    button_report(button, pressed, timestamp);
+}
+
+/* Leading edge: end of the lockout. A change that happened while locked
+ * is reported now and starts a new lockout.
+ */
+static void leading_expired(struct button_data* button)
+{
+    bool pressed = gpio_pin_get_dt(&button->spec) > 0;
+    bool changed;
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    changed = pressed != button->pressed;
+    if (changed)
+    {
+        button->pressed = pressed;
+        k_work_reschedule_for_queue(&input_wq, &button->cooldown_work, K_MSEC(button->debounce.ms));
+    }
+    else
+    {
+        button->locked = false;
+    }
+
+    k_spin_unlock(&lock, key);
+
+    if (changed)
+    {
+        button_report(button, pressed, k_uptime_get_32());
+    }
+}
+
+/* Integrating: count active samples up and inactive samples down, the state
+ * only flips when the count hits a rail. Sampling stops once the pin is
+ * stable again.
+ */
+static void integrating_sample(struct button_data* button)
+{
+    bool active = gpio_pin_get_dt(&button->spec) > 0;
+
+    if (active && button->integrator < button->debounce.ms)
+    {
+        button->integrator++;
+    }
+    else if (!active && button->integrator > 0)
+    {
+        button->integrator--;
+    }
+
+    if (button->integrator == button->debounce.ms && !button->pressed)
+    {
+        button->pressed = true;
+        button_report(button, true, edge_take(button));
+    }
+    else if (button->integrator == 0 && button->pressed)
+    {
+        button->pressed = false;
+        button_report(button, false, edge_take(button));
+    }
+
+    if (button->integrator != (button->pressed ? button->debounce.ms : 0))
+    {
+        k_work_schedule_for_queue(&input_wq, &button->cooldown_work, INTEGRATE_PERIOD);
+    }
+    else
+    {
+        /* Settled, a glitch that was integrated away has no edge */
+        (void)edge_take(button);
+    }
+}
 
 static void cooldown_expired(struct k_work* work)
 {
     struct k_work_delayable* dwork = k_work_delayable_from_work(work);
     struct button_data* button = CONTAINER_OF(dwork, struct button_data, cooldown_work);
-    int val = gpio_pin_get_dt(&button->spec);
-    enum button_evt evt = val ? BUTTON_EVT_PRESSED : BUTTON_EVT_RELEASED;
-    LOG_DBG("Button %d %s\n", button->spec.pin, val ? "pressed" : "released");
 
-    if (button->user_cb)
+    switch (button->debounce.mode)
     {
-        button->user_cb(evt, button->code);
+    case BUTTON_DEBOUNCE_LEADING:
+        leading_expired(button);
+        break;
+    case BUTTON_DEBOUNCE_INTEGRATING:
+        integrating_sample(button);
+        break;
+    case BUTTON_DEBOUNCE_TRAILING:
+    default:
+        trailing_expired(button);
+        break;
+    }
+}
+
+static void button_edge(struct button_data* button)
+{
+    /* The edge starts a debounced change towards pressed */
+    bool press = false;
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (!button->edge_open && button->debounce.mode != BUTTON_DEBOUNCE_LEADING)
+    {
+        button->edge_ts = k_uptime_get_32();
+        button->edge_open = true;
+        press = !button->pressed;
+    }
+
+    switch (button->debounce.mode)
+    {
+    case BUTTON_DEBOUNCE_LEADING:
+        /* The first edge after a stable period is a state change, the
+         * level itself may still be bouncing so it is not read here.
+         */
+        if (!button->locked)
+        {
+            button->locked = true;
+            button->pressed = !button->pressed;
+            press = button->pressed;
+            button->edge_ts = k_uptime_get_32();
+            button->edge_open = true;
+            k_work_submit_to_queue(&input_wq, &button->report_work);
+            k_work_reschedule_for_queue(&input_wq, &button->cooldown_work, K_MSEC(button->debounce.ms));
+        }
+        break;
+    case BUTTON_DEBOUNCE_INTEGRATING:
+        /* Keeps the running sampler going */
+        k_work_schedule_for_queue(&input_wq, &button->cooldown_work, K_NO_WAIT);
+        break;
+    case BUTTON_DEBOUNCE_TRAILING:
+    default:
+        k_work_reschedule_for_queue(&input_wq, &button->cooldown_work, K_MSEC(button->debounce.ms));
+        break;
+    }
+
+    k_spin_unlock(&lock, key);
+
+    /* Bounces, releases and the edges of other changes do not restart the
+     * open latency sample
+     */
+    if (press)
+    {
+        latency_mark(LATENCY_STAGE_ISR);
     }
 }
 
 void button_pressed(const struct device* dev, struct gpio_callback* cb, uint32_t pins)
 {
     LOG_DBG("Button pressed\n");
-    struct button_data* button = CONTAINER_OF(cb, struct button_data, cb_data);
-    k_work_reschedule(&button->cooldown_work, K_MSEC(15));
+    struct button_port* port = CONTAINER_OF(cb, struct button_port, cb_data);
+
+    pins &= cb->pin_mask;
+    while (pins)
+    {
+        uint32_t pin = __builtin_ctz(pins);
+
+        pins &= pins - 1;
+        trace_point(TRACE_BUTTON_ISR, port - ports, pin);
+        button_edge(&buttons[port->buttons[pin]]);
+    }
+}
+
+static struct button_port* port_get(const struct device* dev)
+{
+    for (int i = 0; i < ARRAY_SIZE(ports); i++)
+    {
+        if (ports[i].dev == dev)
+        {
+            return &ports[i];
+        }
+
+        if (!ports[i].dev)
+        {
+            ports[i].dev = dev;
+            memset(ports[i].buttons, NO_BUTTON, sizeof(ports[i].buttons));
+            gpio_init_callback(&ports[i].cb_data, button_pressed, 0);
+
+            if (gpio_add_callback(dev, &ports[i].cb_data))
+            {
+                ports[i].dev = NULL;
+                return NULL;
+            }
+
+            return &ports[i];
+        }
+    }
+
+    return NULL;
 }
 
-int button_init(int index, const struct gpio_dt_spec* spec, uint32_t code, button_event_handler_t handler)
+int button_init(int index,
+                const struct gpio_dt_spec* spec,
+                uint32_t code,
+                const struct button_debounce_cfg* debounce,
+                button_event_handler_t handler)
 {
 
-    if (index < 0 || index >= MAX_BUTTONS || !handler || !spec)
+    if (index < 0 || index >= MAX_BUTTONS || !handler || !spec || !debounce || debounce->ms == 0)
     {
         return -EINVAL;
     }
@@ -55,9 +333,12 @@ int button_init(int index, const struct gpio_dt_spec* spec, uint32_t code, butto
     LOG_DBG("Initializing button %d\n", index);
 
     struct button_data* button = &buttons[index];
+    struct button_port* port;
+
     button->spec = *spec;
     button->user_cb = handler;
     button->code = code;
+    button->debounce = *debounce;
 
     if (!device_is_ready(button->spec.port))
     {
@@ -70,52 +351,37 @@ int button_init(int index, const struct gpio_dt_spec* spec, uint32_t code, butto
         return err;
     }
 
-    err = gpio_pin_interrupt_configure_dt(&button->spec, GPIO_INT_EDGE_BOTH);
-    if (err)
-    {
-        return err;
-    }
+    k_work_init_delayable(&button->cooldown_work, cooldown_expired);
+    k_work_init(&button->report_work, report_handler);
 
-    gpio_init_callback(&button->cb_data, button_pressed, BIT(button->spec.pin));
-    err = gpio_add_callback(button->spec.port, &button->cb_data);
-    if (err)
+    /* Start from the current level so a held button is not reported */
+    button->pressed = gpio_pin_get_dt(&button->spec) > 0;
+    button->integrator = button->pressed ? button->debounce.ms : 0;
+    button->locked = false;
+
+    port = port_get(button->spec.port);
+    if (!port)
     {
-        return err;
+        return -ENOMEM;
     }
 
-    k_work_init_delayable(&button->cooldown_work, cooldown_expired);
+    port->buttons[button->spec.pin] = index;
+    port->cb_data.pin_mask |= BIT(button->spec.pin);
 
-    return 0;
+    return gpio_pin_interrupt_configure_dt(&button->spec, GPIO_INT_EDGE_BOTH);
 }
 
 void buttons_init(button_event_handler_t handler)
 {
-    // Doesn't work for some reason! I nor Copilot can figure out why.
-    // struct gpio_dt_spec spec = GPIO_DT_SPEC_GET_OR(DT_ALIAS(sw##i), gpios, { 0 });
-    // So just hard code the pins for now
-    struct gpio_dt_spec specs[MAX_BUTTONS] = {
-        GPIO_DT_SPEC_GET_OR(DT_ALIAS(sw0), gpios, { 0 }),
-        GPIO_DT_SPEC_GET_OR(DT_ALIAS(sw1), gpios, { 0 }),
-        GPIO_DT_SPEC_GET_OR(DT_ALIAS(sw2), gpios, { 0 }),
-        GPIO_DT_SPEC_GET_OR(DT_ALIAS(sw3), gpios, { 0 }),
-    };
-
-    // I see to do this in a loop just as the one above doesn't work.
-    // TBD: Might be possible to do this with the DT_FOREACH_NODE macro.
-    // See foreach macros https://docs.zephyrproject.org/apidoc/latest/group__devicetree-generic-foreach.html
-    uint32_t codes[MAX_BUTTONS] = {
-        DT_PROP(DT_ALIAS(sw0), zephyr_code),
-        DT_PROP(DT_ALIAS(sw1), zephyr_code),
-        DT_PROP(DT_ALIAS(sw2), zephyr_code),
-        DT_PROP(DT_ALIAS(sw3), zephyr_code),
-    };
-
-    for (int i = 0; i < MAX_BUTTONS; i++)
-    {
-        if (specs[i].port)
+    for (int i = 0; i < ARRAY_SIZE(button_configs); i++)
+    {
+        const struct button_config* config = &button_configs[i];
+
+        LOG_INF("Initializing button %d on pin %d\n", i, config->spec.pin);
+        int err = button_init(i, &config->spec, config->code, &config->debounce, handler);
+        if (err)
         {
-            LOG_INF("Initializing button %d on pin %d\n", i, specs[i].pin);
-            button_init(i, &specs[i], codes[i], handler);
+            LOG_ERR("Button %d init failed (err %d)", i, err);
         }
     }
 }
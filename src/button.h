@@ -11,11 +11,35 @@ enum button_evt
 {
     BUTTON_EVT_PRESSED,
     BUTTON_EVT_RELEASED,
+    /* Emitted by the gesture engine */
+    BUTTON_EVT_LONG_PRESS,
+    BUTTON_EVT_DOUBLE_CLICK,
+    /* code is the mask of BIT(code) of the chord buttons */
+    BUTTON_EVT_CHORD,
 };
 
-typedef void (*button_event_handler_t)(enum button_evt evt, uint32_t code);
+/* Order matches the debounce-mode enum of the rgbled,gpio-keys binding */
+enum button_debounce
+{
+    BUTTON_DEBOUNCE_TRAILING,
+    BUTTON_DEBOUNCE_LEADING,
+    BUTTON_DEBOUNCE_INTEGRATING,
+};
+
+struct button_debounce_cfg
+{
+    enum button_debounce mode;
+    uint16_t ms;
+};
+
+/* timestamp is k_uptime_get_32() of the first edge seen by the ISR */
+typedef void (*button_event_handler_t)(enum button_evt evt, uint32_t code, uint32_t timestamp);
 
-int button_init(int index, const struct gpio_dt_spec* spec, uint32_t code, button_event_handler_t handler);
+int button_init(int index,
+                const struct gpio_dt_spec* spec,
+                uint32_t code,
+                const struct button_debounce_cfg* debounce,
+                button_event_handler_t handler);
 void buttons_init(button_event_handler_t handler);
 
 #endif // BUTTON_H
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Scripted edges on the emulated button pins of native_sim and nrf52_bsim
+ *
+ * The --buttons command line option holds space separated steps:
+ *
+ *   p<n>   press button n, the index in the buttons node
+ *   r<n>   release button n
+ *   w<ms>  wait
+ *   x      flush the log and exit
+ *
+ * e.g. --buttons="p0 w1 r0 w1 p0 w50 r0 w100 x" is a bouncing press. With
+ * --no-rt the simulated time only moves in the waits, so bounce and chord
+ * timing is exact and every run of a script gives the same events. Each step
+ * is logged with its uptime before it is applied.
+ */
+
+#include "cmdline.h"
+#include "soc.h"
+#include <errno.h>
+#include <posix_board_if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log_ctrl.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(button_emul, LOG_LEVEL_INF);
+
+#define STACK_SIZE      1024
+#define THREAD_PRIORITY 7
+
+/* Let main set up the buttons first */
+#define START_DELAY_MS 100
+
+#define BUTTONS_NODE DT_COMPAT_GET_ANY_STATUS_OKAY(rgbled_gpio_keys)
+#define BUTTON_SPEC(node) GPIO_DT_SPEC_GET(node, gpios),
+
+static const struct gpio_dt_spec specs[] = { DT_FOREACH_CHILD_STATUS_OKAY(BUTTONS_NODE, BUTTON_SPEC) };
+
+static char* script;
+
+static void button_emul_options(void)
+{
+    static struct args_struct_t options[] = {
+        {
+            .option = "buttons",
+            .name = "steps",
+            .type = 's',
+            .dest = (void*)&script,
+            .descript = "Button edges to play, see src/button_emul.c",
+        },
+        ARG_TABLE_ENDMARKER,
+    };
+
+    native_add_command_line_opts(options);
+}
+
+NATIVE_TASK(button_emul_options, PRE_BOOT_1, 10);
+
+static int button_set(const char* arg, bool pressed)
+{
+    char* end;
+    unsigned long index = strtoul(arg, &end, 10);
+    const struct gpio_dt_spec* spec;
+
+    if (end == arg || *end || index >= ARRAY_SIZE(specs))
+    {
+        return -EINVAL;
+    }
+
+    spec = &specs[index];
+
+    /* The emulator takes the physical level */
+    return gpio_emul_input_set(spec->port, spec->pin, pressed ^ !!(spec->dt_flags & GPIO_ACTIVE_LOW));
+}
+
+static void button_emul_thread(void)
+{
+    char* rest;
+    int err;
+
+    if (!script)
+    {
+        return;
+    }
+
+    for (char* step = strtok_r(script, " ", &rest); step; step = strtok_r(NULL, " ", &rest))
+    {
+        LOG_INF("Step at %u ms: %s", k_uptime_get_32(), step);
+
+        switch (step[0])
+        {
+        case 'p':
+            err = button_set(&step[1], true);
+            break;
+        case 'r':
+            err = button_set(&step[1], false);
+            break;
+        case 'w':
+            err = 0;
+            k_msleep(strtoul(&step[1], NULL, 10));
+            break;
+        case 'x':
+            LOG_PANIC();
+            posix_exit(0);
+            return;
+        default:
+            err = -EINVAL;
+            break;
+        }
+
+        if (err)
+        {
+            LOG_ERR("Step '%s' failed (err %d)", step, err);
+        }
+    }
+}
+
+K_THREAD_DEFINE(button_emul_id, STACK_SIZE, button_emul_thread, NULL, NULL, NULL, THREAD_PRIORITY, 0, START_DELAY_MS);
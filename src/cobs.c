@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cobs.h"
+#include <errno.h>
+
+size_t cobs_encode(uint8_t* out, const uint8_t* in, size_t len)
+{
+    size_t code_pos = 0;
+    size_t pos = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (in[i] != 0)
+        {
+            out[pos++] = in[i];
+            code++;
+        }
+
+        if (in[i] == 0 || code == 0xff)
+        {
+            out[code_pos] = code;
+            code_pos = pos++;
+            code = 1;
+        }
+    }
+
+    out[code_pos] = code;
+
+    return pos;
+}
+
+int cobs_decode(uint8_t* buf, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len)
+    {
+        uint8_t code = buf[in++];
+
+        if (code == 0 || in + code - 1 > len)
+        {
+            return -EINVAL;
+        }
+
+        for (uint8_t i = 1; i < code; i++)
+        {
+            if (buf[in] == 0)
+            {
+                return -EINVAL;
+            }
+            buf[out++] = buf[in++];
+        }
+
+        /* A full block does not stand for a zero, neither does the last one */
+        if (code != 0xff && in < len)
+        {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
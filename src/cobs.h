@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef COBS_H
+#define COBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Consistent overhead byte stuffing: the encoded data has no zero bytes, so
+ * a zero delimits frames on a byte stream.
+ */
+
+/** @brief Worst case encoded size of @p len bytes, without the delimiter. */
+#define COBS_ENCODED_MAX(len) ((len) + (len) / 254 + 1)
+
+/**
+ * @brief Encode @p len bytes, @p out has room for COBS_ENCODED_MAX(len).
+ *
+ * @return Encoded length, without the delimiter.
+ */
+size_t cobs_encode(uint8_t* out, const uint8_t* in, size_t len);
+
+/**
+ * @brief Decode a frame without its delimiter in place.
+ *
+ * @return Decoded length, or -EINVAL if the frame is malformed.
+ */
+int cobs_decode(uint8_t* buf, size_t len);
+
+#endif // COBS_H
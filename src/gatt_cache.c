@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Discovered GATT handles of known lights
+ *
+ * Lookups, stores and deletes only touch the slots in RAM, they are called
+ * from Bluetooth callbacks during link setup. Writing settings can erase a
+ * flash page, so it is left to a work item on the system workqueue, which
+ * removes the keys of dropped entries first and then saves the changed ones.
+ * A change that failed to reach flash stays pending and is retried after
+ * PERSIST_RETRY_MS.
+ */
+
+#include "gatt_cache.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(gatt_cache, LOG_LEVEL_INF);
+
+#define GATT_CACHE_SUBTREE "gatt_cache"
+
+#define PERSIST_RETRY_MS 5000
+
+/* Address type followed by the address, hex encoded */
+#define GATT_CACHE_KEY_BIN_LEN (1 + sizeof(bt_addr_t))
+#define GATT_CACHE_KEY_HEX_LEN (GATT_CACHE_KEY_BIN_LEN * 2)
+
+struct gatt_cache_slot
+{
+    bt_addr_le_t addr;
+    struct gatt_cache_entry entry;
+    uint32_t last_used;
+    bool valid;
+    /* The entry changed and is not saved yet */
+    bool dirty;
+    /* Settings hold a key for addr */
+    bool stored;
+};
+
+static struct gatt_cache_slot slots[CONFIG_APP_GATT_CACHE_SIZE];
+static uint32_t use_counter;
+static K_MUTEX_DEFINE(cache_lock);
+
+/* Keys in settings whose entry was deleted or evicted. Deletes go first, so
+ * settings never hold more keys than there are slots.
+ */
+static bt_addr_le_t stale[CONFIG_APP_GATT_CACHE_SIZE];
+static size_t stale_count;
+
+static void persist(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(persist_work, persist);
+
+static void key_encode(const bt_addr_le_t* addr, char* key, size_t key_len)
+{
+    uint8_t bin[GATT_CACHE_KEY_BIN_LEN];
+    char hex[GATT_CACHE_KEY_HEX_LEN + 1];
+
+    bin[0] = addr->type;
+    memcpy(&bin[1], addr->a.val, sizeof(addr->a.val));
+    bin2hex(bin, sizeof(bin), hex, sizeof(hex));
+
+    snprintk(key, key_len, GATT_CACHE_SUBTREE "/%s", hex);
+}
+
+static int key_decode(const char* key, bt_addr_le_t* addr)
+{
+    uint8_t bin[GATT_CACHE_KEY_BIN_LEN];
+
+    if (strlen(key) != GATT_CACHE_KEY_HEX_LEN || hex2bin(key, GATT_CACHE_KEY_HEX_LEN, bin, sizeof(bin)) != sizeof(bin))
+    {
+        return -EINVAL;
+    }
+
+    addr->type = bin[0];
+    memcpy(addr->a.val, &bin[1], sizeof(addr->a.val));
+
+    return 0;
+}
+
+static struct gatt_cache_slot* slot_find(const bt_addr_le_t* addr)
+{
+    for (int i = 0; i < ARRAY_SIZE(slots); i++)
+    {
+        if (slots[i].valid && bt_addr_le_eq(&slots[i].addr, addr))
+        {
+            return &slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct gatt_cache_slot* slot_alloc(const bt_addr_le_t* addr)
+{
+    struct gatt_cache_slot* oldest = &slots[0];
+    struct gatt_cache_slot* slot = slot_find(addr);
+
+    if (slot)
+    {
+        return slot;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(slots); i++)
+    {
+        if (!slots[i].valid)
+        {
+            return &slots[i];
+        }
+
+        if (slots[i].last_used < oldest->last_used)
+        {
+            oldest = &slots[i];
+        }
+    }
+
+    return oldest;
+}
+
+/* Called with cache_lock held */
+static void stale_add(const bt_addr_le_t* addr)
+{
+    for (size_t i = 0; i < stale_count; i++)
+    {
+        if (bt_addr_le_eq(&stale[i], addr))
+        {
+            return;
+        }
+    }
+
+    if (stale_count == ARRAY_SIZE(stale))
+    {
+        LOG_WRN("Too many stale entries, one stays in settings");
+        return;
+    }
+
+    bt_addr_le_copy(&stale[stale_count++], addr);
+}
+
+/* Apply one pending change to settings. 1 when one was applied, 0 when none
+ * is left, a negative error when it failed and stays pending.
+ */
+static int persist_one(void)
+{
+    char key[sizeof(GATT_CACHE_SUBTREE) + GATT_CACHE_KEY_HEX_LEN + 1];
+    struct gatt_cache_entry entry;
+    struct gatt_cache_slot* slot = NULL;
+    bt_addr_le_t addr;
+    bool remove = false;
+    int err;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+
+    if (stale_count)
+    {
+        bt_addr_le_copy(&addr, &stale[--stale_count]);
+        remove = true;
+    }
+    else
+    {
+        for (int i = 0; i < ARRAY_SIZE(slots); i++)
+        {
+            if (slots[i].valid && slots[i].dirty)
+            {
+                slot = &slots[i];
+                slot->dirty = false;
+                bt_addr_le_copy(&addr, &slot->addr);
+                entry = slot->entry;
+                break;
+            }
+        }
+    }
+
+    k_mutex_unlock(&cache_lock);
+
+    if (!remove && !slot)
+    {
+        return 0;
+    }
+
+    key_encode(&addr, key, sizeof(key));
+
+    if (remove)
+    {
+        err = settings_delete(key);
+        if (err)
+        {
+            LOG_WRN("Deleting cached handles failed (err %d)", err);
+            k_mutex_lock(&cache_lock, K_FOREVER);
+            stale_add(&addr);
+            k_mutex_unlock(&cache_lock);
+            return err;
+        }
+
+        return 1;
+    }
+
+    err = settings_save_one(key, &entry, sizeof(entry));
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+
+    if (err)
+    {
+        LOG_WRN("Storing cached handles failed (err %d)", err);
+
+        /* Unless the slot was dropped while saving */
+        if (slot->valid && bt_addr_le_eq(&slot->addr, &addr))
+        {
+            slot->dirty = true;
+        }
+
+        k_mutex_unlock(&cache_lock);
+        return err;
+    }
+
+    /* The slot may have been dropped while saving */
+    if (slot->valid && bt_addr_le_eq(&slot->addr, &addr))
+    {
+        slot->stored = true;
+    }
+    else
+    {
+        stale_add(&addr);
+    }
+
+    k_mutex_unlock(&cache_lock);
+
+    return 1;
+}
+
+static void persist(struct k_work* work)
+{
+    int err;
+
+    while ((err = persist_one()) > 0)
+    {
+    }
+
+    if (err)
+    {
+        k_work_schedule(&persist_work, K_MSEC(PERSIST_RETRY_MS));
+    }
+}
+
+static int gatt_cache_set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    struct gatt_cache_slot* slot;
+    bt_addr_le_t addr;
+    ssize_t rc;
+
+    if (!key || key_decode(key, &addr))
+    {
+        return -ENOENT;
+    }
+
+    if (len != sizeof(slot->entry))
+    {
+        /* Stale layout from an older firmware, rediscover */
+        return 0;
+    }
+
+    slot = slot_alloc(&addr);
+
+    rc = read_cb(cb_arg, &slot->entry, sizeof(slot->entry));
+    if (rc < 0)
+    {
+        slot->valid = false;
+        return rc;
+    }
+
+    bt_addr_le_copy(&slot->addr, &addr);
+    slot->last_used = ++use_counter;
+    slot->valid = true;
+    slot->dirty = false;
+    slot->stored = true;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(gatt_cache, GATT_CACHE_SUBTREE, NULL, gatt_cache_set, NULL, NULL);
+
+int gatt_cache_init(void)
+{
+    int err = settings_subsys_init();
+
+    if (err)
+    {
+        LOG_ERR("Settings init failed (err %d)", err);
+        return err;
+    }
+
+    return settings_load_subtree(GATT_CACHE_SUBTREE);
+}
+
+int gatt_cache_get(const bt_addr_le_t* addr, struct gatt_cache_entry* entry)
+{
+    struct gatt_cache_slot* slot;
+    int err = -ENOENT;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+
+    slot = slot_find(addr);
+    if (slot)
+    {
+        *entry = slot->entry;
+        slot->last_used = ++use_counter;
+        err = 0;
+    }
+
+    k_mutex_unlock(&cache_lock);
+
+    return err;
+}
+
+int gatt_cache_store(const bt_addr_le_t* addr, const struct gatt_cache_entry* entry)
+{
+    struct gatt_cache_slot* slot;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+
+    slot = slot_alloc(addr);
+    if (slot->valid && !bt_addr_le_eq(&slot->addr, addr))
+    {
+        if (slot->stored)
+        {
+            stale_add(&slot->addr);
+        }
+        slot->stored = false;
+    }
+
+    bt_addr_le_copy(&slot->addr, addr);
+    slot->entry = *entry;
+    slot->last_used = ++use_counter;
+    slot->valid = true;
+    slot->dirty = true;
+
+    k_mutex_unlock(&cache_lock);
+
+    k_work_reschedule(&persist_work, K_NO_WAIT);
+
+    return 0;
+}
+
+int gatt_cache_delete(const bt_addr_le_t* addr)
+{
+    struct gatt_cache_slot* slot;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+
+    slot = slot_find(addr);
+    if (slot)
+    {
+        if (slot->stored)
+        {
+            stale_add(addr);
+        }
+        slot->valid = false;
+        slot->dirty = false;
+        slot->stored = false;
+    }
+
+    k_mutex_unlock(&cache_lock);
+
+    if (!slot)
+    {
+        return -ENOENT;
+    }
+
+    k_work_reschedule(&persist_work, K_NO_WAIT);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/types.h>
+
+#define GATT_CACHE_DB_HASH_SIZE 16
+
+/**
+ * @brief Handles discovered on a light, valid as long as the light's
+ * database hash matches @p db_hash.
+ */
+struct gatt_cache_entry
+{
+    uint8_t db_hash[GATT_CACHE_DB_HASH_SIZE];
+    uint16_t state_handle;
+    uint16_t pattern_handle;
+    uint16_t indicator_handle;
+    uint16_t value_handle;
+    uint16_t ccc_handle;
+    uint8_t proto;
+};
+
+/** @brief Load the persisted entries. Settings must be usable. */
+int gatt_cache_init(void);
+
+/** @brief Look up the entry for a peer identity. Returns -ENOENT if unknown. */
+int gatt_cache_get(const bt_addr_le_t* addr, struct gatt_cache_entry* entry);
+
+/**
+ * @brief Store the entry for a peer identity, evicting the oldest entry if full.
+ *
+ * Does not block on flash, settings are written from the system workqueue.
+ */
+int gatt_cache_store(const bt_addr_le_t* addr, const struct gatt_cache_entry* entry);
+
+/** @brief Forget the entry for a peer identity. Settings are updated like on a store. */
+int gatt_cache_delete(const bt_addr_le_t* addr);
+
+#endif // GATT_CACHE_H
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Long-press, double-click and chord recognition
+ *
+ * Works from the ISR timestamps the buttons report, the only timers are
+ * delayable works for the chord window and the long-press time. Button
+ * events and the timers both run on the input workqueue so no locking is
+ * needed.
+ */
+
+#include "gesture.h"
+#include "input_wq.h"
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(gesture, LOG_LEVEL_INF);
+
+struct gesture_button
+{
+    struct k_work_delayable long_work;
+    uint32_t press_ts;
+    uint32_t click_ts;
+    /* A first click is waiting for its double */
+    bool clicked;
+    /* Part of a recognized chord, its release is not reported */
+    bool in_chord;
+};
+
+STATS_SECT_START(gesture_stats)
+STATS_SECT_ENTRY32(held)
+STATS_SECT_ENTRY32(hold_last_ms)
+STATS_SECT_ENTRY32(hold_max_ms)
+STATS_SECT_ENTRY32(chords)
+STATS_SECT_ENTRY32(long_presses)
+STATS_SECT_ENTRY32(double_clicks)
+STATS_SECT_END;
+
+STATS_NAME_START(gesture_stats)
+STATS_NAME(gesture_stats, held)
+STATS_NAME(gesture_stats, hold_last_ms)
+STATS_NAME(gesture_stats, hold_max_ms)
+STATS_NAME(gesture_stats, chords)
+STATS_NAME(gesture_stats, long_presses)
+STATS_NAME(gesture_stats, double_clicks)
+STATS_NAME_END(gesture_stats);
+
+static STATS_SECT_DECL(gesture_stats) gesture_stats;
+
+static struct gesture_button buttons[GESTURE_MAX_CODES];
+static const uint32_t* chords;
+static size_t chord_count;
+static uint32_t chord_members;
+static button_event_handler_t user_cb;
+
+/* Presses held back while a chord may still complete */
+static uint32_t held_mask;
+static uint32_t held_ts;
+static struct k_work_delayable hold_work;
+
+/* Remaining time of a window that started at @p since */
+static k_timeout_t window_left(uint32_t since, uint32_t window_ms)
+{
+    uint32_t elapsed = k_uptime_get_32() - since;
+
+    return elapsed >= window_ms ? K_NO_WAIT : K_MSEC(window_ms - elapsed);
+}
+
+static bool chord_partial(uint32_t mask)
+{
+    for (size_t i = 0; i < chord_count; i++)
+    {
+        if ((mask & ~chords[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool chord_exact(uint32_t mask)
+{
+    for (size_t i = 0; i < chord_count; i++)
+    {
+        if (mask == chords[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* A larger chord could still complete from @p mask */
+static bool chord_extendable(uint32_t mask)
+{
+    for (size_t i = 0; i < chord_count; i++)
+    {
+        if (mask != chords[i] && (mask & ~chords[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void press_emit(uint32_t code)
+{
+    struct gesture_button* button = &buttons[code];
+
+    user_cb(BUTTON_EVT_PRESSED, code, button->press_ts);
+
+    if (button->clicked && button->press_ts - button->click_ts <= CONFIG_APP_GESTURE_DOUBLE_CLICK_MS)
+    {
+        button->clicked = false;
+        STATS_INC(gesture_stats, double_clicks);
+        user_cb(BUTTON_EVT_DOUBLE_CLICK, code, button->press_ts);
+    }
+    else
+    {
+        button->clicked = true;
+        button->click_ts = button->press_ts;
+    }
+
+    k_work_reschedule_for_queue(&input_wq, &button->long_work, window_left(button->press_ts, CONFIG_APP_GESTURE_LONG_PRESS_MS));
+}
+
+/* Give up on a chord and pass the held presses on */
+static void hold_flush(void)
+{
+    uint32_t delay = k_uptime_get_32() - held_ts;
+    uint32_t mask = held_mask;
+
+    if (!mask)
+    {
+        return;
+    }
+
+    held_mask = 0;
+    (void)k_work_cancel_delayable(&hold_work);
+
+    STATS_INC(gesture_stats, held);
+    STATS_SET(gesture_stats, hold_last_ms, delay);
+    if (delay > gesture_stats.hold_max_ms)
+    {
+        STATS_SET(gesture_stats, hold_max_ms, delay);
+    }
+
+    for (uint32_t code = 0; mask; code++, mask >>= 1)
+    {
+        if (mask & 1)
+        {
+            press_emit(code);
+        }
+    }
+}
+
+static void chord_emit(void)
+{
+    uint32_t mask = held_mask;
+
+    held_mask = 0;
+    (void)k_work_cancel_delayable(&hold_work);
+
+    for (uint32_t code = 0; code < GESTURE_MAX_CODES; code++)
+    {
+        if (mask & BIT(code))
+        {
+            buttons[code].in_chord = true;
+            buttons[code].clicked = false;
+        }
+    }
+
+    LOG_DBG("Chord 0x%02x", mask);
+    STATS_INC(gesture_stats, chords);
+    user_cb(BUTTON_EVT_CHORD, mask, held_ts);
+}
+
+static void hold_expired(struct k_work* work)
+{
+    if (chord_exact(held_mask) && !IS_POWER_OF_TWO(held_mask))
+    {
+        chord_emit();
+    }
+    else
+    {
+        hold_flush();
+    }
+}
+
+static void long_expired(struct k_work* work)
+{
+    struct k_work_delayable* dwork = k_work_delayable_from_work(work);
+    struct gesture_button* button = CONTAINER_OF(dwork, struct gesture_button, long_work);
+    uint32_t code = ARRAY_INDEX(buttons, button);
+
+    /* A long press is not the first click of a double click */
+    button->clicked = false;
+    STATS_INC(gesture_stats, long_presses);
+    user_cb(BUTTON_EVT_LONG_PRESS, code, button->press_ts);
+}
+
+static void button_down(uint32_t code, uint32_t timestamp)
+{
+    struct gesture_button* button = &buttons[code];
+
+    button->press_ts = timestamp;
+    button->in_chord = false;
+
+    if (held_mask)
+    {
+        uint32_t mask = held_mask | BIT(code);
+
+        if (timestamp - held_ts <= CONFIG_APP_GESTURE_CHORD_MS && chord_partial(mask))
+        {
+            held_mask = mask;
+            if (chord_exact(mask) && !chord_extendable(mask))
+            {
+                chord_emit();
+            }
+            return;
+        }
+
+        hold_flush();
+    }
+
+    if (chord_members & BIT(code))
+    {
+        held_mask = BIT(code);
+        held_ts = timestamp;
+        k_work_reschedule_for_queue(&input_wq, &hold_work, window_left(timestamp, CONFIG_APP_GESTURE_CHORD_MS));
+        return;
+    }
+
+    press_emit(code);
+}
+
+static void button_up(uint32_t code, uint32_t timestamp)
+{
+    struct gesture_button* button = &buttons[code];
+
+    /* Released within the chord window, it was a plain press after all */
+    if (held_mask & BIT(code))
+    {
+        hold_flush();
+    }
+
+    (void)k_work_cancel_delayable(&button->long_work);
+
+    if (button->in_chord)
+    {
+        button->in_chord = false;
+        return;
+    }
+
+    user_cb(BUTTON_EVT_RELEASED, code, timestamp);
+}
+
+void gesture_button_event(enum button_evt evt, uint32_t code, uint32_t timestamp)
+{
+    if (code >= GESTURE_MAX_CODES)
+    {
+        user_cb(evt, code, timestamp);
+        return;
+    }
+
+    switch (evt)
+    {
+    case BUTTON_EVT_PRESSED:
+        button_down(code, timestamp);
+        break;
+    case BUTTON_EVT_RELEASED:
+        button_up(code, timestamp);
+        break;
+    default:
+        user_cb(evt, code, timestamp);
+        break;
+    }
+}
+
+int gesture_init(const uint32_t* chord_masks, size_t count, button_event_handler_t handler)
+{
+    if (!handler || (count && !chord_masks))
+    {
+        return -EINVAL;
+    }
+
+    user_cb = handler;
+    chords = chord_masks;
+    chord_count = count;
+    chord_members = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (chord_masks[i] & ~BIT_MASK(GESTURE_MAX_CODES))
+        {
+            return -EINVAL;
+        }
+        chord_members |= chord_masks[i];
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(buttons); i++)
+    {
+        k_work_init_delayable(&buttons[i].long_work, long_expired);
+    }
+    k_work_init_delayable(&hold_work, hold_expired);
+
+    return STATS_INIT_AND_REG(gesture_stats, STATS_SIZE_32, "gesture");
+}
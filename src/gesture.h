@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include "button.h"
+
+/* Button codes handled by the gesture engine are 0..GESTURE_MAX_CODES-1 */
+#define GESTURE_MAX_CODES 8
+
+/**
+ * @brief Sits between the buttons and the application.
+ *
+ * Presses and releases are passed on, presses of buttons that are part of
+ * a chord are held back for up to CONFIG_APP_GESTURE_CHORD_MS. A second
+ * press within CONFIG_APP_GESTURE_DOUBLE_CLICK_MS adds a DOUBLE_CLICK,
+ * holding for CONFIG_APP_GESTURE_LONG_PRESS_MS adds a LONG_PRESS. Buttons
+ * of a recognized chord only report the CHORD event.
+ *
+ * @param chords Masks of BIT(code) of the buttons forming a chord.
+ */
+int gesture_init(const uint32_t* chords, size_t count, button_event_handler_t handler);
+
+/** @brief Button event handler to pass to buttons_init(). */
+void gesture_button_event(enum button_evt evt, uint32_t code, uint32_t timestamp);
+
+#endif // GESTURE_H
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Host protocol on the USB CDC ACM port
+ *
+ * The protocol thread is woken by the port when bytes arrive, collects them
+ * up to the next frame delimiter and handles one frame at a time. Requests
+ * are answered in order once they have been handled, the reply carries the
+ * room left in the receive buffer so the host never overruns it. Messages
+ * from other contexts, like the replies to bridged writes, are queued and
+ * sent by the protocol thread in between frames.
+ */
+
+#include "host_proto.h"
+#include "ble.h"
+#include "bridge.h"
+#include "cobs.h"
+#include "render.h"
+#include "rgbled_service.h"
+#include "usb_uart.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(host_proto, LOG_LEVEL_INF);
+
+#define FRAME_MAX   CONFIG_APP_HOST_FRAME_MAX
+#define CRC_LEN     sizeof(uint16_t)
+#define HEADER_LEN  2
+#define ENCODED_MAX COBS_ENCODED_MAX(FRAME_MAX + CRC_LEN)
+
+/* Replies wait this long for room in the transmit buffer */
+#define TX_TIMEOUT_MS 100
+
+#define STATS_GROUP_NAME_MAX 16
+
+STATS_SECT_START(host_stats)
+STATS_SECT_ENTRY32(rx_frames)
+STATS_SECT_ENTRY32(rx_bytes)
+STATS_SECT_ENTRY32(rx_crc_errors)
+STATS_SECT_ENTRY32(rx_framing_errors)
+STATS_SECT_ENTRY32(rx_oversize)
+STATS_SECT_ENTRY32(tx_frames)
+STATS_SECT_ENTRY32(tx_errors)
+STATS_SECT_ENTRY32(pixel_frames)
+STATS_SECT_END;
+
+STATS_NAME_START(host_stats)
+STATS_NAME(host_stats, rx_frames)
+STATS_NAME(host_stats, rx_bytes)
+STATS_NAME(host_stats, rx_crc_errors)
+STATS_NAME(host_stats, rx_framing_errors)
+STATS_NAME(host_stats, rx_oversize)
+STATS_NAME(host_stats, tx_frames)
+STATS_NAME(host_stats, tx_errors)
+STATS_NAME(host_stats, pixel_frames)
+STATS_NAME_END(host_stats);
+
+static STATS_SECT_DECL(host_stats) host_stats;
+
+/* Protocol thread only */
+static uint8_t rx_frame[ENCODED_MAX];
+static size_t rx_len;
+static bool rx_oversize;
+
+/* Senders take turns on the encode buffers */
+static K_MUTEX_DEFINE(encode_lock);
+static uint8_t tx_frame[FRAME_MAX + CRC_LEN];
+static uint8_t tx_encoded[ENCODED_MAX + 1];
+
+BUILD_ASSERT(CONFIG_APP_USB_TX_BUF_SIZE >= ENCODED_MAX + 1, "USB transmit buffer must hold a frame");
+
+static K_SEM_DEFINE(rx_sem, 0, 1);
+static K_FIFO_DEFINE(deferred_fifo);
+
+static void host_proto_thread(void);
+
+K_THREAD_DEFINE(host_proto_id,
+                CONFIG_APP_HOST_THREAD_STACK_SIZE,
+                host_proto_thread,
+                NULL,
+                NULL,
+                NULL,
+                CONFIG_APP_HOST_THREAD_PRIORITY,
+                0,
+                0);
+
+static int frame_send(uint8_t type, uint8_t seq, const void* head, size_t head_len, const void* body, size_t len)
+{
+    size_t frame_len = HEADER_LEN + head_len + len;
+    size_t encoded_len;
+    int err;
+
+    if (frame_len > FRAME_MAX)
+    {
+        return -EMSGSIZE;
+    }
+
+    k_mutex_lock(&encode_lock, K_FOREVER);
+
+    tx_frame[0] = type;
+    tx_frame[1] = seq;
+    if (head_len)
+    {
+        memcpy(&tx_frame[HEADER_LEN], head, head_len);
+    }
+    if (len)
+    {
+        memcpy(&tx_frame[HEADER_LEN + head_len], body, len);
+    }
+    sys_put_le16(crc16_ccitt(0xffff, tx_frame, frame_len), &tx_frame[frame_len]);
+
+    encoded_len = cobs_encode(tx_encoded, tx_frame, frame_len + CRC_LEN);
+    tx_encoded[encoded_len++] = 0;
+
+    err = usb_uart_write(tx_encoded, encoded_len, K_MSEC(TX_TIMEOUT_MS));
+
+    k_mutex_unlock(&encode_lock);
+
+    if (err)
+    {
+        STATS_INC(host_stats, tx_errors);
+    }
+    else
+    {
+        STATS_INC(host_stats, tx_frames);
+    }
+
+    return err;
+}
+
+static int reply(uint8_t type, uint8_t seq, int status, const void* body, size_t len)
+{
+    struct host_reply head = {
+        .status = sys_cpu_to_le16(status),
+        .credits = MIN(usb_uart_rx_space() / HOST_CREDIT_BYTES, UINT8_MAX),
+    };
+
+    return frame_send(type | HOST_MSG_REPLY, seq, &head, sizeof(head), body, len);
+}
+
+void host_proto_defer(struct host_deferred* msg)
+{
+    k_fifo_put(&deferred_fifo, msg);
+}
+
+static void deferred_send(void)
+{
+    struct host_deferred* msg;
+
+    while ((msg = k_fifo_get(&deferred_fifo, K_NO_WAIT)) != NULL)
+    {
+        if (msg->reply)
+        {
+            reply(msg->type, msg->seq, msg->status, msg->body, msg->len);
+        }
+        else
+        {
+            frame_send(msg->type, msg->seq, NULL, 0, msg->body, msg->len);
+        }
+
+        msg->release(msg);
+    }
+}
+
+static int state_set(const uint8_t* body, size_t len)
+{
+    const struct host_state_set* set = (const struct host_state_set*)body;
+
+    if (len != sizeof(*set))
+    {
+        return -EINVAL;
+    }
+
+    if (set->indicator != HOST_STATE_KEEP && set->indicator > INDICATOR_HAZARD)
+    {
+        return -EINVAL;
+    }
+
+    if (set->pattern != HOST_STATE_KEEP)
+    {
+        rgbled_pattern_set(set->pattern);
+    }
+
+    if (set->indicator != HOST_STATE_KEEP)
+    {
+        rgbled_left_right_hazard(set->indicator);
+    }
+
+    if (set->brightness != HOST_STATE_KEEP)
+    {
+        rgbled_brightness_set(set->brightness);
+    }
+
+    return 0;
+}
+
+static int pixels_show(const uint8_t* body, size_t len)
+{
+    uint16_t first;
+
+    if (!IS_ENABLED(CONFIG_APP_STRIP))
+    {
+        return -ENOTSUP;
+    }
+
+    if (len < sizeof(first) || (len - sizeof(first)) % 3)
+    {
+        return -EINVAL;
+    }
+
+    first = sys_get_le16(body);
+    render_live(first, &body[sizeof(first)], (len - sizeof(first)) / 3);
+    STATS_INC(host_stats, pixel_frames);
+
+    return 0;
+}
+
+static void status_get(struct host_status* status)
+{
+    struct rgbled_light_state state;
+
+    rgbled_state_get(&state);
+
+    status->uptime_ms = sys_cpu_to_le32(k_uptime_get_32());
+    status->seq = state.seq;
+    status->pattern = state.pattern;
+    status->indicator = state.indicator;
+    status->brightness = state.brightness;
+    status->rx_frames = sys_cpu_to_le32(host_stats.rx_frames);
+    status->rx_errors = sys_cpu_to_le32(host_stats.rx_crc_errors + host_stats.rx_framing_errors +
+                                        host_stats.rx_oversize);
+    status->pixel_frames = sys_cpu_to_le32(host_stats.pixel_frames);
+}
+
+struct stats_reply
+{
+    uint8_t* buf;
+    size_t len;
+    size_t size;
+};
+
+static int stats_entry(struct stats_hdr* hdr, void* arg, const char* name, uint16_t off)
+{
+    struct stats_reply* out = arg;
+    size_t name_len = strlen(name);
+    uint32_t value;
+
+    if (out->len + 1 + name_len + sizeof(value) > out->size)
+    {
+        return -ENOMEM;
+    }
+
+    switch (hdr->s_size)
+    {
+    case sizeof(uint16_t):
+        value = *(uint16_t*)((uint8_t*)hdr + off);
+        break;
+    case sizeof(uint32_t):
+        value = *(uint32_t*)((uint8_t*)hdr + off);
+        break;
+    default:
+        value = *(uint64_t*)((uint8_t*)hdr + off);
+        break;
+    }
+
+    out->buf[out->len++] = name_len;
+    memcpy(&out->buf[out->len], name, name_len);
+    out->len += name_len;
+    sys_put_le32(value, &out->buf[out->len]);
+    out->len += sizeof(value);
+
+    return 0;
+}
+
+static void frame_handle(uint8_t* frame, size_t encoded_len)
+{
+    static uint8_t stats_buf[FRAME_MAX - HEADER_LEN - sizeof(struct host_reply)];
+    int len = cobs_decode(frame, encoded_len);
+    uint8_t type;
+    uint8_t seq;
+    uint8_t* body;
+    int err;
+
+    if (len < (int)(HEADER_LEN + CRC_LEN))
+    {
+        STATS_INC(host_stats, rx_framing_errors);
+        return;
+    }
+
+    len -= CRC_LEN;
+    if (crc16_ccitt(0xffff, frame, len) != sys_get_le16(&frame[len]))
+    {
+        STATS_INC(host_stats, rx_crc_errors);
+        return;
+    }
+
+    STATS_INC(host_stats, rx_frames);
+
+    type = frame[0];
+    seq = frame[1];
+    body = &frame[HEADER_LEN];
+    len -= HEADER_LEN;
+
+    switch (type)
+    {
+    case HOST_MSG_PING:
+        reply(type, seq, 0, body, MIN(len, sizeof(stats_buf)));
+        break;
+    case HOST_MSG_STATE:
+        reply(type, seq, state_set(body, len), NULL, 0);
+        break;
+    case HOST_MSG_PIXELS:
+        reply(type, seq, pixels_show(body, len), NULL, 0);
+        break;
+    case HOST_MSG_STATUS: {
+        struct host_status status;
+
+        status_get(&status);
+        reply(type, seq, 0, &status, sizeof(status));
+        break;
+    }
+    case HOST_MSG_STATS: {
+        struct stats_reply out = { .buf = stats_buf, .size = sizeof(stats_buf) };
+        char name[STATS_GROUP_NAME_MAX + 1] = { 0 };
+        struct stats_hdr* hdr;
+
+        memcpy(name, body, MIN(len, STATS_GROUP_NAME_MAX));
+        hdr = stats_group_find(name);
+        err = hdr ? stats_walk(hdr, stats_entry, &out) : -ENOENT;
+        reply(type, seq, err, out.buf, out.len);
+        break;
+    }
+    case HOST_MSG_LIGHTS:
+        if (!IS_ENABLED(CONFIG_APP_BRIDGE))
+        {
+            reply(type, seq, -ENOTSUP, NULL, 0);
+            break;
+        }
+        reply(type, seq, 0, stats_buf, bridge_lights(stats_buf, sizeof(stats_buf)));
+        break;
+    case HOST_MSG_WRITE:
+        /* Answered once the light did */
+        err = bridge_write(seq, body, len);
+        if (err)
+        {
+            reply(type, seq, err, NULL, 0);
+        }
+        break;
+    default:
+        reply(type, seq, -ENOTSUP, NULL, 0);
+        break;
+    }
+}
+
+static void rx_feed(const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i] != 0)
+        {
+            if (rx_len < sizeof(rx_frame))
+            {
+                rx_frame[rx_len++] = data[i];
+            }
+            else
+            {
+                rx_oversize = true;
+            }
+            continue;
+        }
+
+        if (rx_oversize)
+        {
+            STATS_INC(host_stats, rx_oversize);
+        }
+        else if (rx_len)
+        {
+            frame_handle(rx_frame, rx_len);
+        }
+
+        rx_len = 0;
+        rx_oversize = false;
+    }
+}
+
+static void rx_notify(void)
+{
+    k_sem_give(&rx_sem);
+}
+
+static void host_proto_thread(void)
+{
+    struct k_poll_event events[] = {
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SEM_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, &rx_sem),
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, &deferred_fifo),
+    };
+    const uint8_t* data;
+    size_t len;
+
+    STATS_INIT_AND_REG(host_stats, STATS_SIZE_32, "host");
+    bridge_init();
+    usb_uart_rx_callback_set(rx_notify);
+
+    while (1)
+    {
+        k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+        events[0].state = K_POLL_STATE_NOT_READY;
+        events[1].state = K_POLL_STATE_NOT_READY;
+
+        if (k_sem_take(&rx_sem, K_NO_WAIT) == 0)
+        {
+            while ((len = usb_uart_read_claim(&data)) > 0)
+            {
+                STATS_INCN(host_stats, rx_bytes, len);
+                rx_feed(data, len);
+                usb_uart_read_finish(len);
+                deferred_send();
+            }
+        }
+
+        deferred_send();
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_PROTO_H
+#define HOST_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/toolchain.h>
+
+/*
+ * Framed binary protocol on the USB CDC ACM port. A frame is
+ *
+ *   COBS(type (u8), seq (u8), body, CRC16-CCITT (u16)) 0x00
+ *
+ * The CRC is the little endian CRC16-CCITT, seed 0xffff, over type, seq and
+ * body. Every request is answered with a reply of type | HOST_MSG_REPLY and
+ * the same seq, whose body starts with struct host_reply.
+ *
+ * Flow control: the credits of a reply are the free space of the receive
+ * buffer in HOST_CREDIT_BYTES units when the request was handled. The host
+ * keeps the encoded bytes it sent after that request below it.
+ *
+ * Write replies come when the light answered, they can overtake the replies
+ * to later requests. Messages from the controller without HOST_MSG_REPLY are
+ * not requests, their seq counts them so the host sees the lost ones.
+ */
+#define HOST_MSG_REPLY    0x80U
+#define HOST_CREDIT_BYTES 64U
+
+enum host_msg
+{
+    /* Body echoed back */
+    HOST_MSG_PING = 0x01,
+    /* struct host_state_set */
+    HOST_MSG_STATE = 0x02,
+    /* first pixel (u16), count * { r, g, b }, shown on the local strip */
+    HOST_MSG_PIXELS = 0x03,
+    /* Reply: struct host_status */
+    HOST_MSG_STATUS = 0x04,
+    /* Stats group name, reply: { name length (u8), name, value (u32) }... */
+    HOST_MSG_STATS = 0x05,
+    /* Reply: struct host_light... of the connected lights */
+    HOST_MSG_LIGHTS = 0x06,
+    /* struct host_write, data; forwarded to a light */
+    HOST_MSG_WRITE = 0x07,
+    /* From the controller: struct host_notify, data; a light notified */
+    HOST_MSG_NOTIFY = 0x40,
+    /* From the controller: struct host_trace, struct trace_record... */
+    HOST_MSG_TRACE = 0x41,
+};
+
+struct host_reply
+{
+    /* 0 or a negative errno of the controller's libc, little endian */
+    int16_t status;
+    uint8_t credits;
+} __packed;
+
+/* Fields set to HOST_STATE_KEEP are not changed */
+#define HOST_STATE_KEEP 0xffU
+
+struct host_state_set
+{
+    uint8_t pattern;
+    uint8_t indicator;
+    uint8_t brightness;
+} __packed;
+
+struct host_status
+{
+    uint32_t uptime_ms;
+    uint16_t seq;
+    uint8_t pattern;
+    uint8_t indicator;
+    uint8_t brightness;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+    uint32_t pixel_frames;
+} __packed;
+
+struct host_light
+{
+    uint8_t index;
+    uint8_t addr_type;
+    uint8_t addr[6];
+    /* The light has the packed light state characteristic */
+    uint8_t state_char;
+} __packed;
+
+/* Write without response, the reply comes once the write was sent */
+#define HOST_WRITE_NO_RSP BIT(0)
+
+struct host_write
+{
+    /* struct host_light index */
+    uint8_t light;
+    /* enum ble_light_char */
+    uint8_t chr;
+    uint8_t flags;
+} __packed;
+
+struct host_notify
+{
+    uint8_t light;
+    uint16_t handle;
+} __packed;
+
+struct host_trace
+{
+    /* Frequency of the record cycles */
+    uint32_t cycles_per_sec;
+    /* Records dropped since boot, the buffer was full */
+    uint32_t dropped;
+} __packed;
+
+/**
+ * @brief Message sent by the protocol thread on behalf of another context.
+ *
+ * @p body must stay valid until @p release is called after sending.
+ */
+struct host_deferred
+{
+    void* fifo_reserved;
+    uint8_t type;
+    uint8_t seq;
+    /* Sent as the reply to request @p seq with @p status */
+    bool reply;
+    int16_t status;
+    const void* body;
+    size_t len;
+    void (*release)(struct host_deferred* msg);
+};
+
+/** @brief Queue a message for the protocol thread, any context. */
+void host_proto_defer(struct host_deferred* msg);
+
+#endif // HOST_PROTO_H
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "input_wq.h"
+#include <zephyr/init.h>
+
+struct k_work_q input_wq;
+
+static K_THREAD_STACK_DEFINE(input_wq_stack, CONFIG_APP_INPUT_WQ_STACK_SIZE);
+
+static int input_wq_init(void)
+{
+    const struct k_work_queue_config cfg = {
+        .name = "input_wq",
+    };
+
+    k_work_queue_start(&input_wq, input_wq_stack, K_THREAD_STACK_SIZEOF(input_wq_stack), CONFIG_APP_INPUT_WQ_PRIORITY, &cfg);
+
+    return 0;
+}
+
+SYS_INIT(input_wq_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
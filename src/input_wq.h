@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef INPUT_WQ_H
+#define INPUT_WQ_H
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Workqueue for debouncing, gestures and the button handlers.
+ *
+ * Runs above the system workqueue so button handling does not wait behind
+ * Bluetooth host, settings or flash work. Work on it must not block, the
+ * GATT writes it causes are handed to the system workqueue.
+ */
+extern struct k_work_q input_wq;
+
+#endif // INPUT_WQ_H
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Button to light latency histograms
+ *
+ * Each press is timestamped with the timing counter in the GPIO ISR, when
+ * the debounce completes, when the first write is submitted and when the
+ * first write is acknowledged. The intervals between the stages go into
+ * log-linear histograms, min/max and p50/p90/p99 are published in the
+ * "latency" stats group so they can be read over SMP. Count, min and max are
+ * published with each sample, the percentiles walk the histograms and are
+ * published by a work item at most every PUBLISH_MS, off the latency path.
+ */
+
+#include "latency.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/timing/timing.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(latency, CONFIG_APP_LATENCY_LOG_LEVEL);
+
+/* Buckets are exact below 2^SUB_BITS us and keep SUB_BITS of precision
+ * above, i.e. percentiles are within 12.5%. Samples clamp at ~2 s.
+ */
+#define SUB_BITS     3
+#define SUB_BUCKETS  BIT(SUB_BITS)
+#define MAX_BITS     21
+#define MAX_US       (BIT(MAX_BITS) - 1)
+#define HIST_BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS)
+
+#define PUBLISH_MS 1000
+
+/* An open sample older than this is abandoned by the next press */
+#define SAMPLE_TIMEOUT_MS 1000
+
+enum latency_interval
+{
+    INTERVAL_DEBOUNCE, /* ISR to debounced */
+    INTERVAL_SUBMIT,   /* debounced to write submitted */
+    INTERVAL_ACK,      /* write submitted to acknowledged */
+    INTERVAL_TOTAL,    /* ISR to acknowledged */
+    INTERVAL_COUNT,
+};
+
+struct latency_hist
+{
+    uint16_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+};
+
+#define LATENCY_STATS_ENTRIES(name)                                                                                    \
+    STATS_SECT_ENTRY32(name##_count)                                                                                   \
+    STATS_SECT_ENTRY32(name##_min_us)                                                                                  \
+    STATS_SECT_ENTRY32(name##_max_us)                                                                                  \
+    STATS_SECT_ENTRY32(name##_p50_us)                                                                                  \
+    STATS_SECT_ENTRY32(name##_p90_us)                                                                                  \
+    STATS_SECT_ENTRY32(name##_p99_us)
+
+#define LATENCY_STATS_NAMES(name)                                                                                      \
+    STATS_NAME(latency_stats, name##_count)                                                                            \
+    STATS_NAME(latency_stats, name##_min_us)                                                                           \
+    STATS_NAME(latency_stats, name##_max_us)                                                                           \
+    STATS_NAME(latency_stats, name##_p50_us)                                                                           \
+    STATS_NAME(latency_stats, name##_p90_us)                                                                           \
+    STATS_NAME(latency_stats, name##_p99_us)
+
+#define LATENCY_STATS_PUBLISH(name, hist)                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        STATS_SET(latency_stats, name##_count, (hist)->count);                                                         \
+        STATS_SET(latency_stats, name##_min_us, (hist)->min);                                                          \
+        STATS_SET(latency_stats, name##_max_us, (hist)->max);                                                          \
+    } while (0)
+
+#define LATENCY_STATS_PUBLISH_PERCENTILES(name, hist)                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        STATS_SET(latency_stats, name##_p50_us, hist_percentile(hist, 50));                                            \
+        STATS_SET(latency_stats, name##_p90_us, hist_percentile(hist, 90));                                            \
+        STATS_SET(latency_stats, name##_p99_us, hist_percentile(hist, 99));                                            \
+    } while (0)
+
+STATS_SECT_START(latency_stats)
+LATENCY_STATS_ENTRIES(debounce)
+LATENCY_STATS_ENTRIES(submit)
+LATENCY_STATS_ENTRIES(ack)
+LATENCY_STATS_ENTRIES(total)
+STATS_SECT_ENTRY32(abandoned)
+STATS_SECT_END;
+
+STATS_NAME_START(latency_stats)
+LATENCY_STATS_NAMES(debounce)
+LATENCY_STATS_NAMES(submit)
+LATENCY_STATS_NAMES(ack)
+LATENCY_STATS_NAMES(total)
+STATS_NAME(latency_stats, abandoned)
+STATS_NAME_END(latency_stats);
+
+static STATS_SECT_DECL(latency_stats) latency_stats;
+
+static struct
+{
+    struct k_spinlock lock;
+    timing_t ts[LATENCY_STAGE_COUNT];
+    enum latency_stage next;
+} sample;
+
+static struct latency_hist hists[INTERVAL_COUNT];
+static K_MUTEX_DEFINE(hist_lock);
+static bool ready;
+
+static void percentiles_publish(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(publish_work, percentiles_publish);
+
+static uint32_t hist_bucket(uint32_t us)
+{
+    uint32_t shift;
+
+    if (us < SUB_BUCKETS)
+    {
+        return us;
+    }
+
+    shift = (31 - __builtin_clz(us)) - SUB_BITS;
+
+    return (shift + 1) * SUB_BUCKETS + ((us >> shift) - SUB_BUCKETS);
+}
+
+/* Largest value that falls in a bucket */
+static uint32_t hist_bucket_max(uint32_t bucket)
+{
+    uint32_t shift;
+
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    shift = bucket / SUB_BUCKETS - 1;
+
+    return ((SUB_BUCKETS + bucket % SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static void hist_add(struct latency_hist* hist, uint32_t us)
+{
+    uint32_t bucket;
+
+    us = MIN(us, MAX_US);
+    bucket = hist_bucket(us);
+
+    /* Halve the history instead of saturating, recent samples keep their weight */
+    if (hist->buckets[bucket] == UINT16_MAX)
+    {
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            hist->buckets[i] /= 2;
+        }
+    }
+
+    hist->buckets[bucket]++;
+
+    if (hist->count == 0 || us < hist->min)
+    {
+        hist->min = us;
+    }
+    hist->max = MAX(hist->max, us);
+    hist->count++;
+}
+
+static uint32_t hist_percentile(const struct latency_hist* hist, uint32_t percent)
+{
+    uint32_t total = 0;
+    uint32_t rank;
+    uint32_t seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        total += hist->buckets[i];
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    rank = DIV_ROUND_UP(total * percent, 100);
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+        {
+            return MIN(hist_bucket_max(i), hist->max);
+        }
+    }
+
+    return hist->max;
+}
+
+static void percentiles_publish(struct k_work* work)
+{
+    k_mutex_lock(&hist_lock, K_FOREVER);
+
+    LATENCY_STATS_PUBLISH_PERCENTILES(debounce, &hists[INTERVAL_DEBOUNCE]);
+    LATENCY_STATS_PUBLISH_PERCENTILES(submit, &hists[INTERVAL_SUBMIT]);
+    LATENCY_STATS_PUBLISH_PERCENTILES(ack, &hists[INTERVAL_ACK]);
+    LATENCY_STATS_PUBLISH_PERCENTILES(total, &hists[INTERVAL_TOTAL]);
+
+    k_mutex_unlock(&hist_lock);
+}
+
+static uint32_t interval_us(const timing_t* start, const timing_t* end)
+{
+    uint64_t cycles = timing_cycles_get(start, end);
+
+    return (uint32_t)MIN(timing_cycles_to_ns(cycles) / NSEC_PER_USEC, MAX_US);
+}
+
+static void sample_record(const timing_t* ts)
+{
+    uint32_t total = interval_us(&ts[LATENCY_STAGE_ISR], &ts[LATENCY_STAGE_ACK]);
+
+    k_mutex_lock(&hist_lock, K_FOREVER);
+
+    hist_add(&hists[INTERVAL_DEBOUNCE], interval_us(&ts[LATENCY_STAGE_ISR], &ts[LATENCY_STAGE_DEBOUNCED]));
+    hist_add(&hists[INTERVAL_SUBMIT], interval_us(&ts[LATENCY_STAGE_DEBOUNCED], &ts[LATENCY_STAGE_SUBMIT]));
+    hist_add(&hists[INTERVAL_ACK], interval_us(&ts[LATENCY_STAGE_SUBMIT], &ts[LATENCY_STAGE_ACK]));
+    hist_add(&hists[INTERVAL_TOTAL], total);
+
+    LATENCY_STATS_PUBLISH(debounce, &hists[INTERVAL_DEBOUNCE]);
+    LATENCY_STATS_PUBLISH(submit, &hists[INTERVAL_SUBMIT]);
+    LATENCY_STATS_PUBLISH(ack, &hists[INTERVAL_ACK]);
+    LATENCY_STATS_PUBLISH(total, &hists[INTERVAL_TOTAL]);
+
+    k_mutex_unlock(&hist_lock);
+
+    /* Samples within the delay share one update */
+    k_work_schedule(&publish_work, K_MSEC(PUBLISH_MS));
+
+    LOG_DBG("Press to ack %u us", total);
+}
+
+void latency_mark(enum latency_stage stage)
+{
+    timing_t ts[LATENCY_STAGE_COUNT];
+    bool complete = false;
+    bool abandoned = false;
+    timing_t now;
+
+    if (!ready)
+    {
+        return;
+    }
+
+    now = timing_counter_get();
+
+    k_spinlock_key_t key = k_spin_lock(&sample.lock);
+
+    if (stage == LATENCY_STAGE_ISR)
+    {
+        /* Presses while one is open are ignored, e.g. the second button of
+         * a chord. A press that never led to a write, e.g. without
+         * connected lights, is dropped by the first press after
+         * SAMPLE_TIMEOUT_MS.
+         */
+        if (sample.next == LATENCY_STAGE_ISR ||
+            interval_us(&sample.ts[LATENCY_STAGE_ISR], &now) >= SAMPLE_TIMEOUT_MS * USEC_PER_MSEC)
+        {
+            abandoned = sample.next != LATENCY_STAGE_ISR;
+            sample.ts[LATENCY_STAGE_ISR] = now;
+            sample.next = LATENCY_STAGE_DEBOUNCED;
+        }
+    }
+    else if (stage == sample.next)
+    {
+        sample.ts[stage] = now;
+        sample.next++;
+
+        if (sample.next == LATENCY_STAGE_COUNT)
+        {
+            memcpy(ts, sample.ts, sizeof(ts));
+            sample.next = LATENCY_STAGE_ISR;
+            complete = true;
+        }
+    }
+
+    k_spin_unlock(&sample.lock, key);
+
+    if (abandoned)
+    {
+        STATS_INC(latency_stats, abandoned);
+    }
+
+    if (complete)
+    {
+        sample_record(ts);
+    }
+}
+
+int latency_init(void)
+{
+    timing_init();
+    timing_start();
+
+    ready = true;
+
+    return STATS_INIT_AND_REG(latency_stats, STATS_SIZE_32, "latency");
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/**
+ * @brief Stages of a button press on its way to the lights.
+ *
+ * Marks are only taken in this order. The edge that starts a debounced
+ * press opens a sample, the first acknowledged write closes it. Presses
+ * while a sample is open are not measured.
+ */
+enum latency_stage
+{
+    LATENCY_STAGE_ISR,
+    LATENCY_STAGE_DEBOUNCED,
+    LATENCY_STAGE_SUBMIT,
+    LATENCY_STAGE_ACK,
+    LATENCY_STAGE_COUNT,
+};
+
+#if defined(CONFIG_APP_LATENCY_STATS)
+
+/** @brief Timestamp a stage. Can be called from ISRs. */
+void latency_mark(enum latency_stage stage);
+
+/** @brief Start the timing counter and register the "latency" stats group. */
+int latency_init(void);
+
+#else
+
+static inline void latency_mark(enum latency_stage stage)
+{
+}
+
+static inline int latency_init(void)
+{
+    return 0;
+}
+
+#endif
+
+#endif // LATENCY_H
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "anim.h"
+#include "light_server.h"
+#include "light_sim.h"
+#include "render.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(light_main, LOG_LEVEL_INF);
+
+int main(void)
+{
+    int err;
+
+    LOG_INF("Light started");
+
+    if (IS_ENABLED(CONFIG_APP_STRIP))
+    {
+        anim_init();
+        render_init();
+    }
+
+    err = bt_enable(NULL);
+    if (err)
+    {
+        LOG_ERR("Bluetooth init failed (err %d)", err);
+        return 0;
+    }
+
+    if (light_sim_interferer_start())
+    {
+        return 0;
+    }
+
+    return light_server_start();
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "light_peers.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(light_peers, LOG_LEVEL_INF);
+
+#define LIGHT_PEERS_SUBTREE "light_peers"
+#define LIGHT_PEERS_KEY     LIGHT_PEERS_SUBTREE "/list"
+
+static bt_addr_le_t peers[CONFIG_APP_BLE_MAX_PEERS];
+static size_t peer_count;
+static K_MUTEX_DEFINE(peers_lock);
+
+static int peers_set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    ssize_t rc;
+
+    if (!key || strcmp(key, "list"))
+    {
+        return -ENOENT;
+    }
+
+    if (len % sizeof(bt_addr_le_t) || len > sizeof(peers))
+    {
+        return -EINVAL;
+    }
+
+    rc = read_cb(cb_arg, peers, len);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    peer_count = rc / sizeof(bt_addr_le_t);
+    LOG_INF("Loaded %u known lights", peer_count);
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(light_peers, LIGHT_PEERS_SUBTREE, NULL, peers_set, NULL, NULL);
+
+/* Called with peers_lock held */
+static int peers_save(void)
+{
+    if (peer_count == 0)
+    {
+        return settings_delete(LIGHT_PEERS_KEY);
+    }
+
+    return settings_save_one(LIGHT_PEERS_KEY, peers, peer_count * sizeof(bt_addr_le_t));
+}
+
+static int peers_find(const bt_addr_le_t* addr)
+{
+    for (int i = 0; i < peer_count; i++)
+    {
+        if (bt_addr_le_eq(&peers[i], addr))
+        {
+            return i;
+        }
+    }
+
+    return -ENOENT;
+}
+
+int light_peers_init(void)
+{
+    return settings_load_subtree(LIGHT_PEERS_SUBTREE);
+}
+
+int light_peers_add(const bt_addr_le_t* addr)
+{
+    int err;
+
+    k_mutex_lock(&peers_lock, K_FOREVER);
+
+    if (peers_find(addr) >= 0)
+    {
+        err = -EALREADY;
+    }
+    else if (peer_count >= ARRAY_SIZE(peers))
+    {
+        err = -ENOMEM;
+    }
+    else
+    {
+        bt_addr_le_copy(&peers[peer_count++], addr);
+        err = peers_save();
+    }
+
+    k_mutex_unlock(&peers_lock);
+
+    return err;
+}
+
+int light_peers_remove(const bt_addr_le_t* addr)
+{
+    int err;
+    int idx;
+
+    k_mutex_lock(&peers_lock, K_FOREVER);
+
+    idx = peers_find(addr);
+    if (idx < 0)
+    {
+        err = idx;
+    }
+    else
+    {
+        peer_count--;
+        bt_addr_le_copy(&peers[idx], &peers[peer_count]);
+        err = peers_save();
+    }
+
+    k_mutex_unlock(&peers_lock);
+
+    return err;
+}
+
+int light_peers_clear(void)
+{
+    int err;
+
+    k_mutex_lock(&peers_lock, K_FOREVER);
+    peer_count = 0;
+    err = peers_save();
+    k_mutex_unlock(&peers_lock);
+
+    return err;
+}
+
+bool light_peers_contains(const bt_addr_le_t* addr)
+{
+    bool found;
+
+    k_mutex_lock(&peers_lock, K_FOREVER);
+    found = peers_find(addr) >= 0;
+    k_mutex_unlock(&peers_lock);
+
+    return found;
+}
+
+size_t light_peers_count(void)
+{
+    return peer_count;
+}
+
+int light_peers_load_accept_list(void)
+{
+    int err;
+
+    k_mutex_lock(&peers_lock, K_FOREVER);
+
+    err = bt_le_filter_accept_list_clear();
+    for (int i = 0; !err && i < peer_count; i++)
+    {
+        err = bt_le_filter_accept_list_add(&peers[i]);
+    }
+
+    k_mutex_unlock(&peers_lock);
+
+    return err;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LIGHT_PEERS_H
+#define LIGHT_PEERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <zephyr/bluetooth/addr.h>
+
+/** @brief Load the persisted peer list. Settings must be usable. */
+int light_peers_init(void);
+
+/** @brief Add a light to the known peers. Returns -EALREADY if known, -ENOMEM if full. */
+int light_peers_add(const bt_addr_le_t* addr);
+
+/** @brief Remove a light from the known peers. Returns -ENOENT if unknown. */
+int light_peers_remove(const bt_addr_le_t* addr);
+
+/** @brief Forget all known peers. */
+int light_peers_clear(void);
+
+bool light_peers_contains(const bt_addr_le_t* addr);
+size_t light_peers_count(void);
+
+/**
+ * @brief Replace the controller's filter accept list with the known peers.
+ *
+ * Must not be called while scanning or initiating with the accept list.
+ */
+int light_peers_load_accept_list(void);
+
+#endif // LIGHT_PEERS_H
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Light side of the RGBLED service
+ *
+ * GATT server the controller writes to. The packed state characteristic and
+ * the legacy pattern and indicator characteristics take write requests and
+ * write commands, all three can be read and notify their value after a
+ * change. The controller reads the state on every connection and only
+ * writes what differs. Notifications are batched: a change schedules one
+ * notification of every subscribed characteristic
+ * CONFIG_APP_LIGHT_NOTIFY_DELAY_MS later, the changes in between only update
+ * the value it sends.
+ *
+ * State writes carry a sequence number, writes that are not newer than the
+ * last accepted one are dropped. The sequence restarts with every connection,
+ * the controller may have rebooted in between.
+ */
+
+#include "light_server.h"
+#include "render.h"
+#include "rgbled_service.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(light, LOG_LEVEL_INF);
+
+STATS_SECT_START(light_stats)
+STATS_SECT_ENTRY32(connections)
+STATS_SECT_ENTRY32(writes)
+STATS_SECT_ENTRY32(commands)
+STATS_SECT_ENTRY32(stale)
+STATS_SECT_ENTRY32(rejected)
+STATS_SECT_ENTRY32(changes)
+STATS_SECT_ENTRY32(notifications)
+STATS_SECT_ENTRY32(notify_errors)
+STATS_SECT_END;
+
+STATS_NAME_START(light_stats)
+STATS_NAME(light_stats, connections)
+STATS_NAME(light_stats, writes)
+STATS_NAME(light_stats, commands)
+STATS_NAME(light_stats, stale)
+STATS_NAME(light_stats, rejected)
+STATS_NAME(light_stats, changes)
+STATS_NAME(light_stats, notifications)
+STATS_NAME(light_stats, notify_errors)
+STATS_NAME_END(light_stats);
+
+static STATS_SECT_DECL(light_stats) light_stats;
+
+static struct
+{
+    struct k_spinlock lock;
+    struct rgbled_light_state state;
+    /* No state write accepted on this connection yet */
+    bool seq_reset;
+    struct bt_conn* conn;
+} light = {
+    .state = {
+        .version = RGBLED_LIGHT_STATE_VERSION,
+        .indicator = INDICATOR_OFF,
+    },
+    .seq_reset = true,
+};
+
+static const struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+    BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_RGBLED_SERVICE_VAL),
+};
+
+static void notify_send(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(notify_work, notify_send);
+
+/* Render and notify a new state, called with the lock released */
+static void state_changed(const struct rgbled_light_state* state, uint8_t flags)
+{
+    STATS_INC(light_stats, changes);
+
+    if (IS_ENABLED(CONFIG_APP_STRIP))
+    {
+        render_update(state);
+    }
+
+    if (IS_ENABLED(CONFIG_APP_LIGHT_NOTIFY_CMD) || !(flags & BT_GATT_WRITE_FLAG_CMD))
+    {
+        /* Does not move a pending notification, the window starts with the first change */
+        k_work_schedule(&notify_work, K_MSEC(CONFIG_APP_LIGHT_NOTIFY_DELAY_MS));
+    }
+}
+
+static void write_count(uint8_t flags)
+{
+    if (flags & BT_GATT_WRITE_FLAG_CMD)
+    {
+        STATS_INC(light_stats, commands);
+    }
+    else
+    {
+        STATS_INC(light_stats, writes);
+    }
+}
+
+static ssize_t state_write(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    const void* buf,
+    uint16_t len,
+    uint16_t offset,
+    uint8_t flags)
+{
+    const struct rgbled_light_state* write = buf;
+    struct rgbled_light_state state;
+    k_spinlock_key_t key;
+    uint16_t seq;
+    bool changed;
+
+    write_count(flags);
+
+    if (offset || len != sizeof(*write) || write->version != RGBLED_LIGHT_STATE_VERSION)
+    {
+        STATS_INC(light_stats, rejected);
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    if (write->indicator > INDICATOR_HAZARD)
+    {
+        STATS_INC(light_stats, rejected);
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    seq = sys_le16_to_cpu(write->seq);
+
+    key = k_spin_lock(&light.lock);
+    if (!light.seq_reset && (int16_t)(seq - light.state.seq) <= 0)
+    {
+        k_spin_unlock(&light.lock, key);
+        /* Acknowledged all the same, the controller already has a newer state in flight */
+        STATS_INC(light_stats, stale);
+        return len;
+    }
+
+    changed = light.state.pattern != write->pattern || light.state.indicator != write->indicator ||
+              light.state.brightness != write->brightness;
+
+    light.seq_reset = false;
+    light.state.seq = seq;
+    light.state.pattern = write->pattern;
+    light.state.indicator = write->indicator;
+    light.state.brightness = write->brightness;
+    state = light.state;
+    k_spin_unlock(&light.lock, key);
+
+    LOG_DBG("State seq %u pattern %u indicator %u brightness %u",
+            state.seq,
+            state.pattern,
+            state.indicator,
+            state.brightness);
+
+    if (changed)
+    {
+        state_changed(&state, flags);
+    }
+
+    return len;
+}
+
+static ssize_t legacy_write(const void* buf, uint16_t len, uint16_t offset, uint8_t flags, bool indicator)
+{
+    struct rgbled_light_state state;
+    k_spinlock_key_t key;
+    uint8_t value;
+    bool changed;
+
+    write_count(flags);
+
+    if (offset || len != sizeof(value))
+    {
+        STATS_INC(light_stats, rejected);
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    value = *(const uint8_t*)buf;
+    if (indicator && value > INDICATOR_HAZARD)
+    {
+        STATS_INC(light_stats, rejected);
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    key = k_spin_lock(&light.lock);
+    if (indicator)
+    {
+        changed = light.state.indicator != value;
+        light.state.indicator = value;
+    }
+    else
+    {
+        changed = light.state.pattern != value;
+        light.state.pattern = value;
+    }
+    state = light.state;
+    k_spin_unlock(&light.lock, key);
+
+    LOG_DBG("%s %u", indicator ? "Indicator" : "Pattern", value);
+
+    if (changed)
+    {
+        state_changed(&state, flags);
+    }
+
+    return len;
+}
+
+static ssize_t state_read(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    void* buf,
+    uint16_t len,
+    uint16_t offset)
+{
+    struct rgbled_light_state state;
+    k_spinlock_key_t key = k_spin_lock(&light.lock);
+
+    state = light.state;
+    k_spin_unlock(&light.lock, key);
+
+    state.seq = sys_cpu_to_le16(state.seq);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &state, sizeof(state));
+}
+
+static ssize_t legacy_read(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    void* buf,
+    uint16_t len,
+    uint16_t offset,
+    bool indicator)
+{
+    k_spinlock_key_t key = k_spin_lock(&light.lock);
+    uint8_t value = indicator ? light.state.indicator : light.state.pattern;
+
+    k_spin_unlock(&light.lock, key);
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, &value, sizeof(value));
+}
+
+static ssize_t pattern_read(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    void* buf,
+    uint16_t len,
+    uint16_t offset)
+{
+    return legacy_read(conn, attr, buf, len, offset, false);
+}
+
+static ssize_t indicator_read(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    void* buf,
+    uint16_t len,
+    uint16_t offset)
+{
+    return legacy_read(conn, attr, buf, len, offset, true);
+}
+
+static ssize_t pattern_write(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    const void* buf,
+    uint16_t len,
+    uint16_t offset,
+    uint8_t flags)
+{
+    return legacy_write(buf, len, offset, flags, false);
+}
+
+static ssize_t indicator_write(
+    struct bt_conn* conn,
+    const struct bt_gatt_attr* attr,
+    const void* buf,
+    uint16_t len,
+    uint16_t offset,
+    uint8_t flags)
+{
+    return legacy_write(buf, len, offset, flags, true);
+}
+
+#define RGBLED_CHRC_PROPS \
+    (BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE | BT_GATT_CHRC_WRITE_WITHOUT_RESP | BT_GATT_CHRC_NOTIFY)
+#define RGBLED_CHRC_PERM (BT_GATT_PERM_READ | BT_GATT_PERM_WRITE)
+
+/*
+ * The controller takes the first CCC after the state and the indicator
+ * characteristic, keep every CCC right behind its characteristic.
+ */
+BT_GATT_SERVICE_DEFINE(rgbled_svc,
+                       BT_GATT_PRIMARY_SERVICE(BT_UUID_RGBLED_SERVICE),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_RGBLED_STATE_CHAR,
+                                              RGBLED_CHRC_PROPS,
+                                              RGBLED_CHRC_PERM,
+                                              state_read,
+                                              state_write,
+                                              NULL),
+                       BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_RGBLED_PATTERN_CHAR,
+                                              RGBLED_CHRC_PROPS,
+                                              RGBLED_CHRC_PERM,
+                                              pattern_read,
+                                              pattern_write,
+                                              NULL),
+                       BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_RGBLED_INDICATOR_CHAR,
+                                              RGBLED_CHRC_PROPS,
+                                              RGBLED_CHRC_PERM,
+                                              indicator_read,
+                                              indicator_write,
+                                              NULL),
+                       BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE));
+
+/* Value attributes of the characteristics */
+#define STATE_ATTR     (&rgbled_svc.attrs[2])
+#define PATTERN_ATTR   (&rgbled_svc.attrs[5])
+#define INDICATOR_ATTR (&rgbled_svc.attrs[8])
+
+static void notify_attr(struct bt_conn* conn, const struct bt_gatt_attr* attr, const void* data, uint16_t len)
+{
+    int err;
+
+    if (!bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+    {
+        return;
+    }
+
+    err = bt_gatt_notify(conn, attr, data, len);
+    if (err)
+    {
+        STATS_INC(light_stats, notify_errors);
+        LOG_WRN("Notification failed (err %d)", err);
+        return;
+    }
+
+    STATS_INC(light_stats, notifications);
+}
+
+static void notify_send(struct k_work* work)
+{
+    struct rgbled_light_state state;
+    struct bt_conn* conn;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&light.lock);
+    state = light.state;
+    conn = light.conn ? bt_conn_ref(light.conn) : NULL;
+    k_spin_unlock(&light.lock, key);
+
+    if (!conn)
+    {
+        return;
+    }
+
+    state.seq = sys_cpu_to_le16(state.seq);
+
+    notify_attr(conn, STATE_ATTR, &state, sizeof(state));
+    notify_attr(conn, PATTERN_ATTR, &state.pattern, sizeof(state.pattern));
+    notify_attr(conn, INDICATOR_ATTR, &state.indicator, sizeof(state.indicator));
+
+    bt_conn_unref(conn);
+}
+
+static void advertise(struct k_work* work)
+{
+    bt_addr_le_t addr;
+    size_t count = 1;
+    char str[BT_ADDR_LE_STR_LEN];
+    int err;
+
+    err = bt_le_adv_start(BT_LE_ADV_CONN_ONE_TIME, ad, ARRAY_SIZE(ad), NULL, 0);
+    if (err)
+    {
+        LOG_ERR("Advertising failed to start (err %d)", err);
+        return;
+    }
+
+    bt_id_get(&addr, &count);
+    bt_addr_le_to_str(&addr, str, sizeof(str));
+    LOG_INF("Advertising as %s", str);
+}
+
+static K_WORK_DEFINE(advertise_work, advertise);
+
+static void connected(struct bt_conn* conn, uint8_t err)
+{
+    char addr[BT_ADDR_LE_STR_LEN];
+    k_spinlock_key_t key;
+
+    if (err)
+    {
+        LOG_INF("Connection failed (err 0x%02x)", err);
+        k_work_submit(&advertise_work);
+        return;
+    }
+
+    bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+    LOG_INF("Connected: %s", addr);
+    STATS_INC(light_stats, connections);
+
+    key = k_spin_lock(&light.lock);
+    light.conn = bt_conn_ref(conn);
+    light.seq_reset = true;
+    k_spin_unlock(&light.lock, key);
+}
+
+static void disconnected(struct bt_conn* conn, uint8_t reason)
+{
+    struct bt_conn* old;
+    k_spinlock_key_t key;
+
+    LOG_INF("Disconnected (reason 0x%02x)", reason);
+
+    key = k_spin_lock(&light.lock);
+    old = light.conn;
+    light.conn = NULL;
+    k_spin_unlock(&light.lock, key);
+
+    if (old)
+    {
+        bt_conn_unref(old);
+    }
+}
+
+/* The connection object is free again, advertising can restart */
+static void recycled(void)
+{
+    k_work_submit(&advertise_work);
+}
+
+BT_CONN_CB_DEFINE(light_conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .recycled = recycled,
+};
+
+int light_server_start(void)
+{
+    int err;
+
+    err = STATS_INIT_AND_REG(light_stats, STATS_SIZE_32, "light");
+    if (err)
+    {
+        LOG_ERR("Stats init failed (err %d)", err);
+    }
+
+    k_work_submit(&advertise_work);
+
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LIGHT_SERVER_H
+#define LIGHT_SERVER_H
+
+/**
+ * @brief Start advertising the RGBLED service.
+ *
+ * Bluetooth must be enabled. Advertising restarts whenever the connection
+ * to the controller is gone.
+ */
+int light_server_start(void);
+
+#endif // LIGHT_SERVER_H
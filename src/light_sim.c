@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Simulation options of the light on nrf52_bsim
+ *
+ * --drop_every=<ms> drops the link to the controller that long after it was
+ * set up. --interferer turns the device into a non-connectable advertiser
+ * that keeps the advertising channels busy instead of serving the
+ * controller. Both are used by scripts/bsim_bench.py.
+ */
+
+#include "light_sim.h"
+#include "cmdline.h"
+#include "soc.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(light_sim, LOG_LEVEL_INF);
+
+/* Shortest interval of legacy advertising, 20 ms */
+#define INTERFERER_INTERVAL 0x20
+
+static uint32_t drop_every_ms;
+static bool interferer;
+
+static struct bt_conn* drop_conn;
+
+static const uint8_t noise[29] = { 0xff, 0xff };
+
+static const struct bt_data interferer_ad[] = {
+    BT_DATA(BT_DATA_MANUFACTURER_DATA, noise, sizeof(noise)),
+};
+
+static void light_sim_options(void)
+{
+    static struct args_struct_t options[] = {
+        {
+            .option = "drop_every",
+            .name = "ms",
+            .type = 'u',
+            .dest = (void*)&drop_every_ms,
+            .descript = "Drop the link this long after it was set up",
+        },
+        {
+            .is_switch = true,
+            .option = "interferer",
+            .type = 'b',
+            .dest = (void*)&interferer,
+            .descript = "Only advertise, as fast as possible",
+        },
+        ARG_TABLE_ENDMARKER,
+    };
+
+    native_add_command_line_opts(options);
+}
+
+NATIVE_TASK(light_sim_options, PRE_BOOT_1, 10);
+
+static void drop(struct k_work* work)
+{
+    if (drop_conn)
+    {
+        LOG_INF("Dropping the link");
+        (void)bt_conn_disconnect(drop_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+}
+
+static K_WORK_DELAYABLE_DEFINE(drop_work, drop);
+
+static void connected(struct bt_conn* conn, uint8_t err)
+{
+    if (err || !drop_every_ms)
+    {
+        return;
+    }
+
+    drop_conn = bt_conn_ref(conn);
+    k_work_schedule(&drop_work, K_MSEC(drop_every_ms));
+}
+
+static void disconnected(struct bt_conn* conn, uint8_t reason)
+{
+    k_work_cancel_delayable(&drop_work);
+    if (drop_conn)
+    {
+        bt_conn_unref(drop_conn);
+        drop_conn = NULL;
+    }
+}
+
+BT_CONN_CB_DEFINE(light_sim_conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+};
+
+bool light_sim_interferer_start(void)
+{
+    int err;
+
+    if (!interferer)
+    {
+        return false;
+    }
+
+    err = bt_le_adv_start(BT_LE_ADV_PARAM(0, INTERFERER_INTERVAL, INTERFERER_INTERVAL, NULL),
+                          interferer_ad,
+                          ARRAY_SIZE(interferer_ad),
+                          NULL,
+                          0);
+    LOG_INF("Interferer advertising (err %d)", err);
+
+    return true;
+}
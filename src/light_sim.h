@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LIGHT_SIM_H
+#define LIGHT_SIM_H
+
+#include <stdbool.h>
+
+#if defined(CONFIG_APP_LIGHT_SIM)
+
+/**
+ * @brief Start the simulated interferer if --interferer was given.
+ *
+ * @return true if the device is an interferer and must not serve the
+ * controller.
+ */
+bool light_sim_interferer_start(void);
+
+#else
+
+static inline bool light_sim_interferer_start(void)
+{
+    return false;
+}
+
+#endif
+
+#endif // LIGHT_SIM_H
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Activity driven connection parameter and PHY profiles
+ *
+ * While buttons are used or indicators blink, the light links run a short
+ * connection interval on the 2M PHY. After CONFIG_APP_BLE_IDLE_TIMEOUT_MS
+ * without activity they move to a long interval with peripheral latency.
+ * Going active is immediate, going idle only happens after the timeout,
+ * which keeps a burst of presses from bouncing between the profiles.
+ */
+
+#include "link_profile.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(link_profile, LOG_LEVEL_INF);
+
+/* Connection intervals are in 1.25 ms units, timeouts in 10 ms units */
+#define CONN_INTERVAL(us) ((us) / 1250)
+
+enum link_profile
+{
+    LINK_PROFILE_IDLE,
+    LINK_PROFILE_ACTIVE,
+};
+
+/* The supervision timeout must cover the skipped events of the idle profile */
+BUILD_ASSERT(CONFIG_APP_BLE_IDLE_INTERVAL_MS * (1 + CONFIG_APP_BLE_IDLE_LATENCY) * 2 < 6000,
+             "Idle interval and latency exceed the supervision timeout");
+
+static const struct bt_le_conn_param conn_params[] = {
+    [LINK_PROFILE_IDLE] = BT_LE_CONN_PARAM_INIT(
+        CONN_INTERVAL(CONFIG_APP_BLE_IDLE_INTERVAL_MS * 1000),
+        CONN_INTERVAL(CONFIG_APP_BLE_IDLE_INTERVAL_MS * 1000),
+        CONFIG_APP_BLE_IDLE_LATENCY,
+        600),
+    [LINK_PROFILE_ACTIVE] = BT_LE_CONN_PARAM_INIT(
+        CONN_INTERVAL(CONFIG_APP_BLE_ACTIVE_INTERVAL_US),
+        CONN_INTERVAL(CONFIG_APP_BLE_ACTIVE_INTERVAL_US),
+        0,
+        400),
+};
+
+static const struct bt_conn_le_phy_param phy_params[] = {
+    [LINK_PROFILE_IDLE] = {
+        .options = BT_CONN_LE_PHY_OPT_NONE,
+        .pref_tx_phy = BT_GAP_LE_PHY_1M,
+        .pref_rx_phy = BT_GAP_LE_PHY_1M,
+    },
+    [LINK_PROFILE_ACTIVE] = {
+        .options = BT_CONN_LE_PHY_OPT_NONE,
+        .pref_tx_phy = BT_GAP_LE_PHY_2M,
+        .pref_rx_phy = BT_GAP_LE_PHY_2M,
+    },
+};
+
+STATS_SECT_START(link_stats)
+STATS_SECT_ENTRY32(to_active)
+STATS_SECT_ENTRY32(to_idle)
+STATS_SECT_ENTRY32(param_updates)
+STATS_SECT_ENTRY32(param_update_errors)
+STATS_SECT_ENTRY32(phy_updates)
+STATS_SECT_ENTRY32(phy_update_errors)
+STATS_SECT_ENTRY32(active_ms)
+STATS_SECT_ENTRY32(idle_ms)
+STATS_SECT_ENTRY32(interval_us)
+STATS_SECT_END;
+
+STATS_NAME_START(link_stats)
+STATS_NAME(link_stats, to_active)
+STATS_NAME(link_stats, to_idle)
+STATS_NAME(link_stats, param_updates)
+STATS_NAME(link_stats, param_update_errors)
+STATS_NAME(link_stats, phy_updates)
+STATS_NAME(link_stats, phy_update_errors)
+STATS_NAME(link_stats, active_ms)
+STATS_NAME(link_stats, idle_ms)
+STATS_NAME(link_stats, interval_us)
+STATS_NAME_END(link_stats);
+
+static STATS_SECT_DECL(link_stats) link_stats;
+
+static enum link_profile profile = LINK_PROFILE_IDLE;
+/* Uptime of the last switch, the idle profile starts at boot */
+static int64_t profile_since;
+static atomic_t indicator_blinking;
+
+static void activate_handler(struct k_work* work);
+static void apply_handler(struct k_work* work);
+static void idle_handler(struct k_work* work);
+
+/* Defined statically, button presses call in before Bluetooth is up */
+static K_WORK_DEFINE(activate_work, activate_handler);
+static K_WORK_DEFINE(apply_work, apply_handler);
+static K_WORK_DELAYABLE_DEFINE(idle_work, idle_handler);
+
+static void profile_apply(struct bt_conn* conn, void* data)
+{
+    struct bt_conn_info info;
+    int err;
+
+    if (bt_conn_get_info(conn, &info) || info.role != BT_CONN_ROLE_CENTRAL || info.state != BT_CONN_STATE_CONNECTED)
+    {
+        return;
+    }
+
+    if (info.le.interval != conn_params[profile].interval_max || info.le.latency != conn_params[profile].latency)
+    {
+        err = bt_conn_le_param_update(conn, &conn_params[profile]);
+        if (err && err != -EALREADY)
+        {
+            LOG_DBG("Connection parameter update failed (err %d)", err);
+            STATS_INC(link_stats, param_update_errors);
+        }
+    }
+
+    if (info.le.phy && info.le.phy->tx_phy != phy_params[profile].pref_tx_phy)
+    {
+        err = bt_conn_le_phy_update(conn, &phy_params[profile]);
+        if (err && err != -EALREADY)
+        {
+            LOG_DBG("PHY update failed (err %d)", err);
+            STATS_INC(link_stats, phy_update_errors);
+        }
+    }
+}
+
+static void profile_set(enum link_profile next)
+{
+    int64_t now = k_uptime_get();
+    uint32_t elapsed = (uint32_t)(now - profile_since);
+
+    if (next == profile)
+    {
+        return;
+    }
+
+    if (profile == LINK_PROFILE_ACTIVE)
+    {
+        STATS_INCN(link_stats, active_ms, elapsed);
+        STATS_INC(link_stats, to_idle);
+    }
+    else
+    {
+        STATS_INCN(link_stats, idle_ms, elapsed);
+        STATS_INC(link_stats, to_active);
+    }
+
+    profile = next;
+    profile_since = now;
+
+    LOG_DBG("Switching to %s profile", profile == LINK_PROFILE_ACTIVE ? "active" : "idle");
+    bt_conn_foreach(BT_CONN_TYPE_LE, profile_apply, NULL);
+}
+
+static void activate_handler(struct k_work* work)
+{
+    profile_set(LINK_PROFILE_ACTIVE);
+}
+
+static void apply_handler(struct k_work* work)
+{
+    bt_conn_foreach(BT_CONN_TYPE_LE, profile_apply, NULL);
+}
+
+static void idle_handler(struct k_work* work)
+{
+    /* Blinking indicators need the short interval to stay in phase */
+    if (atomic_get(&indicator_blinking))
+    {
+        k_work_reschedule(&idle_work, K_MSEC(CONFIG_APP_BLE_IDLE_TIMEOUT_MS));
+        return;
+    }
+
+    profile_set(LINK_PROFILE_IDLE);
+}
+
+void link_profile_activity(void)
+{
+    k_work_reschedule(&idle_work, K_MSEC(CONFIG_APP_BLE_IDLE_TIMEOUT_MS));
+
+    if (profile != LINK_PROFILE_ACTIVE)
+    {
+        k_work_submit(&activate_work);
+    }
+}
+
+void link_profile_indicator(bool blinking)
+{
+    atomic_set(&indicator_blinking, blinking);
+    link_profile_activity();
+}
+
+void link_profile_connected(struct bt_conn* conn)
+{
+    k_work_submit(&apply_work);
+}
+
+static void le_param_updated(struct bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    STATS_INC(link_stats, param_updates);
+    STATS_SET(link_stats, interval_us, interval * 1250U);
+    LOG_DBG("Connection interval %u us, latency %u", interval * 1250U, latency);
+}
+
+static void le_phy_updated(struct bt_conn* conn, struct bt_conn_le_phy_info* param)
+{
+    STATS_INC(link_stats, phy_updates);
+    LOG_DBG("PHY tx %u rx %u", param->tx_phy, param->rx_phy);
+}
+
+BT_CONN_CB_DEFINE(link_profile_callbacks) = {
+    .le_param_updated = le_param_updated,
+    .le_phy_updated = le_phy_updated,
+};
+
+int link_profile_init(void)
+{
+    return STATS_INIT_AND_REG(link_stats, STATS_SIZE_32, "link");
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LINK_PROFILE_H
+#define LINK_PROFILE_H
+
+#include <stdbool.h>
+#include <zephyr/bluetooth/conn.h>
+
+/** @brief Switch the light links to the active profile and restart the idle timer. */
+void link_profile_activity(void);
+
+/** @brief Blinking indicators keep the links in the active profile. */
+void link_profile_indicator(bool blinking);
+
+/** @brief Apply the current profile to a new light link. */
+void link_profile_connected(struct bt_conn* conn);
+
+int link_profile_init(void);
+
+#endif // LINK_PROFILE_H
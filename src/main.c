@@ -4,19 +4,19 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "anim.h"
+#include "ble.h"
 #include "button.h"
+#include "gesture.h"
+#include "latency.h"
+#include "render.h"
+#include "rgbled_service.h"
+#include "trace.h"
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(bike_light, LOG_LEVEL_INF);
 
-#define INDICATOR_LEFT   0U
-#define INDICATOR_RIGHT  1U
-#define INDICATOR_OFF    2U
-#define INDICATOR_HAZARD 3U
-
-extern void rgbled_pattern_next(void);
-extern void rgbled_left_right_hazard(uint8_t state);
 static char* helper_button_evt_str(enum button_evt evt)
 {
     switch (evt)
@@ -25,16 +25,62 @@ static char* helper_button_evt_str(enum button_evt evt)
         return "Pressed";
     case BUTTON_EVT_RELEASED:
         return "Released";
+    case BUTTON_EVT_LONG_PRESS:
+        return "Long press";
+    case BUTTON_EVT_DOUBLE_CLICK:
+        return "Double click";
+    case BUTTON_EVT_CHORD:
+        return "Chord";
     default:
         return "Unknown";
     }
 }
 
-static void button_event_handler(enum button_evt evt, uint32_t code)
+/* Left and right together toggle the hazard lights */
+static const uint32_t chords[] = {
+    BIT(BTN_LEFT) | BIT(BTN_RIGHT),
+};
+
+static bool hazard_state = 0;
+
+/* Pattern before the last press of the pattern button, a long press puts
+ * it back
+ */
+static uint8_t pattern_before;
+
+static void button_event_handler(enum button_evt evt, uint32_t code, uint32_t timestamp)
 {
-    static bool hazard_state = 0;
+    trace_point(TRACE_BUTTON_EVENT, evt, code);
 
-    LOG_INF("Button event: %s, code: %d\n", helper_button_evt_str(evt), code);
+    LOG_DBG("Button event: %s, code: %d, edge at %u ms\n", helper_button_evt_str(evt), code, timestamp);
+
+    if (evt == BUTTON_EVT_CHORD && code == (BIT(BTN_LEFT) | BIT(BTN_RIGHT)))
+    {
+        hazard_state = !hazard_state;
+        rgbled_left_right_hazard(hazard_state ? INDICATOR_HAZARD : INDICATOR_OFF);
+        return;
+    }
+
+    /* Holding the pattern button pairs new lights, the pattern its press
+     * advanced to is undone
+     */
+    if (evt == BUTTON_EVT_LONG_PRESS && code == BTN_PATTERN)
+    {
+        rgbled_pattern_set(pattern_before);
+        ble_peer_learn();
+        return;
+    }
+
+    /* Holding the hazard button goes back to the first pattern, the hazard
+     * toggle of its press is undone
+     */
+    if (evt == BUTTON_EVT_LONG_PRESS && code == BTN_HAZARD)
+    {
+        hazard_state = !hazard_state;
+        rgbled_left_right_hazard(hazard_state ? INDICATOR_HAZARD : INDICATOR_OFF);
+        rgbled_pattern_set(0);
+        return;
+    }
 
     if (evt == BUTTON_EVT_PRESSED || evt == BUTTON_EVT_RELEASED)
     {
@@ -43,6 +89,10 @@ static void button_event_handler(enum button_evt evt, uint32_t code)
         case BTN_PATTERN:
             if (evt == BUTTON_EVT_PRESSED)
             {
+                struct rgbled_light_state state;
+
+                rgbled_state_get(&state);
+                pattern_before = state.pattern;
                 rgbled_pattern_next();
             }
             break;
@@ -82,6 +132,15 @@ static void button_event_handler(enum button_evt evt, uint32_t code)
 int main(void)
 {
     LOG_INF("Main ran successfully");
-    buttons_init(button_event_handler);
+    latency_init();
+
+    if (IS_ENABLED(CONFIG_APP_STRIP))
+    {
+        anim_init();
+        render_init();
+    }
+
+    gesture_init(chords, ARRAY_SIZE(chords), button_event_handler);
+    buttons_init(gesture_button_event);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Light patterns of the local strip
+ *
+ * The strip is split at the middle, pixels below the middle are the left
+ * side. Indicators sweep from the middle outwards over their side and hide
+ * the base pattern there. Patterns draw every pixel they own each frame, the
+ * canvas drops the ones that did not change. Pattern IDs after the built-in
+ * ones are uploaded animations.
+ */
+
+#include "patterns.h"
+#include "anim.h"
+#include "render.h"
+#include <zephyr/sys/util.h>
+
+#define PULSE_PERIOD_MS   1500
+#define PULSE_MIN         32
+#define RAINBOW_PERIOD_MS 4000
+
+/* Indicator cycle: sweep out, hold, dark */
+#define SWEEP_MS       400
+#define SWEEP_HOLD_MS  150
+#define SWEEP_CYCLE_MS 800
+
+typedef void (*base_pattern_t)(uint32_t now, bool restart, uint16_t from, uint16_t to);
+
+static const struct led_rgb red = { .r = 255 };
+static const struct led_rgb amber = { .r = 255, .g = 100 };
+static const struct led_rgb dark;
+
+static void pattern_steady(uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+    if (!restart)
+    {
+        return;
+    }
+
+    for (uint16_t i = from; i < to; i++)
+    {
+        render_pixel_set(i, red);
+    }
+}
+
+static void pattern_pulse(uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+    uint32_t phase = now % PULSE_PERIOD_MS;
+    uint32_t half = PULSE_PERIOD_MS / 2;
+    uint32_t ramp = phase < half ? phase : PULSE_PERIOD_MS - phase;
+    struct led_rgb color = { .r = PULSE_MIN + (ramp * (UINT8_MAX - PULSE_MIN)) / half };
+
+    for (uint16_t i = from; i < to; i++)
+    {
+        render_pixel_set(i, color);
+    }
+}
+
+static void pattern_rainbow(uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+    uint32_t offset = ((now % RAINBOW_PERIOD_MS) * RENDER_HUE_MAX) / RAINBOW_PERIOD_MS;
+    uint16_t count = render_pixel_count();
+
+    for (uint16_t i = from; i < to; i++)
+    {
+        uint16_t hue = (offset + ((uint32_t)i * RENDER_HUE_MAX) / count) % RENDER_HUE_MAX;
+
+        render_pixel_set(i, render_hsv(hue, UINT8_MAX, UINT8_MAX));
+    }
+}
+
+/* Indexed by the pattern of the light state, RGBLED_PATTERN_COUNT entries */
+static const base_pattern_t base_patterns[] = {
+    pattern_steady,
+    pattern_pulse,
+    pattern_rainbow,
+};
+
+BUILD_ASSERT(ARRAY_SIZE(base_patterns) == RGBLED_PATTERN_COUNT);
+
+/* Sweep over [from, to), starting at @p to when @p outward_down is set */
+static void indicator_sweep(uint32_t elapsed, uint16_t from, uint16_t to, bool outward_down)
+{
+    uint32_t phase = elapsed % SWEEP_CYCLE_MS;
+    uint16_t len = to - from;
+    uint16_t lit;
+
+    if (phase < SWEEP_MS)
+    {
+        lit = (phase * len) / SWEEP_MS + 1;
+    }
+    else if (phase < SWEEP_MS + SWEEP_HOLD_MS)
+    {
+        lit = len;
+    }
+    else
+    {
+        lit = 0;
+    }
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        render_pixel_set(outward_down ? to - 1 - i : from + i, i < lit ? amber : dark);
+    }
+}
+
+void patterns_render(const struct rgbled_light_state* state, uint32_t now, uint32_t elapsed, bool restart)
+{
+    uint16_t count = render_pixel_count();
+    uint16_t middle = count / 2;
+    uint16_t from = 0;
+    uint16_t to = count;
+
+    switch (state->indicator)
+    {
+    case INDICATOR_LEFT:
+        from = middle;
+        break;
+    case INDICATOR_RIGHT:
+        to = middle;
+        break;
+    case INDICATOR_HAZARD:
+        to = 0;
+        break;
+    default:
+        break;
+    }
+
+    if (state->pattern < ARRAY_SIZE(base_patterns))
+    {
+        anim_stop();
+        base_patterns[state->pattern](now, restart, from, to);
+    }
+    else
+    {
+        anim_render(state->pattern, now, restart, from, to);
+    }
+
+    if (state->indicator == INDICATOR_LEFT || state->indicator == INDICATOR_HAZARD)
+    {
+        indicator_sweep(elapsed, 0, middle, true);
+    }
+
+    if (state->indicator == INDICATOR_RIGHT || state->indicator == INDICATOR_HAZARD)
+    {
+        indicator_sweep(elapsed, middle, count, false);
+    }
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include "rgbled_service.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Draw one frame of the light state into the render canvas.
+ *
+ * @param now Uptime in milliseconds, base patterns run from it.
+ * @param elapsed Milliseconds since the pattern or indicator changed.
+ * @param restart The state changed, every pixel has to be drawn again.
+ */
+void patterns_render(const struct rgbled_light_state* state, uint32_t now, uint32_t elapsed, bool restart);
+
+#endif // PATTERNS_H
@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Frame based renderer for the local LED strip
+ *
+ * A fixed frame clock drives the render thread. Patterns draw linear colors
+ * into a canvas, every changed canvas pixel is marked dirty for both frame
+ * buffers. A frame converts only the dirty pixels of the back buffer through
+ * the gamma and brightness lookup table, outputs it and swaps the buffers.
+ * Frames without a change are not output at all. Pixels from the host
+ * replace the patterns while they keep coming.
+ */
+
+#include "render.h"
+#include "patterns.h"
+#include "ws2812_i2s.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(render, LOG_LEVEL_INF);
+
+#define STRIP_NODE   DT_ALIAS(led_strip)
+#define STRIP_PIXELS DT_PROP(STRIP_NODE, chain_length)
+#define DIRTY_WORDS  DIV_ROUND_UP(STRIP_PIXELS, 32)
+
+#define FRAME_MS (MSEC_PER_SEC / CONFIG_APP_STRIP_FPS)
+
+#if defined(CONFIG_APP_HOST_LIVE_TIMEOUT_MS)
+#define LIVE_TIMEOUT_MS CONFIG_APP_HOST_LIVE_TIMEOUT_MS
+#else
+#define LIVE_TIMEOUT_MS 0
+#endif
+
+#if defined(CONFIG_APP_STRIP_OUTPUT_I2S)
+
+#define FRAME_CLOBBERED false
+
+static int strip_output_init(void)
+{
+    return ws2812_i2s_init();
+}
+
+static int strip_output(const struct led_rgb* frame)
+{
+    return ws2812_i2s_update(frame, STRIP_PIXELS);
+}
+
+#else
+
+/* ws2812-spi encodes into its own buffer, other drivers may pack the
+ * pixels in place, the whole buffer has to be converted again then.
+ */
+#define FRAME_CLOBBERED (!DT_NODE_HAS_COMPAT(STRIP_NODE, worldsemi_ws2812_spi))
+
+static const struct device* const strip = DEVICE_DT_GET(STRIP_NODE);
+
+static int strip_output_init(void)
+{
+    return device_is_ready(strip) ? 0 : -ENODEV;
+}
+
+static int strip_output(struct led_rgb* frame)
+{
+    return led_strip_update_rgb(strip, frame, STRIP_PIXELS);
+}
+
+#endif
+
+/* Gamma 2.2 */
+static const uint8_t gamma_lut[256] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,
+    5,   6,   6,   6,   6,   7,   7,   7,   8,   8,   8,   9,   9,   9,   10,  10,  11,  11,  11,  12,  12,  13,
+    13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,  20,  20,  21,  22,  22,  23,  23,  24,
+    25,  25,  26,  26,  27,  28,  28,  29,  30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,
+    40,  41,  42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,
+    60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,  73,  74,  75,  76,  77,  78,  79,  81,  82,  83,
+    84,  85,  87,  88,  89,  90,  91,  93,  94,  95,  97,  98,  99,  100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135, 137, 138, 140, 141, 143, 145,
+    146, 148, 149, 151, 153, 154, 156, 158, 159, 161, 163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182,
+    184, 186, 188, 190, 192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221, 223, 225,
+    227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+STATS_SECT_START(render_stats)
+STATS_SECT_ENTRY32(frames)
+STATS_SECT_ENTRY32(outputs)
+STATS_SECT_ENTRY32(unchanged)
+STATS_SECT_ENTRY32(missed)
+STATS_SECT_ENTRY32(pixels)
+STATS_SECT_ENTRY32(live_frames)
+STATS_SECT_ENTRY32(output_busy)
+STATS_SECT_ENTRY32(output_errors)
+STATS_SECT_ENTRY32(render_us_last)
+STATS_SECT_ENTRY32(render_us_max)
+STATS_SECT_END;
+
+STATS_NAME_START(render_stats)
+STATS_NAME(render_stats, frames)
+STATS_NAME(render_stats, outputs)
+STATS_NAME(render_stats, unchanged)
+STATS_NAME(render_stats, missed)
+STATS_NAME(render_stats, pixels)
+STATS_NAME(render_stats, live_frames)
+STATS_NAME(render_stats, output_busy)
+STATS_NAME(render_stats, output_errors)
+STATS_NAME(render_stats, render_us_last)
+STATS_NAME(render_stats, render_us_max)
+STATS_NAME_END(render_stats);
+
+static STATS_SECT_DECL(render_stats) render_stats;
+
+/* Gamma followed by brightness */
+static uint8_t out_lut[256];
+
+static struct led_rgb canvas[STRIP_PIXELS];
+static struct led_rgb frames[2][STRIP_PIXELS];
+static uint32_t dirty[2][DIRTY_WORDS];
+static uint8_t back;
+static bool canvas_changed;
+static bool painted;
+
+static struct k_spinlock state_lock;
+static struct rgbled_light_state pending_state;
+static bool pending;
+static struct rgbled_light_state state;
+static uint32_t state_since;
+
+/* Host pixels, under live_mutex */
+K_MUTEX_DEFINE(live_mutex);
+static struct led_rgb live_pixels[STRIP_PIXELS];
+static uint32_t live_until;
+static bool live_pending;
+static bool live;
+
+K_TIMER_DEFINE(frame_timer, NULL, NULL);
+
+static void render_thread(void);
+
+K_THREAD_DEFINE(render_thread_id,
+                CONFIG_APP_STRIP_THREAD_STACK_SIZE,
+                render_thread,
+                NULL,
+                NULL,
+                NULL,
+                CONFIG_APP_STRIP_THREAD_PRIORITY,
+                0,
+                SYS_FOREVER_MS);
+
+uint16_t render_pixel_count(void)
+{
+    return STRIP_PIXELS;
+}
+
+void render_pixel_set(uint16_t index, struct led_rgb color)
+{
+    struct led_rgb* pixel;
+
+    if (index >= STRIP_PIXELS)
+    {
+        return;
+    }
+
+    pixel = &canvas[index];
+    if (pixel->r == color.r && pixel->g == color.g && pixel->b == color.b)
+    {
+        return;
+    }
+
+    *pixel = color;
+    dirty[0][index / 32] |= BIT(index % 32);
+    dirty[1][index / 32] |= BIT(index % 32);
+    canvas_changed = true;
+}
+
+struct led_rgb render_hsv(uint16_t hue, uint8_t sat, uint8_t val)
+{
+    uint8_t sector = (hue / RENDER_HUE_SECTOR) % 6;
+    uint8_t frac = hue % RENDER_HUE_SECTOR;
+    uint8_t p = (val * (255 - sat)) / 255;
+    uint8_t q = (val * (255 - (sat * frac) / 255)) / 255;
+    uint8_t t = (val * (255 - (sat * (255 - frac)) / 255)) / 255;
+
+    switch (sector)
+    {
+    case 0:
+        return (struct led_rgb){ .r = val, .g = t, .b = p };
+    case 1:
+        return (struct led_rgb){ .r = q, .g = val, .b = p };
+    case 2:
+        return (struct led_rgb){ .r = p, .g = val, .b = t };
+    case 3:
+        return (struct led_rgb){ .r = p, .g = q, .b = val };
+    case 4:
+        return (struct led_rgb){ .r = t, .g = p, .b = val };
+    default:
+        return (struct led_rgb){ .r = val, .g = p, .b = q };
+    }
+}
+
+static void lut_build(uint8_t brightness)
+{
+    uint32_t scale = (uint32_t)brightness * CONFIG_APP_STRIP_MAX_BRIGHTNESS / UINT8_MAX;
+
+    for (int i = 0; i < ARRAY_SIZE(out_lut); i++)
+    {
+        out_lut[i] = (gamma_lut[i] * scale) / UINT8_MAX;
+    }
+}
+
+static void dirty_all(uint32_t* mask)
+{
+    memset(mask, 0xff, DIRTY_WORDS * sizeof(uint32_t));
+    if (STRIP_PIXELS % 32)
+    {
+        mask[DIRTY_WORDS - 1] = BIT_MASK(STRIP_PIXELS % 32);
+    }
+}
+
+static void frame_invalidate(void)
+{
+    dirty_all(dirty[0]);
+    dirty_all(dirty[1]);
+    canvas_changed = true;
+}
+
+/* Take over a state update, returns true when the patterns restart */
+static bool state_apply(void)
+{
+    struct rgbled_light_state next;
+    bool restart;
+
+    k_spinlock_key_t key = k_spin_lock(&state_lock);
+
+    if (!pending)
+    {
+        k_spin_unlock(&state_lock, key);
+        return false;
+    }
+
+    next = pending_state;
+    pending = false;
+    k_spin_unlock(&state_lock, key);
+
+    if (next.brightness != state.brightness)
+    {
+        lut_build(next.brightness);
+        frame_invalidate();
+    }
+
+    restart = next.pattern != state.pattern || next.indicator != state.indicator;
+    if (restart)
+    {
+        state_since = k_uptime_get_32();
+    }
+
+    state = next;
+
+    return restart;
+}
+
+/* Take over host pixels, returns true while the host drives the strip */
+static bool live_apply(uint32_t now)
+{
+    bool active;
+
+    k_mutex_lock(&live_mutex, K_FOREVER);
+
+    active = live_pending || (int32_t)(live_until - now) > 0;
+    if (live_pending)
+    {
+        for (int i = 0; i < STRIP_PIXELS; i++)
+        {
+            render_pixel_set(i, live_pixels[i]);
+        }
+        live_pending = false;
+        STATS_INC(render_stats, live_frames);
+    }
+
+    k_mutex_unlock(&live_mutex);
+
+    return active;
+}
+
+static uint32_t frame_convert(struct led_rgb* frame, uint32_t* mask)
+{
+    uint32_t converted = 0;
+
+    for (int w = 0; w < DIRTY_WORDS; w++)
+    {
+        uint32_t bits = mask[w];
+
+        mask[w] = 0;
+        while (bits)
+        {
+            uint32_t i = w * 32 + __builtin_ctz(bits);
+
+            bits &= bits - 1;
+            frame[i].r = out_lut[canvas[i].r];
+            frame[i].g = out_lut[canvas[i].g];
+            frame[i].b = out_lut[canvas[i].b];
+            converted++;
+        }
+    }
+
+    return converted;
+}
+
+static void render_frame(void)
+{
+    uint32_t start = k_cycle_get_32();
+    uint32_t now = k_uptime_get_32();
+    bool restart = state_apply() || !painted;
+    uint32_t us;
+    int err;
+
+    STATS_INC(render_stats, frames);
+
+    if (live_apply(now))
+    {
+        live = true;
+    }
+    else
+    {
+        /* The patterns draw every pixel again after the host let go */
+        patterns_render(&state, now, now - state_since, restart || live);
+        live = false;
+        painted = true;
+    }
+
+    if (!canvas_changed)
+    {
+        STATS_INC(render_stats, unchanged);
+        return;
+    }
+
+    canvas_changed = false;
+    STATS_INCN(render_stats, pixels, frame_convert(frames[back], dirty[back]));
+
+    err = strip_output(frames[back]);
+    if (err == -EBUSY)
+    {
+        /* Keep the converted frame in the back buffer and output it again */
+        STATS_INC(render_stats, output_busy);
+        canvas_changed = true;
+        return;
+    }
+    else if (err)
+    {
+        STATS_INC(render_stats, output_errors);
+    }
+    else
+    {
+        STATS_INC(render_stats, outputs);
+    }
+
+    if (FRAME_CLOBBERED)
+    {
+        dirty_all(dirty[back]);
+    }
+
+    back ^= 1;
+
+    us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    STATS_SET(render_stats, render_us_last, us);
+    if (us > render_stats.render_us_max)
+    {
+        STATS_SET(render_stats, render_us_max, us);
+    }
+}
+
+static void render_thread(void)
+{
+    uint32_t ticks;
+
+    k_timer_start(&frame_timer, K_MSEC(FRAME_MS), K_MSEC(FRAME_MS));
+
+    while (1)
+    {
+        ticks = k_timer_status_sync(&frame_timer);
+        if (ticks > 1)
+        {
+            STATS_INCN(render_stats, missed, ticks - 1);
+        }
+
+        render_frame();
+    }
+}
+
+void render_live(uint16_t first, const uint8_t* rgb, uint16_t count)
+{
+    if (first >= STRIP_PIXELS)
+    {
+        return;
+    }
+
+    count = MIN(count, STRIP_PIXELS - first);
+
+    k_mutex_lock(&live_mutex, K_FOREVER);
+    for (uint16_t i = 0; i < count; i++, rgb += 3)
+    {
+        live_pixels[first + i] = (struct led_rgb){ .r = rgb[0], .g = rgb[1], .b = rgb[2] };
+    }
+    live_until = k_uptime_get_32() + LIVE_TIMEOUT_MS;
+    live_pending = true;
+    k_mutex_unlock(&live_mutex);
+}
+
+void render_update(const struct rgbled_light_state* next)
+{
+    k_spinlock_key_t key = k_spin_lock(&state_lock);
+
+    pending_state = *next;
+    pending = true;
+    k_spin_unlock(&state_lock, key);
+}
+
+int render_init(void)
+{
+    int err = strip_output_init();
+
+    if (err)
+    {
+        LOG_ERR("LED strip not ready (err %d)", err);
+        return err;
+    }
+
+    state.version = RGBLED_LIGHT_STATE_VERSION;
+    state.indicator = INDICATOR_OFF;
+    state.brightness = UINT8_MAX;
+    state_since = k_uptime_get_32();
+    lut_build(state.brightness);
+    frame_invalidate();
+
+    STATS_INIT_AND_REG(render_stats, STATS_SIZE_32, "render");
+
+    k_thread_start(render_thread_id);
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "rgbled_service.h"
+#include <zephyr/drivers/led_strip.h>
+
+/* Hue is 0..RENDER_HUE_MAX-1, six sectors of 256 steps */
+#define RENDER_HUE_SECTOR 256U
+#define RENDER_HUE_MAX    (6U * RENDER_HUE_SECTOR)
+
+/** @brief Start the frame clock of the local strip. */
+int render_init(void);
+
+/** @brief Render a new light state from the next frame on. Does not block. */
+void render_update(const struct rgbled_light_state* state);
+
+/**
+ * @brief Show pixels set by the host instead of the patterns.
+ *
+ * Sets @p count pixels from @p first on from r, g, b triplets in @p rgb,
+ * the other pixels keep their live color. The patterns take over again
+ * CONFIG_APP_HOST_LIVE_TIMEOUT_MS after the last call.
+ */
+void render_live(uint16_t first, const uint8_t* rgb, uint16_t count);
+
+/*
+ * Pattern interface. Patterns draw linear colors into the canvas, gamma and
+ * brightness are applied by the engine. Only pixels whose color changes are
+ * converted and output again.
+ */
+
+/** @brief Number of pixels of the strip. */
+uint16_t render_pixel_count(void);
+
+/** @brief Set a canvas pixel, a no-op if the color does not change. */
+void render_pixel_set(uint16_t index, struct led_rgb color);
+
+/** @brief Fixed point HSV to RGB, @p hue in 0..RENDER_HUE_MAX-1. */
+struct led_rgb render_hsv(uint16_t hue, uint8_t sat, uint8_t val);
+
+#endif // RENDER_H
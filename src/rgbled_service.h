@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef RGBLED_SERVICE_H
+#define RGBLED_SERVICE_H
+
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/types.h>
+
+/** @brief RGBLED Service UUID */
+#define BT_UUID_RGBLED_CTRL_SERVICE_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4)
+#define BT_UUID_RGBLED_SERVICE_VAL      BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef0)
+
+// f0debc9a7856 3412 7856 3412 78563412 0106
+
+/** @brief RGBLED Pattern Characteristic UUID */
+#define BT_UUID_RGBLED_PATTERN_CHAR_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef1)
+
+/** @brief RGBLED Indicator Characteristic UUID */
+#define BT_UUID_RGBLED_INDICATOR_CHAR_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef2)
+
+/** @brief RGBLED packed Light State Characteristic UUID */
+#define BT_UUID_RGBLED_STATE_CHAR_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef3)
+
+#define BT_UUID_RGBLED_SERVICE        BT_UUID_DECLARE_128(BT_UUID_RGBLED_SERVICE_VAL)
+#define BT_UUID_RGBLED_PATTERN_CHAR   BT_UUID_DECLARE_128(BT_UUID_RGBLED_PATTERN_CHAR_VAL)
+#define BT_UUID_RGBLED_INDICATOR_CHAR BT_UUID_DECLARE_128(BT_UUID_RGBLED_INDICATOR_CHAR_VAL)
+#define BT_UUID_RGBLED_STATE_CHAR     BT_UUID_DECLARE_128(BT_UUID_RGBLED_STATE_CHAR_VAL)
+
+#define INDICATOR_LEFT   0U
+#define INDICATOR_RIGHT  1U
+#define INDICATOR_OFF    2U
+#define INDICATOR_HAZARD 3U
+
+#define RGBLED_PATTERN_COUNT 3U
+
+#define RGBLED_LIGHT_STATE_VERSION 1U
+
+/**
+ * @brief Light state as carried by the light state characteristic.
+ *
+ * The state is absolute: every write carries the full pattern, indicator and
+ * brightness, so a lost write is repaired by the next one. @p seq is
+ * incremented for every state change and lets the light drop stale or
+ * duplicated writes. Multi-byte fields are little endian.
+ */
+struct rgbled_light_state
+{
+    uint8_t version;
+    uint16_t seq;
+    uint8_t pattern;
+    uint8_t indicator;
+    uint8_t brightness;
+} __packed;
+
+#endif // RGBLED_SERVICE_H
@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Streamed light show playback from the file system
+ *
+ * A reader thread keeps CONFIG_APP_SHOW_READAHEAD compressed frame records
+ * ahead of the render thread in a ring of slots. Only the slots and the
+ * decoded frame are in RAM, whatever the length of the show. The reader
+ * runs as soon as a slot is free, so flash reads happen frames before their
+ * deadline. The render thread decodes the records that are due, a frame
+ * that is not there yet is an underrun. When playback falls further behind
+ * than the read-ahead, the reader skips to the next key frame.
+ *
+ * Sessions: show_start() and show_stop() bump the session and empty the
+ * ring. A record read for an older session is dropped on commit.
+ */
+
+#include "show.h"
+#include "render.h"
+#include <string.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(show, LOG_LEVEL_INF);
+
+#define STRIP_PIXELS DT_PROP(DT_ALIAS(led_strip), chain_length)
+#define RECORD_MAX   (1 + 3 * STRIP_PIXELS)
+#define SLOTS        CONFIG_APP_SHOW_READAHEAD
+
+struct show_slot
+{
+    /* Absolute frame number, counts on over loops */
+    uint32_t frame;
+    uint16_t len;
+    uint8_t data[RECORD_MAX];
+};
+
+struct show_info
+{
+    uint16_t pixels;
+    uint16_t frame_ms;
+    uint32_t frames;
+};
+
+STATS_SECT_START(show_stats)
+STATS_SECT_ENTRY32(frames)
+STATS_SECT_ENTRY32(underruns)
+STATS_SECT_ENTRY32(resyncs)
+STATS_SECT_ENTRY32(read_errors)
+STATS_SECT_ENTRY32(decode_errors)
+STATS_SECT_ENTRY32(read_us_max)
+STATS_SECT_END;
+
+STATS_NAME_START(show_stats)
+STATS_NAME(show_stats, frames)
+STATS_NAME(show_stats, underruns)
+STATS_NAME(show_stats, resyncs)
+STATS_NAME(show_stats, read_errors)
+STATS_NAME(show_stats, decode_errors)
+STATS_NAME(show_stats, read_us_max)
+STATS_NAME_END(show_stats);
+
+static STATS_SECT_DECL(show_stats) show_stats;
+
+/* Shared between the threads, under lock */
+static struct k_spinlock lock;
+static struct show_slot slots[SLOTS];
+static uint8_t head;
+static uint8_t tail;
+static uint8_t used;
+static uint32_t session;
+static char request_path[MAX_FILE_NAME + 1];
+static uint32_t request_frame;
+static struct show_info info;
+static bool info_valid;
+
+/* Render thread only */
+static struct led_rgb pixels[STRIP_PIXELS];
+static bool synced;
+static bool started;
+static uint32_t position;
+static uint32_t base_frame;
+static uint32_t since;
+
+static K_SEM_DEFINE(reader_sem, 0, 1);
+
+static void reader_thread(void);
+
+K_THREAD_DEFINE(show_reader_id,
+                CONFIG_APP_SHOW_THREAD_STACK_SIZE,
+                reader_thread,
+                NULL,
+                NULL,
+                NULL,
+                CONFIG_APP_SHOW_THREAD_PRIORITY,
+                0,
+                0);
+
+static int index_read(struct fs_file_t* file, uint32_t frame, uint32_t* entry)
+{
+    uint32_t le;
+    ssize_t len;
+    int err;
+
+    err = fs_seek(file, sizeof(struct show_header) + frame * sizeof(le), FS_SEEK_SET);
+    if (err)
+    {
+        return err;
+    }
+
+    len = fs_read(file, &le, sizeof(le));
+    if (len != sizeof(le))
+    {
+        return len < 0 ? len : -EIO;
+    }
+
+    *entry = sys_le32_to_cpu(le);
+
+    return 0;
+}
+
+static int reader_open(struct fs_file_t* file, const char* path, struct show_info* show)
+{
+    struct show_header header;
+    uint32_t entry;
+    ssize_t len;
+    int err;
+
+    err = fs_open(file, path, FS_O_READ);
+    if (err)
+    {
+        return err;
+    }
+
+    len = fs_read(file, &header, sizeof(header));
+    if (len != sizeof(header) || sys_le16_to_cpu(header.magic) != SHOW_MAGIC || header.version != SHOW_VERSION)
+    {
+        err = -EINVAL;
+        goto close;
+    }
+
+    show->pixels = sys_le16_to_cpu(header.pixels);
+    show->frame_ms = sys_le16_to_cpu(header.frame_ms);
+    show->frames = sys_le32_to_cpu(header.frames);
+
+    if (show->pixels == 0 || show->pixels > STRIP_PIXELS || show->frame_ms == 0 || show->frames == 0)
+    {
+        err = -EINVAL;
+        goto close;
+    }
+
+    err = index_read(file, 0, &entry);
+    if (!err && !(entry & SHOW_INDEX_KEY))
+    {
+        err = -EINVAL;
+    }
+
+close:
+    if (err)
+    {
+        fs_close(file);
+    }
+
+    return err;
+}
+
+/* First key frame at or after @p frame, wrapping to the start of the show */
+static int reader_key_find(struct fs_file_t* file, const struct show_info* show, uint32_t* frame)
+{
+    uint32_t entry;
+    int err;
+
+    for (uint32_t i = 0; i < show->frames; i++)
+    {
+        err = index_read(file, (*frame + i) % show->frames, &entry);
+        if (err)
+        {
+            return err;
+        }
+
+        if (entry & SHOW_INDEX_KEY)
+        {
+            *frame += i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static int reader_fetch(struct fs_file_t* file, const struct show_info* show, uint32_t frame, struct show_slot* slot)
+{
+    uint32_t start = k_cycle_get_32();
+    uint32_t offset;
+    uint32_t end;
+    uint32_t us;
+    ssize_t len;
+    int err;
+
+    err = index_read(file, frame % show->frames, &offset);
+    if (!err)
+    {
+        err = index_read(file, frame % show->frames + 1, &end);
+    }
+    if (err)
+    {
+        return err;
+    }
+
+    offset &= ~SHOW_INDEX_KEY;
+    end &= ~SHOW_INDEX_KEY;
+    if (end <= offset || end - offset > RECORD_MAX)
+    {
+        return -EINVAL;
+    }
+
+    err = fs_seek(file, offset, FS_SEEK_SET);
+    if (err)
+    {
+        return err;
+    }
+
+    len = fs_read(file, slot->data, end - offset);
+    if (len != end - offset)
+    {
+        return len < 0 ? len : -EIO;
+    }
+
+    slot->frame = frame;
+    slot->len = len;
+
+    us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    if (us > show_stats.read_us_max)
+    {
+        STATS_SET(show_stats, read_us_max, us);
+    }
+
+    return 0;
+}
+
+static void reader_thread(void)
+{
+    struct fs_file_t file;
+    struct show_info show;
+    uint32_t current = 0;
+    uint32_t next = 0;
+    bool open = false;
+    char path[sizeof(request_path)];
+    struct show_slot* slot;
+    k_spinlock_key_t key;
+    int err;
+
+    fs_file_t_init(&file);
+    STATS_INIT_AND_REG(show_stats, STATS_SIZE_32, "show");
+
+    while (1)
+    {
+        key = k_spin_lock(&lock);
+
+        if (current != session)
+        {
+            current = session;
+            strcpy(path, request_path);
+            next = request_frame;
+            k_spin_unlock(&lock, key);
+
+            if (open)
+            {
+                fs_close(&file);
+                open = false;
+            }
+
+            if (path[0] == '\0')
+            {
+                continue;
+            }
+
+            err = reader_open(&file, path, &show);
+            if (!err)
+            {
+                open = true;
+                err = reader_key_find(&file, &show, &next);
+            }
+
+            if (err)
+            {
+                LOG_WRN("Cannot play %s (err %d)", path, err);
+                STATS_INC(show_stats, read_errors);
+                continue;
+            }
+
+            key = k_spin_lock(&lock);
+            if (current == session)
+            {
+                info = show;
+                info_valid = true;
+            }
+            k_spin_unlock(&lock, key);
+            continue;
+        }
+
+        if (!open || used == SLOTS)
+        {
+            k_spin_unlock(&lock, key);
+            k_sem_take(&reader_sem, K_FOREVER);
+            continue;
+        }
+
+        /* The slot at head is not visible to the render thread until committed */
+        slot = &slots[head];
+        k_spin_unlock(&lock, key);
+
+        err = reader_fetch(&file, &show, next, slot);
+        if (err)
+        {
+            LOG_WRN("Frame %u not read (err %d)", next % show.frames, err);
+            STATS_INC(show_stats, read_errors);
+            fs_close(&file);
+            open = false;
+            continue;
+        }
+
+        key = k_spin_lock(&lock);
+        if (current == session)
+        {
+            head = (head + 1) % SLOTS;
+            used++;
+            next++;
+        }
+        k_spin_unlock(&lock, key);
+    }
+}
+
+static void session_restart(const char* path, uint32_t frame)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    session++;
+    head = 0;
+    tail = 0;
+    used = 0;
+    info_valid = false;
+    strncpy(request_path, path, sizeof(request_path) - 1);
+    request_frame = frame;
+    k_spin_unlock(&lock, key);
+
+    synced = false;
+    started = false;
+    k_sem_give(&reader_sem);
+}
+
+void show_start(const char* path)
+{
+    memset(pixels, 0, sizeof(pixels));
+    session_restart(path, 0);
+}
+
+void show_stop(void)
+{
+    session_restart("", 0);
+}
+
+static int frame_decode(const struct show_slot* slot, uint16_t count)
+{
+    const uint8_t* p = &slot->data[1];
+    const uint8_t* end = &slot->data[slot->len];
+    uint16_t i = 0;
+
+    switch (slot->data[0])
+    {
+    case SHOW_FRAME_RAW:
+        if (end - p != 3 * count)
+        {
+            return -EINVAL;
+        }
+
+        for (; i < count; i++, p += 3)
+        {
+            pixels[i] = (struct led_rgb){ .r = p[0], .g = p[1], .b = p[2] };
+        }
+        return 0;
+    case SHOW_FRAME_RLE:
+        for (; end - p >= 4; p += 4)
+        {
+            if (p[0] == 0 || i + p[0] > count)
+            {
+                return -EINVAL;
+            }
+
+            for (uint8_t n = 0; n < p[0]; n++)
+            {
+                pixels[i++] = (struct led_rgb){ .r = p[1], .g = p[2], .b = p[3] };
+            }
+        }
+        return p == end && i == count ? 0 : -EINVAL;
+    case SHOW_FRAME_DELTA:
+        for (; end - p >= 5; p += 5)
+        {
+            i += p[0];
+            if (i + p[1] > count)
+            {
+                return -EINVAL;
+            }
+
+            for (uint8_t n = 0; n < p[1]; n++)
+            {
+                pixels[i++] = (struct led_rgb){ .r = p[2], .g = p[3], .b = p[4] };
+            }
+        }
+        return p == end ? 0 : -EINVAL;
+    default:
+        return -EINVAL;
+    }
+}
+
+void show_render(uint32_t now, bool restart, uint16_t from, uint16_t to)
+{
+    struct show_info show;
+    struct show_slot* slot;
+    bool decoded = false;
+    uint32_t due = 0;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&lock);
+    show = info;
+    if (!info_valid)
+    {
+        k_spin_unlock(&lock, key);
+        goto draw;
+    }
+    k_spin_unlock(&lock, key);
+
+    if (started)
+    {
+        due = base_frame + (now - since) / show.frame_ms;
+    }
+
+    while (1)
+    {
+        key = k_spin_lock(&lock);
+        if (!used)
+        {
+            k_spin_unlock(&lock, key);
+            break;
+        }
+        /* The reader does not touch committed slots */
+        slot = &slots[tail];
+        k_spin_unlock(&lock, key);
+
+        if (!synced)
+        {
+            position = slot->frame;
+            synced = true;
+        }
+
+        if (started && position > due)
+        {
+            break;
+        }
+
+        if (slot->frame != position || frame_decode(slot, show.pixels))
+        {
+            STATS_INC(show_stats, decode_errors);
+        }
+        else
+        {
+            STATS_INC(show_stats, frames);
+            decoded = true;
+        }
+
+        if (!started)
+        {
+            started = true;
+            base_frame = position;
+            since = now;
+            due = position;
+        }
+
+        position++;
+
+        key = k_spin_lock(&lock);
+        tail = (tail + 1) % SLOTS;
+        used--;
+        k_spin_unlock(&lock, key);
+        k_sem_give(&reader_sem);
+    }
+
+    if (started && position <= due)
+    {
+        STATS_INC(show_stats, underruns);
+
+        if (due - position >= SLOTS)
+        {
+            /* Too far behind to catch up frame by frame */
+            char path[sizeof(request_path)];
+
+            key = k_spin_lock(&lock);
+            strcpy(path, request_path);
+            k_spin_unlock(&lock, key);
+
+            STATS_INC(show_stats, resyncs);
+            session_restart(path, due + SLOTS);
+        }
+    }
+
+draw:
+    if (decoded || restart)
+    {
+        for (uint16_t i = from; i < to && i < STRIP_PIXELS; i++)
+        {
+            render_pixel_set(i, pixels[i]);
+        }
+    }
+}
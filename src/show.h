@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/*
+ * Pre-rendered light show file. All values are little endian.
+ *
+ *   header
+ *   index: (frames + 1) * u32 file offset of the frame record, the last one
+ *          is the end of the file. SHOW_INDEX_KEY marks frames that do not
+ *          depend on the previous one, the first frame must be one.
+ *   frame records: type (u8) followed by the payload
+ *     SHOW_FRAME_RAW:   pixels * { r, g, b }
+ *     SHOW_FRAME_RLE:   { run (u8, >= 1), r, g, b } covering every pixel
+ *     SHOW_FRAME_DELTA: { skip (u8), run (u8), r, g, b }, pixels that are not
+ *                       covered keep the color of the previous frame
+ *
+ * Shows loop from the last frame back to the first one.
+ */
+#define SHOW_MAGIC     0x534c /* "LS" */
+#define SHOW_VERSION   1U
+#define SHOW_INDEX_KEY 0x80000000U
+
+struct show_header
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t pixels;
+    uint16_t frame_ms;
+    uint32_t frames;
+} __packed;
+
+enum show_frame_type
+{
+    SHOW_FRAME_RAW,
+    SHOW_FRAME_RLE,
+    SHOW_FRAME_DELTA,
+};
+
+/**
+ * @brief Start playing a show file from its first frame.
+ *
+ * The file is opened and read ahead by the show reader thread, the strip
+ * keeps its pixels until the first frame arrives. Render thread only.
+ */
+void show_start(const char* path);
+
+/** @brief Stop reading the current show and close its file. Render thread only. */
+void show_stop(void);
+
+/**
+ * @brief Draw the frame of the show that is due at @p now over [from, to).
+ *
+ * Frames that did not arrive in time are counted as underruns in the "show"
+ * stats group, the last frame stays on the strip then.
+ */
+void show_render(uint32_t now, bool restart, uint16_t from, uint16_t to);
+
+#endif // SHOW_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Binary trace of hot path events, drained to the host
+ *
+ * trace_point() reserves a slot of the ring by moving the head with a
+ * compare and swap, fills it and writes the event last, which commits the
+ * slot. No lock is taken, ISRs and threads record concurrently. When the
+ * ring is full the record is dropped and counted.
+ *
+ * The first record into an empty ring schedules the drain on the system
+ * workqueue after CONFIG_APP_TRACE_FLUSH_MS, so a burst of events leaves in
+ * few frames. The drain copies committed slots into the batch, frees them
+ * and defers the batch to the protocol thread as a HOST_MSG_TRACE message,
+ * one batch at a time. scripts/trace_decode.py turns the messages into a
+ * timeline.
+ */
+
+#include "trace.h"
+#include "host_proto.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/util.h>
+
+#define RECORDS CONFIG_APP_TRACE_RECORDS
+
+BUILD_ASSERT(IS_POWER_OF_TWO(RECORDS), "CONFIG_APP_TRACE_RECORDS must be a power of two");
+
+/* Records that fit in one frame after type, seq and the batch header */
+#define BATCH_MAX ((CONFIG_APP_HOST_FRAME_MAX - 2 - sizeof(struct host_trace)) / sizeof(struct trace_record))
+
+BUILD_ASSERT(BATCH_MAX > 0, "CONFIG_APP_HOST_FRAME_MAX is too small for a trace batch");
+
+static struct trace_record ring[RECORDS];
+
+/* Free running, the slot is the index modulo RECORDS */
+static atomic_t head;
+static atomic_t tail;
+static atomic_t dropped;
+static atomic_t in_flight;
+
+static struct
+{
+    struct host_trace head;
+    struct trace_record records[BATCH_MAX];
+} __packed batch;
+
+static struct host_deferred batch_msg;
+
+static void drain(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(drain_work, drain);
+
+void trace_point(enum trace_event event, uint8_t a, uint16_t b)
+{
+    struct trace_record* rec;
+    atomic_val_t slot;
+
+    do
+    {
+        slot = atomic_get(&head);
+        if ((atomic_val_t)(slot - atomic_get(&tail)) >= RECORDS)
+        {
+            atomic_inc(&dropped);
+            return;
+        }
+    } while (!atomic_cas(&head, slot, slot + 1));
+
+    rec = &ring[slot & (RECORDS - 1)];
+    rec->cycles = k_cycle_get_32();
+    rec->a = a;
+    rec->b = b;
+
+    /* The drain takes the slot once the event is set */
+    barrier_dmem_fence_full();
+    rec->event = event;
+
+    if (slot == atomic_get(&tail))
+    {
+        k_work_schedule(&drain_work, K_MSEC(CONFIG_APP_TRACE_FLUSH_MS));
+    }
+}
+
+static void batch_release(struct host_deferred* msg)
+{
+    atomic_clear(&in_flight);
+
+    if (atomic_get(&head) != atomic_get(&tail))
+    {
+        k_work_schedule(&drain_work, K_NO_WAIT);
+    }
+}
+
+static void drain(struct k_work* work)
+{
+    static uint8_t seq;
+    atomic_val_t pos = atomic_get(&tail);
+    atomic_val_t end = atomic_get(&head);
+    size_t count = 0;
+
+    /* batch_release() drains the rest */
+    if (!atomic_cas(&in_flight, 0, 1))
+    {
+        return;
+    }
+
+    while (pos != end && count < BATCH_MAX)
+    {
+        struct trace_record* rec = &ring[pos & (RECORDS - 1)];
+
+        /* Reserved, but the recording context did not commit it yet */
+        if (rec->event == TRACE_NONE)
+        {
+            k_work_schedule(&drain_work, K_MSEC(CONFIG_APP_TRACE_FLUSH_MS));
+            break;
+        }
+
+        batch.records[count++] = *rec;
+        rec->event = TRACE_NONE;
+        pos++;
+    }
+
+    /* Slots are free for trace_point() only after they were cleared */
+    barrier_dmem_fence_full();
+    atomic_set(&tail, pos);
+
+    if (!count)
+    {
+        atomic_clear(&in_flight);
+        return;
+    }
+
+    batch.head.cycles_per_sec = sys_clock_hw_cycles_per_sec();
+    batch.head.dropped = atomic_get(&dropped);
+
+    batch_msg = (struct host_deferred){
+        .type = HOST_MSG_TRACE,
+        .seq = ++seq,
+        .body = &batch,
+        .len = sizeof(batch.head) + count * sizeof(struct trace_record),
+        .release = batch_release,
+    };
+
+    host_proto_defer(&batch_msg);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/**
+ * @brief Hot path events, with the meaning of their arguments.
+ *
+ * New events go at the end, scripts/trace_decode.py knows them by number.
+ */
+enum trace_event
+{
+    /* Free slot, never recorded */
+    TRACE_NONE,
+    /* a: GPIO port, b: pin of the edge */
+    TRACE_BUTTON_ISR,
+    /* a: button code, b: 1 pressed, 0 released */
+    TRACE_DEBOUNCED,
+    /* a: enum button_evt, b: code, as delivered to main */
+    TRACE_BUTTON_EVENT,
+    /* a: light | cmd << 4, b: sequence number of the state */
+    TRACE_WRITE_SUBMIT,
+    /* a: light | cmd << 4, b: ATT error, 0 acknowledged or sent */
+    TRACE_WRITE_DONE,
+    /* a: light | cmd << 4, b: sequence number, the light already shows it */
+    TRACE_WRITE_SKIP,
+    /* a: light, 0xff if it failed or no link was free, b: HCI error */
+    TRACE_CONNECT,
+    /* a: light, b: HCI reason */
+    TRACE_DISCONNECT,
+    /* a: advertising PDU type, b: RSSI as int8_t */
+    TRACE_SCAN_REPORT,
+};
+
+/** @brief Fixed size record, as sent to the host. */
+struct trace_record
+{
+    /* Hardware cycles, the host message carries the frequency */
+    uint32_t cycles;
+    uint8_t event;
+    uint8_t a;
+    uint16_t b;
+} __packed;
+
+#if defined(CONFIG_APP_TRACE)
+
+/**
+ * @brief Record an event. Lock-free, can be called from ISRs.
+ *
+ * Records are dropped and counted while the buffer is full.
+ */
+void trace_point(enum trace_event event, uint8_t a, uint16_t b);
+
+#else
+
+static inline void trace_point(enum trace_event event, uint8_t a, uint16_t b)
+{
+}
+
+#endif
+
+#endif // TRACE_H
@@ -6,43 +6,76 @@
 
 /**
  * @file
- * @brief Sample echo app for CDC ACM class
+ * @brief Byte stream over the USB CDC ACM port
  *
- * Sample app for USB CDC ACM class driver. The received data is echoed back
- * to the serial port.
+ * The interrupt handler reads the FIFO straight into claimed space of the
+ * receive ring buffer and fills the FIFO straight from claimed data of the
+ * transmit ring buffer, nothing is copied in between. Bytes the FIFO did not
+ * take stay in the transmit buffer. When the receive buffer is full,
+ * reception is throttled until the reader made room, the host then backs
+ * off through USB flow control. The reader consumes the received bytes in
+ * place as well.
+ *
+ * Bring-up runs from SYS_INIT and the system workqueue, no thread waits for
+ * the host to open the port.
  */
 
-#include <stdio.h>
-#include <string.h>
+#include "usb_uart.h"
+#include <errno.h>
 #include <zephyr/device.h>
-#include <zephyr/drivers/gpio.h>
-#include <zephyr/drivers/led_strip.h>
-#include <zephyr/drivers/spi.h>
 #include <zephyr/drivers/uart.h>
+#include <zephyr/init.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/stats/stats.h>
 #include <zephyr/sys/ring_buffer.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/usb/usb_device.h>
-#include <zephyr/usb/usbd.h>
 
-#define STACK_SIZE      1024
-#define THREAD_PRIORITY 5
+/* DTR is polled until the host opens the port */
+#define DTR_POLL_MS 100
+
+/* Time for the host to do all settings after raising DTR */
+#define HOST_SETUP_MS 100
+
+LOG_MODULE_REGISTER(usb_uart, LOG_LEVEL_INF);
 
-LOG_MODULE_REGISTER(cdc_acm_echo, LOG_LEVEL_INF);
+#define RX_BUF_SIZE CONFIG_APP_USB_RX_BUF_SIZE
+#define TX_BUF_SIZE CONFIG_APP_USB_TX_BUF_SIZE
 
-#define ZEPHYR_USER_NODE DT_PATH(zephyr_user)
+RING_BUF_DECLARE(rx_ringbuf, RX_BUF_SIZE);
+RING_BUF_DECLARE(tx_ringbuf, TX_BUF_SIZE);
 
-#define RING_BUF_SIZE 1024
-uint8_t ring_buffer[RING_BUF_SIZE];
+/* Updated from the ISR, except the tx drops */
+STATS_SECT_START(usb_stats)
+STATS_SECT_ENTRY32(rx_bytes)
+STATS_SECT_ENTRY32(tx_bytes)
+STATS_SECT_ENTRY32(rx_throttles)
+STATS_SECT_ENTRY32(rx_errors)
+STATS_SECT_ENTRY32(tx_drops)
+STATS_SECT_ENTRY32(irqs)
+STATS_SECT_END;
 
-struct ring_buf ringbuf;
+STATS_NAME_START(usb_stats)
+STATS_NAME(usb_stats, rx_bytes)
+STATS_NAME(usb_stats, tx_bytes)
+STATS_NAME(usb_stats, rx_throttles)
+STATS_NAME(usb_stats, rx_errors)
+STATS_NAME(usb_stats, tx_drops)
+STATS_NAME(usb_stats, irqs)
+STATS_NAME_END(usb_stats);
+
+static STATS_SECT_DECL(usb_stats) usb_stats;
 
 static bool rx_throttled;
+static bool host_open;
+static usb_uart_rx_cb_t rx_cb;
 
-const struct device* const uart_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
+/* Writers take turns, the ISR signals room in the transmit buffer */
+static K_MUTEX_DEFINE(tx_mutex);
+static K_SEM_DEFINE(tx_space_sem, 0, 1);
 
-void ble_thread(void);
+const struct device* const uart_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
 
 static inline void print_baudrate(const struct device* dev)
 {
@@ -64,136 +97,209 @@ static void interrupt_handler(const struct device* dev, void* user_data)
 {
     ARG_UNUSED(user_data);
 
+    STATS_INC(usb_stats, irqs);
+
     while (uart_irq_update(dev) && uart_irq_is_pending(dev))
     {
         if (!rx_throttled && uart_irq_rx_ready(dev))
         {
-            int recv_len, rb_len;
-            uint8_t buffer[64];
-            size_t len = MIN(ring_buf_space_get(&ringbuf), sizeof(buffer));
+            uint8_t* data;
+            uint32_t space = ring_buf_put_claim(&rx_ringbuf, &data, RX_BUF_SIZE);
+            int recv_len;
 
-            if (len == 0)
+            if (space == 0)
             {
                 /* Throttle because ring buffer is full */
                 uart_irq_rx_disable(dev);
                 rx_throttled = true;
+                STATS_INC(usb_stats, rx_throttles);
                 continue;
             }
 
-            recv_len = uart_fifo_read(dev, buffer, len);
+            recv_len = uart_fifo_read(dev, data, space);
             if (recv_len < 0)
             {
-                LOG_ERR("Failed to read UART FIFO");
+                STATS_INC(usb_stats, rx_errors);
                 recv_len = 0;
-            };
-
-            rb_len = ring_buf_put(&ringbuf, buffer, recv_len);
-            if (rb_len < recv_len)
-            {
-                LOG_ERR("Drop %u bytes", recv_len - rb_len);
             }
 
-            LOG_DBG("tty fifo -> ringbuf %d bytes", rb_len);
-            if (rb_len)
+            ring_buf_put_finish(&rx_ringbuf, recv_len);
+            STATS_INCN(usb_stats, rx_bytes, recv_len);
+
+            if (recv_len && rx_cb)
             {
-                uart_irq_tx_enable(dev);
+                rx_cb();
             }
         }
 
         if (uart_irq_tx_ready(dev))
         {
-            uint8_t buffer[64];
-            int rb_len, send_len;
+            uint8_t* data;
+            uint32_t len = ring_buf_get_claim(&tx_ringbuf, &data, TX_BUF_SIZE);
+            int send_len;
 
-            rb_len = ring_buf_get(&ringbuf, buffer, sizeof(buffer));
-            if (!rb_len)
+            if (!len)
             {
-                LOG_DBG("Ring buffer empty, disable TX IRQ");
                 uart_irq_tx_disable(dev);
                 continue;
             }
 
-            if (rx_throttled)
-            {
-                uart_irq_rx_enable(dev);
-                rx_throttled = false;
-            }
+            send_len = uart_fifo_fill(dev, data, len);
+            ring_buf_get_finish(&tx_ringbuf, MAX(send_len, 0));
+            STATS_INCN(usb_stats, tx_bytes, MAX(send_len, 0));
 
-            send_len = uart_fifo_fill(dev, buffer, rb_len);
-            if (send_len < rb_len)
+            if (send_len > 0)
             {
-                LOG_ERR("Drop %d bytes", rb_len - send_len);
+                k_sem_give(&tx_space_sem);
             }
-
-            LOG_DBG("ringbuf -> tty fifo %d bytes", send_len);
         }
     }
 }
 
-int uart_thread(void)
+void usb_uart_rx_callback_set(usb_uart_rx_cb_t cb)
 {
-    int ret;
+    rx_cb = cb;
+}
 
-    if (!device_is_ready(uart_dev))
+size_t usb_uart_read_claim(const uint8_t** data)
+{
+    return ring_buf_get_claim(&rx_ringbuf, (uint8_t**)data, RX_BUF_SIZE);
+}
+
+void usb_uart_read_finish(size_t len)
+{
+    ring_buf_get_finish(&rx_ringbuf, len);
+
+    if (len && rx_throttled)
     {
-        LOG_ERR("CDC ACM device not ready");
-        return 0;
+        rx_throttled = false;
+        uart_irq_rx_enable(uart_dev);
     }
+}
 
-    ret = usb_enable(NULL);
+size_t usb_uart_rx_space(void)
+{
+    return ring_buf_space_get(&rx_ringbuf);
+}
 
-    if (ret != 0)
+int usb_uart_write(const uint8_t* buf, size_t len, k_timeout_t timeout)
+{
+    k_timepoint_t end = sys_timepoint_calc(timeout);
+    int err = 0;
+
+    if (!host_open)
     {
-        LOG_ERR("Failed to enable USB");
-        return 0;
+        STATS_INCN(usb_stats, tx_drops, len);
+        return -ENOTCONN;
     }
 
-    ring_buf_init(&ringbuf, sizeof(ring_buffer), ring_buffer);
+    if (len > TX_BUF_SIZE)
+    {
+        STATS_INCN(usb_stats, tx_drops, len);
+        return -EMSGSIZE;
+    }
 
-    LOG_INF("Wait for DTR");
+    k_mutex_lock(&tx_mutex, K_FOREVER);
 
-    while (true)
+    while (ring_buf_space_get(&tx_ringbuf) < len)
     {
-        uint32_t dtr = 0U;
-
-        uart_line_ctrl_get(uart_dev, UART_LINE_CTRL_DTR, &dtr);
-        if (dtr)
+        if (k_sem_take(&tx_space_sem, sys_timepoint_timeout(end)))
         {
+            err = -EAGAIN;
             break;
         }
-        else
-        {
-            /* Give CPU resources to low priority threads. */
-            k_sleep(K_MSEC(100));
-        }
     }
 
-    LOG_INF("DTR set");
-
-    /* They are optional, we use them to test the interrupt endpoint */
-    ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DCD, 1);
-    if (ret)
+    if (!err)
     {
-        LOG_WRN("Failed to set DCD, ret code %d", ret);
+        ring_buf_put(&tx_ringbuf, buf, len);
+        uart_irq_tx_enable(uart_dev);
     }
-
-    ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DSR, 1);
-    if (ret)
+    else
     {
-        LOG_WRN("Failed to set DSR, ret code %d", ret);
+        STATS_INCN(usb_stats, tx_drops, len);
     }
 
-    /* Wait 100ms for the host to do all settings */
-    k_msleep(100);
+    k_mutex_unlock(&tx_mutex);
+
+    return err;
+}
+
+static void port_open(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(port_work, port_open);
+
+/* Polls DTR, then gives the host time to finish its settings before the
+ * port is opened.
+ */
+static void port_open(struct k_work* work)
+{
+    static bool dtr_seen;
+    uint32_t dtr = 0U;
+    int ret;
+
+    if (!dtr_seen)
+    {
+        uart_line_ctrl_get(uart_dev, UART_LINE_CTRL_DTR, &dtr);
+        if (!dtr)
+        {
+            k_work_schedule(&port_work, K_MSEC(DTR_POLL_MS));
+            return;
+        }
+
+        LOG_INF("DTR set");
+        dtr_seen = true;
+
+        /* They are optional, we use them to test the interrupt endpoint */
+        ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DCD, 1);
+        if (ret)
+        {
+            LOG_WRN("Failed to set DCD, ret code %d", ret);
+        }
+
+        ret = uart_line_ctrl_set(uart_dev, UART_LINE_CTRL_DSR, 1);
+        if (ret)
+        {
+            LOG_WRN("Failed to set DSR, ret code %d", ret);
+        }
+
+        k_work_schedule(&port_work, K_MSEC(HOST_SETUP_MS));
+        return;
+    }
 
     print_baudrate(uart_dev);
 
     uart_irq_callback_set(uart_dev, interrupt_handler);
 
+    host_open = true;
+
     /* Enable rx interrupts */
     uart_irq_rx_enable(uart_dev);
+}
+
+static int usb_uart_init(void)
+{
+    int ret;
+
+    STATS_INIT_AND_REG(usb_stats, STATS_SIZE_32, "usb");
+
+    if (!device_is_ready(uart_dev))
+    {
+        LOG_ERR("CDC ACM device not ready");
+        return -ENODEV;
+    }
+
+    ret = usb_enable(NULL);
+    if (ret != 0)
+    {
+        LOG_ERR("Failed to enable USB");
+        return ret;
+    }
+
+    LOG_INF("Wait for DTR");
+    k_work_schedule(&port_work, K_NO_WAIT);
 
     return 0;
 }
 
-K_THREAD_DEFINE(uart_thread_id, STACK_SIZE, uart_thread, NULL, NULL, NULL, THREAD_PRIORITY, 0, 0);
+SYS_INIT(usb_uart_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
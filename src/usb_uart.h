@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef USB_UART_H
+#define USB_UART_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/** @brief Called from the ISR when received bytes are ready to be read. */
+typedef void (*usb_uart_rx_cb_t)(void);
+
+/** @brief Set the receive notification, before the port is opened. */
+void usb_uart_rx_callback_set(usb_uart_rx_cb_t cb);
+
+/**
+ * @brief Claim received bytes in place, does not block.
+ *
+ * @return Number of contiguous bytes at @p data, 0 if nothing was received.
+ */
+size_t usb_uart_read_claim(const uint8_t** data);
+
+/** @brief Release @p len claimed bytes to the receiver. */
+void usb_uart_read_finish(size_t len);
+
+/** @brief Free space of the receive buffer in bytes. */
+size_t usb_uart_rx_space(void);
+
+/**
+ * @brief Queue @p len bytes for sending, all or nothing.
+ *
+ * @retval -EAGAIN There was no room for @p len bytes within @p timeout.
+ * @retval -ENOTCONN No host has the port open.
+ */
+int usb_uart_write(const uint8_t* buf, size_t len, k_timeout_t timeout);
+
+#endif // USB_UART_H
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ws2812_encode.h"
+
+/* Four I2S bits per WS2812 bit of a nibble, most significant bit first */
+#define SYM(bit) ((bit) ? 0xeU : 0x8U)
+#define NIBBLE(n) ((SYM((n) & 8) << 12) | (SYM((n) & 4) << 8) | (SYM((n) & 2) << 4) | SYM((n) & 1))
+
+static const uint16_t nibble_lut[16] = {
+    NIBBLE(0),  NIBBLE(1),  NIBBLE(2),  NIBBLE(3),  NIBBLE(4),  NIBBLE(5),  NIBBLE(6),  NIBBLE(7),
+    NIBBLE(8),  NIBBLE(9),  NIBBLE(10), NIBBLE(11), NIBBLE(12), NIBBLE(13), NIBBLE(14), NIBBLE(15),
+};
+
+size_t ws2812_encode(uint32_t* out,
+                     const uint8_t* pixels,
+                     size_t count,
+                     size_t stride,
+                     const uint8_t* order,
+                     size_t channels)
+{
+    uint32_t* word = out;
+
+    for (size_t i = 0; i < count; i++, pixels += stride)
+    {
+        for (size_t c = 0; c < channels; c++)
+        {
+            uint8_t value = pixels[order[c]];
+
+            /* The left sample (low half word) goes out first */
+            *word++ = nibble_lut[value >> 4] | ((uint32_t)nibble_lut[value & 0xf] << 16);
+        }
+    }
+
+    for (size_t i = 0; i < WS2812_ENCODE_RESET_WORDS; i++)
+    {
+        *word++ = 0;
+    }
+
+    return word - out;
+}
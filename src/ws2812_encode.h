@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WS2812_ENCODE_H
+#define WS2812_ENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every WS2812 bit is sent as four I2S bits at 3.2 MHz, 1000 for a zero and
+ * 1110 for a one. A color byte is one 32 bit word of 16 bit stereo data.
+ * Kept free of Zephyr headers so the encoder also builds on the host.
+ */
+#define WS2812_ENCODE_BIT_RATE 3200000U
+
+/* >280 us low latches the pixels, 30 words at 3.2 MHz are 300 us */
+#define WS2812_ENCODE_RESET_WORDS 30U
+
+#define WS2812_ENCODE_WORDS(pixels, channels) ((pixels) * (channels) + WS2812_ENCODE_RESET_WORDS)
+
+/**
+ * @brief Encode pixels into the I2S bit pattern, followed by the reset.
+ *
+ * @param out WS2812_ENCODE_WORDS(count, channels) words.
+ * @param pixels First color byte of the first pixel.
+ * @param stride Bytes from one pixel to the next.
+ * @param order Offset of each channel from @p pixels in wire order.
+ *
+ * @return Number of words written.
+ */
+size_t ws2812_encode(uint32_t* out,
+                     const uint8_t* pixels,
+                     size_t count,
+                     size_t stride,
+                     const uint8_t* order,
+                     size_t channels);
+
+#endif // WS2812_ENCODE_H
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief WS2812 output over I2S EasyDMA
+ *
+ * Frames are encoded into one of two memory slab blocks and queued on the
+ * I2S peripheral, which streams them without the CPU. The driver releases a
+ * block once it has been sent, so frame N+1 is encoded into the other block
+ * while frame N is on the wire.
+ *
+ * Every frame is started and drained on its own, the stream never runs dry
+ * mid frame. The driver takes no block while a frame drains, so a frame
+ * encoded meanwhile is kept and submitted from a work item once the wire is
+ * free. A newer frame replaces it in the same block.
+ */
+
+#include "ws2812_i2s.h"
+#include "ws2812_encode.h"
+#include <zephyr/drivers/i2s.h>
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(ws2812_i2s, LOG_LEVEL_INF);
+
+#define STRIP_NODE     DT_ALIAS(led_strip)
+#define STRIP_PIXELS   DT_PROP(STRIP_NODE, chain_length)
+#define STRIP_CHANNELS DT_PROP_LEN(STRIP_NODE, color_mapping)
+#define BLOCK_SIZE     (WS2812_ENCODE_WORDS(STRIP_PIXELS, STRIP_CHANNELS) * sizeof(uint32_t))
+
+/* 16 bit stereo, 32 bits per frame clock */
+#define FRAME_CLK_FREQ (WS2812_ENCODE_BIT_RATE / 32)
+
+/* Time a block takes on the wire */
+#define BLOCK_US ((uint32_t)((uint64_t)BLOCK_SIZE * 8 * USEC_PER_SEC / WS2812_ENCODE_BIT_RATE))
+
+BUILD_ASSERT(STRIP_CHANNELS == 3, "Only RGB strips are supported");
+
+static const struct device* const i2s = DEVICE_DT_GET(DT_ALIAS(led_strip_i2s));
+
+K_MEM_SLAB_DEFINE_STATIC(ws2812_slab, BLOCK_SIZE, 2, 4);
+
+STATS_SECT_START(ws2812_stats)
+STATS_SECT_ENTRY32(frames)
+STATS_SECT_ENTRY32(deferred)
+STATS_SECT_ENTRY32(busy)
+STATS_SECT_ENTRY32(errors)
+STATS_SECT_ENTRY32(encode_us)
+STATS_SECT_END;
+
+STATS_NAME_START(ws2812_stats)
+STATS_NAME(ws2812_stats, frames)
+STATS_NAME(ws2812_stats, deferred)
+STATS_NAME(ws2812_stats, busy)
+STATS_NAME(ws2812_stats, errors)
+STATS_NAME(ws2812_stats, encode_us)
+STATS_NAME_END(ws2812_stats);
+
+static STATS_SECT_DECL(ws2812_stats) ws2812_stats;
+
+/* Offsets of the wire order channels from led_rgb.r */
+static uint8_t order[STRIP_CHANNELS];
+
+/* Encoded frame waiting for the previous one to drain */
+static void* pending;
+static K_MUTEX_DEFINE(pending_lock);
+
+static void retry_handler(struct k_work* work);
+
+static K_WORK_DELAYABLE_DEFINE(retry_work, retry_handler);
+
+static int color_offset(uint8_t color_id)
+{
+    switch (color_id)
+    {
+    case LED_COLOR_ID_RED:
+        return offsetof(struct led_rgb, r) - offsetof(struct led_rgb, r);
+    case LED_COLOR_ID_GREEN:
+        return offsetof(struct led_rgb, g) - offsetof(struct led_rgb, r);
+    case LED_COLOR_ID_BLUE:
+        return offsetof(struct led_rgb, b) - offsetof(struct led_rgb, r);
+    default:
+        return -EINVAL;
+    }
+}
+
+/* Hand the pending frame to the driver, called with pending_lock held */
+static int pending_submit(void)
+{
+    int err;
+
+    /* The previous frame still holds its block until it is drained */
+    if (k_mem_slab_num_used_get(&ws2812_slab) > 1)
+    {
+        k_work_reschedule(&retry_work, K_USEC(BLOCK_US));
+        return 0;
+    }
+
+    /* Released just before the stream reached the ready state */
+    err = i2s_write(i2s, pending, BLOCK_SIZE);
+    if (err == -EIO)
+    {
+        k_work_reschedule(&retry_work, K_USEC(BLOCK_US / 8));
+        return 0;
+    }
+
+    if (err)
+    {
+        k_mem_slab_free(&ws2812_slab, pending);
+        pending = NULL;
+        STATS_INC(ws2812_stats, errors);
+        return err;
+    }
+
+    /* The driver owns the block now */
+    pending = NULL;
+
+    err = i2s_trigger(i2s, I2S_DIR_TX, I2S_TRIGGER_START);
+    if (!err)
+    {
+        err = i2s_trigger(i2s, I2S_DIR_TX, I2S_TRIGGER_DRAIN);
+    }
+
+    if (err)
+    {
+        STATS_INC(ws2812_stats, errors);
+        (void)i2s_trigger(i2s, I2S_DIR_TX, I2S_TRIGGER_DROP);
+        return err;
+    }
+
+    STATS_INC(ws2812_stats, frames);
+
+    return 0;
+}
+
+static void retry_handler(struct k_work* work)
+{
+    k_mutex_lock(&pending_lock, K_FOREVER);
+
+    if (pending)
+    {
+        (void)pending_submit();
+    }
+
+    k_mutex_unlock(&pending_lock);
+}
+
+int ws2812_i2s_update(const struct led_rgb* pixels, size_t count)
+{
+    uint32_t start;
+    int err;
+
+    if (count > STRIP_PIXELS)
+    {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&pending_lock, K_FOREVER);
+
+    if (pending)
+    {
+        /* Not sent yet, the new frame takes its place */
+        STATS_INC(ws2812_stats, busy);
+    }
+    else if (k_mem_slab_alloc(&ws2812_slab, &pending, K_NO_WAIT))
+    {
+        k_mutex_unlock(&pending_lock);
+        STATS_INC(ws2812_stats, busy);
+        return -EBUSY;
+    }
+
+    start = k_cycle_get_32();
+    ws2812_encode(pending, &pixels->r, count, sizeof(*pixels), order, STRIP_CHANNELS);
+    STATS_SET(ws2812_stats, encode_us, k_cyc_to_us_floor32(k_cycle_get_32() - start));
+
+    err = pending_submit();
+    if (!err && pending)
+    {
+        STATS_INC(ws2812_stats, deferred);
+    }
+
+    k_mutex_unlock(&pending_lock);
+
+    return err;
+}
+
+int ws2812_i2s_init(void)
+{
+    static const uint8_t color_mapping[] = DT_PROP(STRIP_NODE, color_mapping);
+    struct i2s_config config = {
+        .word_size = 16,
+        .channels = 2,
+        .format = I2S_FMT_DATA_FORMAT_LEFT_JUSTIFIED,
+        .options = I2S_OPT_BIT_CLK_MASTER | I2S_OPT_FRAME_CLK_MASTER,
+        .frame_clk_freq = FRAME_CLK_FREQ,
+        .mem_slab = &ws2812_slab,
+        .block_size = BLOCK_SIZE,
+        .timeout = 0,
+    };
+    int err;
+
+    if (!device_is_ready(i2s))
+    {
+        LOG_ERR("I2S device not ready");
+        return -ENODEV;
+    }
+
+    for (int i = 0; i < STRIP_CHANNELS; i++)
+    {
+        err = color_offset(color_mapping[i]);
+        if (err < 0)
+        {
+            return err;
+        }
+        order[i] = err;
+    }
+
+    err = i2s_configure(i2s, I2S_DIR_TX, &config);
+    if (err)
+    {
+        LOG_ERR("I2S configure failed (err %d)", err);
+        return err;
+    }
+
+    return STATS_INIT_AND_REG(ws2812_stats, STATS_SIZE_32, "ws2812");
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WS2812_I2S_H
+#define WS2812_I2S_H
+
+#include <stddef.h>
+#include <zephyr/drivers/led_strip.h>
+
+int ws2812_i2s_init(void);
+
+/**
+ * @brief Encode a frame and start streaming it, does not wait for the wire.
+ *
+ * While the previous frame is still being sent the frame is kept and sent
+ * right after it, a newer frame replaces it.
+ *
+ * @retval -EBUSY No block is free, try again next frame.
+ */
+int ws2812_i2s_update(const struct led_rgb* pixels, size_t count);
+
+#endif // WS2812_I2S_H
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Debouncers and gesture engine on the GPIO emulator
+ *
+ * Each test drives the emulated pins with gpio_emul_input_set() and checks
+ * the events the gesture engine hands to the application handler: their
+ * order, the time of the first edge they carry and when they arrived.
+ * native_sim time only moves while every thread sleeps, so an edge happens
+ * at the uptime read right after setting the pin and the timing is the same
+ * on every run. Delays are one tick late at most, see SLACK_MS.
+ */
+
+#include "button.h"
+#include "gesture.h"
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#define BUTTONS_NODE DT_COMPAT_GET_ANY_STATUS_OKAY(rgbled_gpio_keys)
+
+/* Codes of the buttons in boards/native_sim.overlay */
+#define BTN_TRAILING    0
+#define BTN_CHORD_A     1
+#define BTN_CHORD_B     2
+#define BTN_LEADING     3
+#define BTN_INTEGRATING 4
+
+#define DEBOUNCE_MS    20
+#define INTEGRATING_MS 10
+
+/* A relative timeout expires up to one tick after its time */
+#define SLACK_MS 2
+
+/* Time for the gesture windows of the previous test to close */
+#define SETTLE_MS 1000
+
+#define BUTTON_SPEC(node) GPIO_DT_SPEC_GET(node, gpios),
+
+/* Indexed by code, the overlay numbers the buttons in order */
+static const struct gpio_dt_spec pins[] = { DT_FOREACH_CHILD_STATUS_OKAY(BUTTONS_NODE, BUTTON_SPEC) };
+
+static const uint32_t chords[] = {
+    BIT(BTN_CHORD_A) | BIT(BTN_CHORD_B),
+};
+
+struct event
+{
+    enum button_evt evt;
+    uint32_t code;
+    /* Edge time the event carries */
+    uint32_t ts;
+    /* Uptime when the handler got it */
+    uint32_t at;
+};
+
+K_MSGQ_DEFINE(events, sizeof(struct event), 32, 4);
+
+/* Events that did not fit, the handler runs on the input workqueue */
+static atomic_t lost;
+
+static void record(enum button_evt evt, uint32_t code, uint32_t timestamp)
+{
+    struct event event = {
+        .evt = evt,
+        .code = code,
+        .ts = timestamp,
+        .at = k_uptime_get_32(),
+    };
+
+    if (k_msgq_put(&events, &event, K_NO_WAIT))
+    {
+        atomic_inc(&lost);
+    }
+}
+
+/* Sets the level of a button pin, returns the time of the edge */
+static uint32_t pin_set(uint32_t code, int pressed)
+{
+    zassert_ok(gpio_emul_input_set(pins[code].port, pins[code].pin, pressed));
+
+    return k_uptime_get_32();
+}
+
+static struct event next(void)
+{
+    struct event event;
+
+    zassert_ok(k_msgq_get(&events, &event, K_NO_WAIT), "missing event");
+
+    return event;
+}
+
+/* Next event must be @p evt of @p code with its first edge at @p ts,
+ * delivered at @p at
+ */
+static void expect(enum button_evt evt, uint32_t code, uint32_t ts, uint32_t at)
+{
+    struct event event = next();
+
+    zassert_equal(event.evt, evt, "event %d, expected %d", event.evt, evt);
+    zassert_equal(event.code, code, "code 0x%x, expected 0x%x", event.code, code);
+    zassert_equal(event.ts, ts, "edge at %u ms, expected %u ms", event.ts, ts);
+    zassert_within(event.at, at, SLACK_MS, "delivered at %u ms, expected %u ms", event.at, at);
+}
+
+static void expect_none(void)
+{
+    struct event event;
+
+    zassert_equal(atomic_get(&lost), 0, "event queue full");
+    zassert_not_ok(k_msgq_get(&events, &event, K_NO_WAIT), "unexpected event %d of 0x%x", event.evt, event.code);
+}
+
+/* Trailing: bounces restart the window, the event carries the first edge */
+ZTEST(button, test_trailing_bounce)
+{
+    uint32_t first;
+    uint32_t last;
+
+    first = pin_set(BTN_TRAILING, 1);
+    k_msleep(1);
+    pin_set(BTN_TRAILING, 0);
+    k_msleep(2);
+    pin_set(BTN_TRAILING, 1);
+    k_msleep(1);
+    pin_set(BTN_TRAILING, 0);
+    k_msleep(1);
+    last = pin_set(BTN_TRAILING, 1);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_PRESSED, BTN_TRAILING, first, last + DEBOUNCE_MS);
+    expect_none();
+
+    first = pin_set(BTN_TRAILING, 0);
+    k_msleep(1);
+    pin_set(BTN_TRAILING, 1);
+    k_msleep(1);
+    last = pin_set(BTN_TRAILING, 0);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_RELEASED, BTN_TRAILING, first, last + DEBOUNCE_MS);
+    expect_none();
+}
+
+/* Leading: the first edge is reported at once, bounces in the lockout not */
+ZTEST(button, test_leading_bounce)
+{
+    uint32_t press;
+    uint32_t release;
+
+    press = pin_set(BTN_LEADING, 1);
+    k_msleep(1);
+    pin_set(BTN_LEADING, 0);
+    k_msleep(1);
+    pin_set(BTN_LEADING, 1);
+    k_msleep(50);
+
+    expect(BUTTON_EVT_PRESSED, BTN_LEADING, press, press);
+    expect_none();
+
+    release = pin_set(BTN_LEADING, 0);
+    k_msleep(1);
+    pin_set(BTN_LEADING, 1);
+    k_msleep(1);
+    pin_set(BTN_LEADING, 0);
+    k_msleep(50);
+
+    expect(BUTTON_EVT_RELEASED, BTN_LEADING, release, release);
+    expect_none();
+}
+
+/* Leading: a level that changed during the lockout is reported at its end */
+ZTEST(button, test_leading_toggle_in_lockout)
+{
+    struct event event;
+    uint32_t press;
+
+    press = pin_set(BTN_LEADING, 1);
+    k_msleep(4);
+    pin_set(BTN_LEADING, 0);
+    k_msleep(4);
+    pin_set(BTN_LEADING, 1);
+    k_msleep(4);
+    pin_set(BTN_LEADING, 0);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_PRESSED, BTN_LEADING, press, press);
+
+    event = next();
+    zassert_equal(event.evt, BUTTON_EVT_RELEASED);
+    zassert_equal(event.code, BTN_LEADING);
+    zassert_within(event.ts, press + DEBOUNCE_MS, SLACK_MS, "edge at %u ms", event.ts);
+    zassert_equal(event.at, event.ts);
+    expect_none();
+}
+
+/* Clean presses past the lockout, every second one is a double click */
+ZTEST(button, test_rapid_toggles)
+{
+    uint32_t press[4];
+    uint32_t release[4];
+
+    for (int i = 0; i < ARRAY_SIZE(press); i++)
+    {
+        press[i] = pin_set(BTN_LEADING, 1);
+        k_msleep(30);
+        release[i] = pin_set(BTN_LEADING, 0);
+        k_msleep(30);
+    }
+    k_msleep(100);
+
+    for (int i = 0; i < ARRAY_SIZE(press); i++)
+    {
+        expect(BUTTON_EVT_PRESSED, BTN_LEADING, press[i], press[i]);
+        if (i % 2)
+        {
+            expect(BUTTON_EVT_DOUBLE_CLICK, BTN_LEADING, press[i], press[i]);
+        }
+        expect(BUTTON_EVT_RELEASED, BTN_LEADING, release[i], release[i]);
+    }
+    expect_none();
+}
+
+/* Integrating: a short glitch is averaged away, a held level is not */
+ZTEST(button, test_integrating_glitch)
+{
+    struct event event;
+    uint32_t press;
+    uint32_t release;
+
+    pin_set(BTN_INTEGRATING, 1);
+    k_msleep(3);
+    pin_set(BTN_INTEGRATING, 0);
+    k_msleep(50);
+
+    expect_none();
+
+    /* INTEGRATING_MS samples, a sample period is one or two ticks */
+    press = pin_set(BTN_INTEGRATING, 1);
+    k_msleep(100);
+
+    event = next();
+    zassert_equal(event.evt, BUTTON_EVT_PRESSED);
+    zassert_equal(event.code, BTN_INTEGRATING);
+    zassert_equal(event.ts, press, "edge at %u ms, expected %u ms", event.ts, press);
+    zassert_between_inclusive(event.at, press + INTEGRATING_MS - 1, press + 2 * INTEGRATING_MS + SLACK_MS);
+
+    release = pin_set(BTN_INTEGRATING, 0);
+    k_msleep(100);
+
+    event = next();
+    zassert_equal(event.evt, BUTTON_EVT_RELEASED);
+    zassert_equal(event.code, BTN_INTEGRATING);
+    zassert_equal(event.ts, release, "edge at %u ms, expected %u ms", event.ts, release);
+    zassert_between_inclusive(event.at, release + INTEGRATING_MS - 1, release + 2 * INTEGRATING_MS + SLACK_MS);
+    expect_none();
+}
+
+/* Both chord buttons in the window: one chord event, no presses or releases */
+ZTEST(button, test_chord)
+{
+    uint32_t first;
+    uint32_t second;
+
+    first = pin_set(BTN_CHORD_A, 1);
+    k_msleep(10);
+    second = pin_set(BTN_CHORD_B, 1);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_CHORD, BIT(BTN_CHORD_A) | BIT(BTN_CHORD_B), first, second);
+    expect_none();
+
+    pin_set(BTN_CHORD_A, 0);
+    pin_set(BTN_CHORD_B, 0);
+    k_msleep(100);
+
+    expect_none();
+}
+
+/* The second chord button after the window: two plain presses, each held
+ * back for the chord window
+ */
+ZTEST(button, test_chord_late)
+{
+    uint32_t first;
+    uint32_t second;
+    uint32_t release;
+
+    first = pin_set(BTN_CHORD_A, 1);
+    k_msleep(CONFIG_APP_GESTURE_CHORD_MS + 30);
+    second = pin_set(BTN_CHORD_B, 1);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_PRESSED, BTN_CHORD_A, first, first + CONFIG_APP_GESTURE_CHORD_MS);
+    expect(BUTTON_EVT_PRESSED, BTN_CHORD_B, second, second + CONFIG_APP_GESTURE_CHORD_MS);
+    expect_none();
+
+    release = pin_set(BTN_CHORD_A, 0);
+    pin_set(BTN_CHORD_B, 0);
+    k_msleep(100);
+
+    expect(BUTTON_EVT_RELEASED, BTN_CHORD_A, release, release);
+    expect(BUTTON_EVT_RELEASED, BTN_CHORD_B, release, release);
+    expect_none();
+}
+
+ZTEST(button, test_long_press)
+{
+    uint32_t press;
+    uint32_t release;
+
+    press = pin_set(BTN_LEADING, 1);
+    k_msleep(CONFIG_APP_GESTURE_LONG_PRESS_MS + 200);
+    release = pin_set(BTN_LEADING, 0);
+    k_msleep(50);
+
+    expect(BUTTON_EVT_PRESSED, BTN_LEADING, press, press);
+    expect(BUTTON_EVT_LONG_PRESS, BTN_LEADING, press, press + CONFIG_APP_GESTURE_LONG_PRESS_MS);
+    expect(BUTTON_EVT_RELEASED, BTN_LEADING, release, release);
+    expect_none();
+}
+
+static void* button_setup(void)
+{
+    for (int i = 0; i < ARRAY_SIZE(pins); i++)
+    {
+        zassert_true(gpio_is_ready_dt(&pins[i]));
+    }
+
+    zassert_ok(gesture_init(chords, ARRAY_SIZE(chords), record));
+    buttons_init(gesture_button_event);
+
+    return NULL;
+}
+
+static void button_before(void* fixture)
+{
+    k_msleep(SETTLE_MS);
+    k_msgq_purge(&events);
+    atomic_clear(&lost);
+}
+
+ZTEST_SUITE(button, NULL, button_setup, button_before, NULL, NULL);
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2024-2025 Robert Wessels
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief ws2812_encode() against a bit-by-bit reference
+ *
+ * The reference builds the I2S bit stream one WS2812 bit at a time, the way
+ * the wire sees it: four bits per WS2812 bit, 1000 for a zero and 1110 for a
+ * one, most significant bit first, the left sample (low half word) of each
+ * word first.
+ */
+
+#include "ws2812_encode.h"
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#define PIXELS   4
+#define CHANNELS 3
+
+/* Places the next wire bit into the words */
+struct bit_writer
+{
+    uint32_t* words;
+    size_t pos;
+};
+
+static void bit_put(struct bit_writer* w, bool bit)
+{
+    size_t word = w->pos / 32;
+    size_t in_word = w->pos % 32;
+    /* Bits 0..15 of a word are the left sample, 16..31 the right one */
+    size_t half = in_word / 16;
+    size_t shift = half * 16 + 15 - in_word % 16;
+
+    if (bit)
+    {
+        w->words[word] |= BIT(shift);
+    }
+    w->pos++;
+}
+
+static size_t reference_encode(uint32_t* out,
+                               const uint8_t* pixels,
+                               size_t count,
+                               size_t stride,
+                               const uint8_t* order,
+                               size_t channels)
+{
+    struct bit_writer w = { .words = out };
+    size_t words = WS2812_ENCODE_WORDS(count, channels);
+
+    memset(out, 0, words * sizeof(uint32_t));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t c = 0; c < channels; c++)
+        {
+            uint8_t value = pixels[i * stride + order[c]];
+
+            for (int bit = 7; bit >= 0; bit--)
+            {
+                bool one = value & BIT(bit);
+
+                bit_put(&w, true);
+                bit_put(&w, one);
+                bit_put(&w, one);
+                bit_put(&w, false);
+            }
+        }
+    }
+
+    /* The reset is all zeros, already there */
+    return words;
+}
+
+ZTEST(ws2812_encode, test_all_values)
+{
+    static const uint8_t order[] = { 0 };
+    uint32_t out[WS2812_ENCODE_WORDS(1, 1)];
+    uint32_t ref[WS2812_ENCODE_WORDS(1, 1)];
+
+    for (int value = 0; value < 256; value++)
+    {
+        uint8_t pixel = value;
+
+        memset(out, 0xa5, sizeof(out));
+        zassert_equal(ws2812_encode(out, &pixel, 1, 1, order, 1), ARRAY_SIZE(out));
+        reference_encode(ref, &pixel, 1, 1, order, 1);
+        zassert_mem_equal(out, ref, sizeof(ref), "value 0x%02x", value);
+    }
+}
+
+ZTEST(ws2812_encode, test_channel_order)
+{
+    /* Wire order of a GRB strip, offsets from r of r, g, b, padding */
+    static const uint8_t grb[] = { 1, 0, 2 };
+    static const uint8_t pixels[PIXELS][4] = {
+        { 0x01, 0x80, 0xff, 0x00 },
+        { 0x12, 0x34, 0x56, 0x00 },
+        { 0x00, 0x00, 0x00, 0x77 },
+        { 0xfe, 0x7f, 0xaa, 0x55 },
+    };
+    uint32_t out[WS2812_ENCODE_WORDS(PIXELS, CHANNELS)];
+    uint32_t ref[WS2812_ENCODE_WORDS(PIXELS, CHANNELS)];
+
+    zassert_equal(ws2812_encode(out, &pixels[0][0], PIXELS, sizeof(pixels[0]), grb, CHANNELS), ARRAY_SIZE(out));
+    reference_encode(ref, &pixels[0][0], PIXELS, sizeof(pixels[0]), grb, CHANNELS);
+    zassert_mem_equal(out, ref, sizeof(ref));
+
+    /* Green goes out first: 0x80 is 1110 then seven times 1000 */
+    zassert_equal(out[0], 0x8888e888U);
+}
+
+ZTEST(ws2812_encode, test_reset_tail)
+{
+    static const uint8_t order[] = { 0, 1, 2 };
+    static const uint8_t pixels[PIXELS * CHANNELS] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                                       0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint32_t out[WS2812_ENCODE_WORDS(PIXELS, CHANNELS) + 1];
+    size_t words;
+
+    memset(out, 0xa5, sizeof(out));
+    words = ws2812_encode(out, pixels, PIXELS, CHANNELS, order, CHANNELS);
+
+    zassert_equal(words, PIXELS * CHANNELS + WS2812_ENCODE_RESET_WORDS);
+    for (size_t i = 0; i < PIXELS * CHANNELS; i++)
+    {
+        zassert_equal(out[i], 0xeeeeeeeeU, "word %zu", i);
+    }
+    for (size_t i = PIXELS * CHANNELS; i < words; i++)
+    {
+        zassert_equal(out[i], 0, "reset word %zu", i);
+    }
+    zassert_equal(out[words], 0xa5a5a5a5U, "wrote past the end");
+
+    /* >280 us low latches the pixels */
+    zassert_true(WS2812_ENCODE_RESET_WORDS * 32ULL * USEC_PER_SEC / WS2812_ENCODE_BIT_RATE > 280);
+}
+
+ZTEST_SUITE(ws2812_encode, NULL, NULL, NULL, NULL, NULL);